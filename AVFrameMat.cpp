@@ -0,0 +1,155 @@
+// Presents decoded frames to OpenCV: as "cv::Mat"s that share the frames' own buffers, or converted to (pooled) BGR "cv::Mat"s.
+// Implementation
+
+#include "AVFrameMat.hh"
+
+extern "C"
+{
+#include "libavutil/pixdesc.h"
+}
+
+#define BGR_MAT_ALIGNMENT 64 // of each row of a converted "cv::Mat"
+
+// Define a "cv::MatAllocator" for "cv::Mat"s whose data is part of an "AVBufferRef".  It never allocates; it just unreferences
+// the buffer once the last "cv::Mat" that shares it has been released.  (This is the approach that OpenCV's own Python
+// bindings take to share NumPy arrays' memory.)
+
+class AVBufferMatAllocator : public cv::MatAllocator
+{
+public:
+#if CV_VERSION_MAJOR >= 4
+  typedef cv::AccessFlag AccessFlags;
+#else
+  typedef int AccessFlags;
+#endif
+
+  cv::UMatData *allocate(int, const int *, int, void *, size_t *, AccessFlags, cv::UMatUsageFlags) const CV_OVERRIDE
+  {
+    return NULL; // (only "AVFrameMat::wrapBuffer()" creates our "cv::Mat"s; OpenCV uses its default allocator for others)
+  }
+  bool allocate(cv::UMatData *, AccessFlags, cv::UMatUsageFlags) const CV_OVERRIDE
+  {
+    return false;
+  }
+  void deallocate(cv::UMatData *u) const CV_OVERRIDE
+  {
+    if (u != NULL && u->refcount == 0)
+    {
+      AVBufferRef *buffer = (AVBufferRef *)u->userdata;
+      av_buffer_unref(&buffer);
+      delete u;
+    }
+  }
+};
+
+static AVBufferMatAllocator bufferMatAllocator; // (stateless, so shared by all threads)
+
+cv::Mat AVFrameMat::wrapBuffer(AVBufferRef *buffer, uint8_t *data, int rows, int cols, int type, size_t step)
+{
+  AVBufferRef *reference = av_buffer_ref(buffer);
+  if (reference == NULL)
+    return cv::Mat();
+
+  cv::Mat mat(rows, cols, type, data, step);
+  cv::UMatData *u = new cv::UMatData(&bufferMatAllocator);
+  u->data = u->origdata = reference->data;
+  u->size = reference->size;
+  u->userdata = reference;
+  mat.u = u;
+  mat.allocator = &bufferMatAllocator;
+  mat.addref(); // (so that releasing the last "cv::Mat" unreferences the buffer)
+  return mat;
+}
+
+cv::Mat AVFrameMat::wrapPlane(AVFrame const *frame, unsigned plane)
+{
+  AVPixFmtDescriptor const *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+  if (desc == NULL || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_RGB)) != 0 ||
+      plane >= (unsigned)av_pix_fmt_count_planes((AVPixelFormat)frame->format))
+    return cv::Mat();
+
+  // Find the plane's components (to get its number of channels), and whether it's a chroma plane (to get its size):
+  unsigned numChannels = 0, depth = 8;
+  bool isLuma = false, isChroma = false;
+  for (unsigned i = 0; i < desc->nb_components; ++i)
+  {
+    if ((unsigned)desc->comp[i].plane != plane)
+      continue;
+    ++numChannels;
+    depth = desc->comp[i].depth;
+    isLuma = isLuma || i == 0;
+    isChroma = isChroma || i == 1 || i == 2;
+  }
+  if (numChannels == 0 || depth > 16)
+    return cv::Mat();
+  if (isLuma && isChroma)
+    return cv::Mat(); // a packed format (e.g., YUYV422), whose chroma is subsampled within each row, which a "cv::Mat" can't describe
+  int rows = isChroma ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+  int cols = isChroma ? AV_CEIL_RSHIFT(frame->width, desc->log2_chroma_w) : frame->width;
+  int type = CV_MAKETYPE(depth > 8 ? CV_16U : CV_8U, numChannels);
+
+  AVBufferRef *buffer = av_frame_get_plane_buffer((AVFrame *)frame, plane);
+  if (buffer == NULL || frame->linesize[plane] <= 0)
+    return cv::Mat(); // (a frame that isn't reference-counted, or that's stored bottom-up)
+
+  return wrapBuffer(buffer, frame->data[plane], rows, cols, type, frame->linesize[plane]);
+}
+
+bool AVFrameMat::wrapPlanes(AVFrame const *frame, std::vector<cv::Mat> &planes)
+{
+  planes.clear();
+  int numPlanes = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+  for (int i = 0; i < numPlanes; ++i)
+  {
+    cv::Mat mat = wrapPlane(frame, i);
+    if (mat.empty())
+    {
+      planes.clear();
+      return false;
+    }
+    planes.push_back(mat);
+  }
+  return numPlanes > 0;
+}
+
+// Implementation of "BGRMatConverter":
+
+BGRMatConverter::BGRMatConverter()
+    : fSwsContext(NULL), fPool(NULL), fWidth(0), fHeight(0), fStep(0)
+{
+}
+
+BGRMatConverter::~BGRMatConverter()
+{
+  sws_freeContext(fSwsContext);
+  av_buffer_pool_uninit(&fPool); // (the pool itself is freed only once every "cv::Mat" from it has been released)
+}
+
+cv::Mat BGRMatConverter::convert(AVFrame const *frame)
+{
+  if (fPool == NULL || frame->width != fWidth || frame->height != fHeight)
+  {
+    av_buffer_pool_uninit(&fPool);
+    fWidth = frame->width;
+    fHeight = frame->height;
+    fStep = FFALIGN(3 * fWidth, BGR_MAT_ALIGNMENT);
+    fPool = av_buffer_pool_init(fStep * fHeight, NULL);
+    if (fPool == NULL)
+      return cv::Mat();
+  }
+  fSwsContext = sws_getCachedContext(fSwsContext, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                     frame->width, frame->height, AV_PIX_FMT_BGR24, SWS_BILINEAR, NULL, NULL, NULL);
+  if (fSwsContext == NULL)
+    return cv::Mat();
+
+  AVBufferRef *buffer = av_buffer_pool_get(fPool);
+  if (buffer == NULL)
+    return cv::Mat();
+  uint8_t *dst[1] = {buffer->data};
+  int dstStride[1] = {(int)fStep};
+  sws_scale(fSwsContext, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+
+  cv::Mat mat = AVFrameMat::wrapBuffer(buffer, buffer->data, fHeight, fWidth, CV_8UC3, fStep);
+  av_buffer_unref(&buffer); // (the "cv::Mat" holds its own reference)
+  return mat;
+}
@@ -0,0 +1,53 @@
+// Presents decoded frames to OpenCV: as "cv::Mat"s that share the frames' own buffers, or converted to (pooled) BGR "cv::Mat"s.
+// C++ header
+
+#ifndef _AV_FRAME_MAT_HH
+#define _AV_FRAME_MAT_HH
+
+#include "opencv2/core.hpp"
+#include <vector>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+#include "libswscale/swscale.h"
+}
+
+// Define functions that wrap a decoded frame's planes as "cv::Mat" headers, without copying them.  Each "cv::Mat" uses the
+// plane's real linesize as its step, and holds a reference to the (reference-counted) buffer that contains the plane, so
+// it - and any copies of it - stay valid after the frame callback returns (and the decoder reuses, or frees, the frame).
+// The planes are single-channel, except for those that interleave several components (e.g., NV12's "UV" plane is CV_8UC2).
+// Samples of more than 8 bits (e.g., YUV420P10LE) give CV_16U "cv::Mat"s.
+
+class AVFrameMat
+{
+public:
+  static cv::Mat wrapPlane(AVFrame const *frame, unsigned plane);
+  // returns an empty "cv::Mat" if the frame's buffers aren't reference-counted, or its format isn't a supported YUV format
+  // (i.e., a planar or semi-planar one; packed formats such as YUYV422 and UYVY422 aren't supported)
+  static bool wrapPlanes(AVFrame const *frame, std::vector<cv::Mat> &planes);
+  // wraps all of the frame's planes (e.g., Y, U and V, for YUV420P); returns false (leaving "planes" empty) on failure
+  static cv::Mat wrapBuffer(AVBufferRef *buffer, uint8_t *data, int rows, int cols, int type, size_t step);
+  // wraps the image at "data" (which must lie within "buffer"), taking a reference to "buffer" (also used by "BGRMatConverter")
+};
+
+// Define a class that converts frames to BGR24 "cv::Mat"s (e.g., for vision code that needs BGR).  Their memory comes from a
+// pool, which is reused once the application has released every "cv::Mat" that refers to it, so steady-state conversion
+// allocates nothing.  (Each stream that converts should have its own converter, because it isn't thread-safe.)
+
+class BGRMatConverter
+{
+public:
+  BGRMatConverter();
+  virtual ~BGRMatConverter();
+
+  cv::Mat convert(AVFrame const *frame); // returns an empty "cv::Mat" on failure
+
+private:
+  struct SwsContext *fSwsContext;
+  AVBufferPool *fPool; // of buffers for "fWidth" x "fHeight" images; replaced if the frame size changes
+  int fWidth, fHeight;
+  size_t fStep;
+};
+
+#endif
@@ -0,0 +1,92 @@
+// A pool of threads that decode video off the LIVE555 event loop(s).
+// Implementation
+
+#include "DecodeWorkerPool.hh"
+
+DecodeWorkerPool::DecodeWorkerPool(unsigned numWorkers)
+    : fStopping(False)
+{
+  if (numWorkers == 0)
+  {
+    numWorkers = std::thread::hardware_concurrency();
+    if (numWorkers == 0)
+      numWorkers = 1; // the core count isn't known
+  }
+  for (unsigned i = 0; i < numWorkers; ++i)
+  {
+    fWorkers.push_back(std::thread(&DecodeWorkerPool::workerLoop, this));
+  }
+}
+
+DecodeWorkerPool::~DecodeWorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStopping = True;
+  }
+  fWorkAvailable.notify_all();
+  for (unsigned i = 0; i < fWorkers.size(); ++i)
+  {
+    fWorkers[i].join();
+  }
+}
+
+void DecodeWorkerPool::submit(StreamDecoder *decoder)
+{
+  if (!decoder->enqueueAccessUnit())
+    return; // the stream is already scheduled (or the access unit was dropped)
+
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fReady.push_back(decoder);
+  }
+  fWorkAvailable.notify_one();
+}
+
+void DecodeWorkerPool::cancel(StreamDecoder *decoder)
+{
+  std::unique_lock<std::mutex> lock(fMutex);
+  while (fRunning.count(decoder) > 0) // (it's removed once its count reaches 0)
+  {
+    fDecoderIdle.wait(lock);
+  }
+  // (Only now, because a worker that has just finished with the decoder may have put it back in the ready queue.)
+  for (std::deque<StreamDecoder *>::iterator it = fReady.begin(); it != fReady.end();)
+  {
+    if (*it == decoder)
+      it = fReady.erase(it);
+    else
+      ++it;
+  }
+}
+
+void DecodeWorkerPool::workerLoop()
+{
+  std::unique_lock<std::mutex> lock(fMutex);
+  while (True)
+  {
+    while (!fStopping && fReady.empty())
+    {
+      fWorkAvailable.wait(lock);
+    }
+    if (fStopping)
+      break;
+
+    StreamDecoder *decoder = fReady.front();
+    fReady.pop_front();
+    ++fRunning[decoder];
+    lock.unlock();
+
+    Boolean moreQueued = decoder->decodeQueuedAccessUnits(DECODE_WORKER_BATCH);
+
+    lock.lock();
+    std::map<StreamDecoder *, unsigned>::iterator running = fRunning.find(decoder);
+    if (--running->second == 0)
+      fRunning.erase(running);
+    if (moreQueued)
+    {
+      fReady.push_back(decoder); // go to the back of the line, so that busy streams don't starve the others
+    }
+    fDecoderIdle.notify_all();
+  }
+}
@@ -0,0 +1,44 @@
+// A pool of threads that decode video off the LIVE555 event loop(s).
+// C++ header
+
+#ifndef _DECODE_WORKER_POOL_HH
+#define _DECODE_WORKER_POOL_HH
+
+#include "StreamDecoder.hh"
+#include <deque>
+#include <map>
+#include <thread>
+#include <condition_variable>
+
+// Define a pool of threads that decode video off the LIVE555 event loop, so that a large frame being decoded for one stream
+// never delays the reading of other streams' RTP packets.  Each stream is decoded by at most one worker at a time (so its
+// frames stay in order), and its decoded frames are delivered to its frame callback from that worker.
+
+class DecodeWorkerPool
+{
+public:
+  DecodeWorkerPool(unsigned numWorkers); // "numWorkers" == 0 means one per core
+  virtual ~DecodeWorkerPool();
+
+  void submit(StreamDecoder *decoder);
+  // called within an event loop (by the decoder), to queue the access unit that the decoder has just completed
+  void cancel(StreamDecoder *decoder);
+  // called within an event loop before "decoder" is deleted; waits until no worker is using it
+
+  unsigned numWorkers() const { return fWorkers.size(); }
+
+private:
+  void workerLoop();
+
+private:
+  std::mutex fMutex;
+  std::condition_variable fWorkAvailable, fDecoderIdle;
+  std::deque<StreamDecoder *> fReady;
+  std::map<StreamDecoder *, unsigned> fRunning;
+  // the number of workers that hold each decoder.  (Normally at most 1 - but a worker that has just emptied a decoder's queue
+  // still holds it briefly after the decoder can be submitted again, and taken by another worker.)
+  Boolean fStopping;
+  std::vector<std::thread> fWorkers;
+};
+
+#endif
@@ -0,0 +1,62 @@
+// A latest-frame-wins mailbox, for handing a stream's decoded frames to a consumer that may be slower than the stream.
+// Implementation
+
+#include "FrameMailbox.hh"
+#include <stddef.h>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+}
+
+#define FRAME_MAILBOX_FRESH 0x4 // set in "fSharedSlot" (above the slot index) iff the shared slot holds a frame that hasn't been taken
+#define FRAME_MAILBOX_SLOT_MASK 0x3
+
+FrameMailbox::FrameMailbox()
+    : fProducerSlot(0), fConsumerSlot(1), fSharedSlot(2), fNumFramesPosted(0), fNumFramesOverwritten(0)
+{
+  for (unsigned i = 0; i < 3; ++i)
+  {
+    fSlots[i] = av_frame_alloc();
+  }
+}
+
+FrameMailbox::~FrameMailbox()
+{
+  for (unsigned i = 0; i < 3; ++i)
+  {
+    av_frame_free(&fSlots[i]); // also drops the slot's reference to its frame buffers (if any)
+  }
+}
+
+bool FrameMailbox::post(AVFrame const *frame)
+{
+  // Reference the frame from our own slot (first dropping whatever frame the slot last referenced - which the consumer is
+  // finished with, or never saw):
+  AVFrame *slot = fSlots[fProducerSlot];
+  av_frame_unref(slot);
+  if (av_frame_ref(slot, frame) < 0)
+    return false; // out of memory; drop the frame
+
+  // Then swap it into the shared slot, taking back whatever was there:
+  unsigned previous = fSharedSlot.exchange(fProducerSlot | FRAME_MAILBOX_FRESH, std::memory_order_acq_rel);
+  fProducerSlot = previous & FRAME_MAILBOX_SLOT_MASK;
+  ++fNumFramesPosted;
+  if (previous & FRAME_MAILBOX_FRESH)
+  {
+    ++fNumFramesOverwritten; // the consumer never took it
+    return false;
+  }
+  return true;
+}
+
+AVFrame *FrameMailbox::take()
+{
+  if ((fSharedSlot.load(std::memory_order_acquire) & FRAME_MAILBOX_FRESH) == 0)
+    return NULL; // nothing new
+
+  // Swap our (finished-with) slot into the shared slot, taking the new frame.  (Only we ever clear the flag, so it's still set.)
+  unsigned previous = fSharedSlot.exchange(fConsumerSlot, std::memory_order_acq_rel);
+  fConsumerSlot = previous & FRAME_MAILBOX_SLOT_MASK;
+  return fSlots[fConsumerSlot];
+}
@@ -0,0 +1,42 @@
+// A latest-frame-wins mailbox, for handing a stream's decoded frames to a consumer that may be slower than the stream.
+// C++ header
+
+#ifndef _FRAME_MAILBOX_HH
+#define _FRAME_MAILBOX_HH
+
+#include <atomic>
+
+struct AVFrame;
+
+// Define a mailbox that holds (a reference to) only the most recently posted frame.  Posting a frame that the consumer hasn't
+// yet taken overwrites it (and counts it as overwritten), so a slow consumer always sees the freshest frame, rather than an
+// ever-growing backlog.  Neither side ever blocks: the mailbox is triple-buffered - one frame for the producer to fill, one
+// for the consumer to use, and one in between - and the two sides swap frames with a single atomic exchange.  The pixel data
+// is never copied: each slot just references the decoder's (pooled) frame buffers.  (Referencing them does allocate a small
+// "AVBufferRef" per plane, on each post.)
+
+class FrameMailbox
+{
+public:
+  FrameMailbox();
+  virtual ~FrameMailbox();
+
+  bool post(AVFrame const *frame);
+  // called by the producer (e.g., from a "RTSPDecodeEngine::FrameCallback"), from one thread at a time.  Returns true iff the
+  // consumer had taken the previous frame (and so may need to be woken), or false if that frame has just been overwritten
+  AVFrame *take();
+  // called by the consumer, from one thread at a time.  Returns the newest frame, if one has been posted since the last call
+  // (otherwise NULL).  The frame remains valid - and owned by the mailbox - until the next call to "take()"
+
+  unsigned long long numFramesPosted() const { return fNumFramesPosted; }           // called from any thread
+  unsigned long long numFramesOverwritten() const { return fNumFramesOverwritten; } // ditto
+
+private:
+  AVFrame *fSlots[3];
+  unsigned fProducerSlot; // accessed only by the producer
+  unsigned fConsumerSlot; // accessed only by the consumer
+  std::atomic<unsigned> fSharedSlot; // the slot in between, plus a flag that's set iff it holds a frame that hasn't been taken
+  std::atomic<unsigned long long> fNumFramesPosted, fNumFramesOverwritten;
+};
+
+#endif
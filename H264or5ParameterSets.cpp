@@ -0,0 +1,198 @@
+// The H.264 or H.265 parameter set NAL units needed to decode a stream, as parsed from its SDP and kept up to date from the
+// stream itself.
+// Implementation
+
+#include "H264or5ParameterSets.hh"
+
+// Reads "numBits" bits (at most 32), starting "bitOffset" bits into "data".  Bits past the end of "data" read as 0:
+static unsigned readBits(unsigned char const *data, unsigned size, unsigned bitOffset, unsigned numBits)
+{
+  unsigned value = 0;
+  for (unsigned i = 0; i < numBits; ++i, ++bitOffset)
+  {
+    unsigned bit = bitOffset < 8 * size ? (data[bitOffset / 8] >> (7 - bitOffset % 8)) & 1 : 0;
+    value = (value << 1) | bit;
+  }
+  return value;
+}
+
+// Reads an Exp-Golomb-coded ("ue(v)") value, starting "bitOffset" bits into "data".  (H.264 parameter set ids come early enough
+// in their NAL units that we don't bother to remove emulation prevention bytes first.)
+static unsigned readUE(unsigned char const *data, unsigned size, unsigned bitOffset)
+{
+  unsigned leadingZeroBits = 0;
+  while (bitOffset < 8 * size && ((data[bitOffset / 8] >> (7 - bitOffset % 8)) & 1) == 0)
+  {
+    ++leadingZeroBits;
+    ++bitOffset;
+  }
+  ++bitOffset; // the terminating '1' bit
+
+  unsigned value = 0;
+  for (unsigned i = 0; i < leadingZeroBits && bitOffset < 8 * size && i < 31; ++i, ++bitOffset)
+  {
+    value = (value << 1) | ((data[bitOffset / 8] >> (7 - bitOffset % 8)) & 1);
+  }
+  return (1u << (leadingZeroBits < 31 ? leadingZeroBits : 31)) - 1 + value;
+}
+
+// Reads a H.265 SPS's "sps_seq_parameter_set_id".  This follows the (variable-length) "profile_tier_level()", whose mostly-zero
+// flags are likely to contain emulation prevention bytes, so these are removed first:
+static unsigned h265SPSId(unsigned char const *nalUnit, unsigned size)
+{
+  // (With 6 sub-layers, each with its profile and level present, the SPS id starts 89 bytes in - once the emulation prevention
+  // bytes have been removed.)
+  unsigned char sps[128];
+  unsigned spsSize = removeH264or5EmulationBytes(sps, sizeof sps, nalUnit, size);
+
+  unsigned maxSubLayersMinus1 = readBits(sps, spsSize, 16 + 4, 3); // after the NAL header, and "sps_video_parameter_set_id"
+  unsigned bitOffset = 24 + 96; // after "sps_temporal_id_nesting_flag", and the general profile, tier and level
+  unsigned subLayersOffset = bitOffset;
+  if (maxSubLayersMinus1 > 0)
+    bitOffset += 16; // each sub-layer's "sub_layer_profile_present_flag" and "sub_layer_level_present_flag", then padding
+  for (unsigned i = 0; i < maxSubLayersMinus1; ++i)
+  {
+    if (readBits(sps, spsSize, subLayersOffset + 2 * i, 1))
+      bitOffset += 88; // the sub-layer's profile
+    if (readBits(sps, spsSize, subLayersOffset + 2 * i + 1, 1))
+      bitOffset += 8; // the sub-layer's level
+  }
+  return readUE(sps, spsSize, bitOffset);
+}
+
+int H264or5ParameterSets::hNumberFor(MediaSubsession &subsession)
+{
+  if (strcmp(subsession.mediumName(), "video") != 0)
+    return 0;
+  if (strcmp(subsession.codecName(), "H264") == 0)
+    return 264;
+  if (strcmp(subsession.codecName(), "H265") == 0)
+    return 265;
+  return 0;
+}
+
+H264or5ParameterSets::H264or5ParameterSets(MediaSubsession &subsession)
+    : fHNumber(hNumberFor(subsession))
+{
+  if (fHNumber == 264)
+  {
+    addSPropParameterSets(subsession.fmtp_spropparametersets());
+  }
+  else
+  {
+    // (The decoder needs them in this order:)
+    addSPropParameterSets(subsession.fmtp_spropvps());
+    addSPropParameterSets(subsession.fmtp_spropsps());
+    addSPropParameterSets(subsession.fmtp_sproppps());
+  }
+}
+
+void H264or5ParameterSets::addSPropParameterSets(char const *sPropParameterSetsStr)
+{
+  unsigned numSPropRecords;
+  SPropRecord *sPropRecords = parseSPropParameterSets(sPropParameterSetsStr, numSPropRecords);
+  for (unsigned i = 0; i < numSPropRecords; ++i)
+  {
+    update(sPropRecords[i].sPropBytes, sPropRecords[i].sPropLength);
+  }
+  delete[] sPropRecords;
+}
+
+unsigned H264or5ParameterSets::nalUnitType(unsigned char const *nalUnit) const
+{
+  return fHNumber == 264 ? nalUnit[0] & 0x1F : (nalUnit[0] >> 1) & 0x3F;
+}
+
+Boolean H264or5ParameterSets::isParameterSet(unsigned nalUnitType) const
+{
+  if (fHNumber == 264)
+    return nalUnitType == 7 /*SPS*/ || nalUnitType == 8 /*PPS*/;
+  return nalUnitType >= 32 /*VPS*/ && nalUnitType <= 34 /*PPS*/;
+}
+
+Boolean H264or5ParameterSets::isRandomAccessPoint(unsigned nalUnitType) const
+{
+  if (fHNumber == 264)
+    return nalUnitType == 5 /*IDR*/;
+  return nalUnitType >= 16 /*BLA_W_LP*/ && nalUnitType <= 21 /*CRA_NUT*/; // an IRAP picture
+}
+
+Boolean H264or5ParameterSets::isNonRandomAccessSlice(unsigned nalUnitType) const
+{
+  if (fHNumber == 264)
+    return nalUnitType == 1 /*non-IDR slice*/;
+  return nalUnitType <= 9 /*RASL_R*/; // (the reserved non-IRAP VCL types, 10-15, are never sent)
+}
+
+Boolean H264or5ParameterSets::update(unsigned char const *nalUnit, unsigned size)
+{
+  if (size < 2)
+    return False;
+  unsigned type = nalUnitType(nalUnit);
+  if (!isParameterSet(type))
+    return False;
+
+  unsigned id;
+  if (fHNumber == 264)
+  {
+    if (type == 7 /*SPS*/)
+    {
+      if (size < 5)
+        return False;
+      id = readUE(nalUnit, size, 32); // after the NAL header, "profile_idc", the constraint flags, and "level_idc"
+    }
+    else
+    {
+      id = readUE(nalUnit, size, 8); // just after the NAL header
+    }
+  }
+  else
+  {
+    if (type == 32 /*VPS*/)
+      id = readBits(nalUnit, size, 16, 4); // just after the (2-byte) NAL header
+    else if (type == 33 /*SPS*/)
+      id = h265SPSId(nalUnit, size);
+    else
+      id = readUE(nalUnit, size, 16); // just after the NAL header
+  }
+
+  for (unsigned i = 0; i < fParameterSets.size(); ++i)
+  {
+    ParameterSet &ps = fParameterSets[i];
+    if (ps.nalUnitType == type && ps.id == id)
+    {
+      if (ps.bytes.size() == size && memcmp(&ps.bytes[0], nalUnit, size) == 0)
+        return False; // the usual case: the camera is just repeating it
+      ps.bytes.assign(nalUnit, nalUnit + size);
+      return True;
+    }
+  }
+
+  ParameterSet ps;
+  ps.nalUnitType = type;
+  ps.id = id;
+  ps.bytes.assign(nalUnit, nalUnit + size);
+  fParameterSets.push_back(ps);
+  return True;
+}
+
+unsigned H264or5ParameterSets::annexBSize() const
+{
+  unsigned totalsize = 0;
+  for (unsigned i = 0; i < fParameterSets.size(); ++i)
+  {
+    totalsize += 4 + fParameterSets[i].bytes.size();
+  }
+  return totalsize;
+}
+
+void H264or5ParameterSets::copyAnnexB(unsigned char *to) const
+{
+  unsigned char const start_code[4] = {0x00, 0x00, 0x00, 0x01};
+  for (unsigned i = 0; i < fParameterSets.size(); ++i)
+  {
+    memcpy(to, start_code, 4);
+    memcpy(to + 4, &fParameterSets[i].bytes[0], fParameterSets[i].bytes.size());
+    to += 4 + fParameterSets[i].bytes.size();
+  }
+}
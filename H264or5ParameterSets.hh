@@ -0,0 +1,51 @@
+// The H.264 or H.265 parameter set NAL units needed to decode a stream, as parsed from its SDP and kept up to date from the
+// stream itself.
+// C++ header
+
+#ifndef _H264_OR_5_PARAMETER_SETS_HH
+#define _H264_OR_5_PARAMETER_SETS_HH
+
+#include "liveMedia.hh"
+#include <vector>
+
+// Define a class to hold the parameter set NAL units (without start codes) that a stream's decoder needs: for H.264, the
+// SPS/PPS; for H.265, the VPS/SPS/PPS.  These are parsed, once, from the SDP's "sprop-parameter-sets" (H.264) or
+// "sprop-vps"/"sprop-sps"/"sprop-pps" (H.265) when the stream's sink is created, and then replaced by any new versions of
+// them (with the same parameter set id) that arrive in-band.
+
+class H264or5ParameterSets
+{
+public:
+  H264or5ParameterSets(MediaSubsession &subsession);
+  // "subsession" must be H.264 or H.265 video (see "hNumberFor()")
+
+  static int hNumberFor(MediaSubsession &subsession); // 264 or 265, or 0 if "subsession" isn't H.264 or H.265 video
+  int hNumber() const { return fHNumber; }
+
+  Boolean update(unsigned char const *nalUnit, unsigned size);
+  // returns True iff "nalUnit" is a parameter set that we didn't already have
+  unsigned numParameterSets() const { return fParameterSets.size(); }
+  unsigned annexBSize() const;          // the size of all of the parameter sets, each preceded by a 4-byte start code
+  void copyAnnexB(unsigned char *to) const; // "to" must have room for "annexBSize()" bytes
+
+  // Classify NAL units (by their header), for a stream of this kind:
+  unsigned nalUnitType(unsigned char const *nalUnit) const;
+  Boolean isParameterSet(unsigned nalUnitType) const;
+  Boolean isRandomAccessPoint(unsigned nalUnitType) const; // a picture that's decodable without earlier ones (e.g., IDR)
+  Boolean isNonRandomAccessSlice(unsigned nalUnitType) const; // a picture that may reference earlier ones
+
+private:
+  void addSPropParameterSets(char const *sPropParameterSetsStr);
+
+private:
+  int fHNumber; // 264 or 265
+  struct ParameterSet
+  {
+    unsigned nalUnitType; // e.g., 7 (SPS) or 8 (PPS), for H.264
+    unsigned id;          // e.g., "seq_parameter_set_id" or "pic_parameter_set_id"
+    std::vector<unsigned char> bytes;
+  };
+  std::vector<ParameterSet> fParameterSets;
+};
+
+#endif
@@ -0,0 +1,92 @@
+// Low-overhead latency histograms, for measuring each stage of a stream's pipeline.
+// Implementation
+
+#include "LatencyHistogram.hh"
+
+LatencyHistogram::LatencyHistogram()
+    : fMax(0)
+{
+  for (unsigned i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; ++i)
+  {
+    fCounts[i] = 0;
+  }
+}
+
+unsigned LatencyHistogram::bucketFor(uint64_t latencyUS)
+{
+  if (latencyUS < LATENCY_HISTOGRAM_SUB_BUCKETS)
+    return latencyUS; // small latencies get a bucket each
+
+  // Otherwise, the bucket is given by the position of the top bit, and the 3 bits below it:
+  unsigned topBit = 63 - __builtin_clzll(latencyUS); // >= 3
+  unsigned subBucket = (latencyUS >> (topBit - 3)) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+  return (topBit - 2) * LATENCY_HISTOGRAM_SUB_BUCKETS + subBucket;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned bucket)
+{
+  if (bucket < LATENCY_HISTOGRAM_SUB_BUCKETS)
+    return bucket;
+
+  unsigned topBit = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS + 2;
+  uint64_t subBucket = bucket % LATENCY_HISTOGRAM_SUB_BUCKETS;
+  uint64_t lowerBound = (LATENCY_HISTOGRAM_SUB_BUCKETS + subBucket) << (topBit - 3);
+  return lowerBound + ((uint64_t)1 << (topBit - 3)) - 1;
+}
+
+void LatencyHistogram::record(int64_t latencyUS)
+{
+  if (latencyUS < 0)
+    latencyUS = 0;
+  fCounts[bucketFor(latencyUS)].fetch_add(1, std::memory_order_relaxed);
+
+  int64_t max = fMax.load(std::memory_order_relaxed);
+  while (latencyUS > max && !fMax.compare_exchange_weak(max, latencyUS, std::memory_order_relaxed))
+  {
+  }
+}
+
+void LatencyHistogram::takeSummary(RTSPDecodeEngine::LatencySummary &summary)
+{
+  // Take (and reset) each bucket's count.  A latency that's recorded while we're doing this gets counted either now, or next time:
+  unsigned counts[LATENCY_HISTOGRAM_NUM_BUCKETS];
+  unsigned long total = 0;
+  for (unsigned i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; ++i)
+  {
+    counts[i] = fCounts[i].exchange(0, std::memory_order_relaxed);
+    total += counts[i];
+  }
+  summary.count = total;
+  summary.maxUS = fMax.exchange(0, std::memory_order_relaxed);
+  summary.p50US = summary.p99US = 0;
+  if (total == 0)
+    return;
+
+  // Report each percentile as the upper bound of its bucket (but no more than the maximum):
+  unsigned long p50Rank = (total + 1) / 2, p99Rank = total - total / 100;
+  unsigned long seen = 0;
+  for (unsigned i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; ++i)
+  {
+    if (counts[i] == 0)
+      continue;
+    unsigned long before = seen;
+    seen += counts[i];
+    long long upperBound = (long long)bucketUpperBound(i);
+    if (upperBound > summary.maxUS)
+      upperBound = summary.maxUS;
+    if (before < p50Rank && seen >= p50Rank)
+      summary.p50US = upperBound;
+    if (before < p99Rank && seen >= p99Rank)
+    {
+      summary.p99US = upperBound;
+      break;
+    }
+  }
+}
+
+void StreamLatency::takeReport(RTSPDecodeEngine::LatencyReport &report)
+{
+  captureToReceive.takeSummary(report.captureToReceive);
+  receiveToDecoded.takeSummary(report.receiveToDecoded);
+  decodedToDelivered.takeSummary(report.decodedToDelivered);
+}
@@ -0,0 +1,47 @@
+// Low-overhead latency histograms, for measuring each stage of a stream's pipeline.
+// C++ header
+
+#ifndef _LATENCY_HISTOGRAM_HH
+#define _LATENCY_HISTOGRAM_HH
+
+#include "RTSPDecode.hh"
+#include <atomic>
+#include <stdint.h>
+
+// Define a histogram of latencies (in microseconds) that can be recorded into from any thread, without locking.  Latencies are
+// counted in buckets on a log-linear scale - 8 per power of two - so percentiles are accurate to within 12.5%, and recording is
+// just an atomic increment.
+
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 8
+#define LATENCY_HISTOGRAM_NUM_BUCKETS (62 * LATENCY_HISTOGRAM_SUB_BUCKETS) // enough for any non-negative "int64_t"
+
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  void record(int64_t latencyUS); // (negative latencies - from clocks that aren't quite in sync - are counted as 0)
+  void takeSummary(RTSPDecodeEngine::LatencySummary &summary);
+  // summarizes the latencies recorded since the last call, then resets the histogram
+
+private:
+  static unsigned bucketFor(uint64_t latencyUS);
+  static uint64_t bucketUpperBound(unsigned bucket);
+
+private:
+  std::atomic<unsigned> fCounts[LATENCY_HISTOGRAM_NUM_BUCKETS];
+  std::atomic<int64_t> fMax;
+};
+
+// Define the latency histograms that we keep for each (video) stream:
+
+struct StreamLatency
+{
+  LatencyHistogram captureToReceive;   // from the sender's (RTCP-synchronized) capture time to our receipt of the frame
+  LatencyHistogram receiveToDecoded;   // from our receipt of a frame to the decoder producing a picture from it
+  LatencyHistogram decodedToDelivered; // from the decoder producing a picture to the frame callback having returned
+
+  void takeReport(RTSPDecodeEngine::LatencyReport &report);
+};
+
+#endif
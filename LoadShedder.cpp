@@ -0,0 +1,134 @@
+// A controller that sheds decoding load - from the lowest-priority streams first - when the decoders can't keep up.
+// Implementation
+
+#include "LoadShedder.hh"
+#include <chrono>
+
+LoadShedder::LoadShedder(DecodeCounters &counters, unsigned numDecodingThreads, unsigned periodMS, unsigned busyBudgetPercent,
+                         RTSPDecodeEngine::DecodeLevelCallback const &onDecodeLevelChanged)
+    : fCounters(counters), fNumDecodingThreads(numDecodingThreads > 0 ? numDecodingThreads : 1),
+      fPeriodMS(periodMS), fBusyBudgetPercent(busyBudgetPercent), fOnDecodeLevelChanged(onDecodeLevelChanged),
+      fLastDecodeTimeUS(counters.decodeTimeUS), fLastNumQueueOverflows(counters.numQueueOverflows),
+      fStopping(False)
+{
+  fThread = std::thread(&LoadShedder::controllerLoop, this);
+}
+
+LoadShedder::~LoadShedder()
+{
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStopping = True;
+  }
+  fStop.notify_all();
+  fThread.join();
+}
+
+void LoadShedder::addDecoder(StreamDecoder *decoder, RTSPDecodeEngine::StreamOptions const &streamOptions)
+{
+  Stream stream;
+  stream.decoder = decoder;
+  stream.priority = streamOptions.priority;
+  stream.lowestDecodeLevel = streamOptions.lowestDecodeLevel;
+  stream.lastDecodeTimeUS = decoder->decodeTimeUS();
+  stream.decodeTimeUS = 0;
+
+  std::lock_guard<std::mutex> lock(fMutex);
+  fStreams.push_back(stream);
+}
+
+void LoadShedder::removeDecoder(StreamDecoder *decoder)
+{
+  // (Holding the lock means that we can't be in the middle of "evaluate()" using the decoder.)
+  std::lock_guard<std::mutex> lock(fMutex);
+  for (std::vector<Stream>::iterator it = fStreams.begin(); it != fStreams.end(); ++it)
+  {
+    if (it->decoder == decoder)
+    {
+      fStreams.erase(it);
+      break;
+    }
+  }
+}
+
+void LoadShedder::controllerLoop()
+{
+  std::chrono::steady_clock::time_point lastEvaluation = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(fMutex);
+  while (!fStop.wait_for(lock, std::chrono::milliseconds(fPeriodMS), [this]() { return fStopping != False; }))
+  {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    unsigned long long elapsedUS = std::chrono::duration_cast<std::chrono::microseconds>(now - lastEvaluation).count();
+    lastEvaluation = now;
+    StreamDecoder *changedDecoder = NULL; // the stream (if any) that this evaluation moves to another decode level
+
+    // How busy have the decoding threads been?
+    unsigned long long decodeTimeUS = fCounters.decodeTimeUS;
+    unsigned long long numQueueOverflows = fCounters.numQueueOverflows;
+    unsigned busyPercent = elapsedUS > 0 ? (unsigned)((decodeTimeUS - fLastDecodeTimeUS) * 100 / (elapsedUS * fNumDecodingThreads)) : 0;
+    Boolean queuesOverflowed = numQueueOverflows != fLastNumQueueOverflows;
+    fLastDecodeTimeUS = decodeTimeUS;
+    fLastNumQueueOverflows = numQueueOverflows;
+
+    unsigned maxQueueDepth = 0;
+    for (unsigned i = 0; i < fStreams.size(); ++i)
+    {
+      Stream &stream = fStreams[i]; // alias
+      unsigned long long streamDecodeTimeUS = stream.decoder->decodeTimeUS();
+      stream.decodeTimeUS = streamDecodeTimeUS - stream.lastDecodeTimeUS;
+      stream.lastDecodeTimeUS = streamDecodeTimeUS;
+      unsigned queueDepth = stream.decoder->queueDepth();
+      if (queueDepth > maxQueueDepth)
+        maxQueueDepth = queueDepth;
+    }
+
+    if (busyPercent > fBusyBudgetPercent || queuesOverflowed || maxQueueDepth >= LOAD_SHEDDER_MAX_QUEUE_DEPTH)
+    {
+      // Overloaded.  Shed the lowest-priority stream that we can (of those, the one whose decoding has been costing the most):
+      Stream *victim = NULL;
+      for (unsigned i = 0; i < fStreams.size(); ++i)
+      {
+        Stream &stream = fStreams[i]; // alias
+        if (stream.decoder->decodeLevel() >= stream.lowestDecodeLevel)
+          continue; // it's already been shed as far as it's allowed to be
+        if (victim == NULL || stream.priority < victim->priority ||
+            (stream.priority == victim->priority && stream.decodeTimeUS > victim->decodeTimeUS))
+          victim = &stream;
+      }
+      if (victim != NULL)
+      {
+        victim->decoder->setDecodeLevel((RTSPDecodeEngine::DecodeLevel)(victim->decoder->decodeLevel() + 1));
+        changedDecoder = victim->decoder;
+      }
+    }
+    else if (busyPercent * 100 < fBusyBudgetPercent * LOAD_SHEDDER_RESTORE_PERCENT && maxQueueDepth <= 1)
+    {
+      // There's room to spare.  Restore the highest-priority stream that has been shed:
+      Stream *beneficiary = NULL;
+      for (unsigned i = 0; i < fStreams.size(); ++i)
+      {
+        Stream &stream = fStreams[i]; // alias
+        if (stream.decoder->decodeLevel() == RTSPDecodeEngine::DECODE_FULL)
+          continue;
+        if (beneficiary == NULL || stream.priority > beneficiary->priority)
+          beneficiary = &stream;
+      }
+      if (beneficiary != NULL)
+      {
+        beneficiary->decoder->setDecodeLevel((RTSPDecodeEngine::DecodeLevel)(beneficiary->decoder->decodeLevel() - 1));
+        changedDecoder = beneficiary->decoder;
+      }
+    }
+
+    if (changedDecoder != NULL && fOnDecodeLevelChanged)
+    {
+      // Tell the application - without holding the lock, in case the callback takes a while (the decoder may then be removed,
+      // so we don't use it again):
+      unsigned streamNum = changedDecoder->streamNum();
+      RTSPDecodeEngine::DecodeLevel level = changedDecoder->decodeLevel();
+      lock.unlock();
+      fOnDecodeLevelChanged(streamNum, level, busyPercent);
+      lock.lock();
+    }
+  }
+}
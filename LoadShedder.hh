@@ -0,0 +1,57 @@
+// A controller that sheds decoding load - from the lowest-priority streams first - when the decoders can't keep up.
+// C++ header
+
+#ifndef _LOAD_SHEDDER_HH
+#define _LOAD_SHEDDER_HH
+
+#include "StreamDecoder.hh"
+#include <thread>
+#include <condition_variable>
+
+#define LOAD_SHEDDER_MAX_QUEUE_DEPTH (DECODE_QUEUE_DEPTH / 2) // a decode queue this deep means that its stream is falling behind
+#define LOAD_SHEDDER_RESTORE_PERCENT 75 // restore a stream only once the decoders are this much below their budget (hysteresis)
+
+// Define a controller that, every period, measures how busy the decoding threads have been, and how deep the streams' decode
+// queues are.  If the decoders are over their budget (or any queue is backing up, or overflowed), it moves the lowest-priority
+// stream that can be shed one decode level down (full => reference frames only => keyframes only).  Once the load has dropped
+// back well below the budget, it moves the highest-priority shed stream back up one level.  Only one stream moves per period,
+// so that the effect of each change can be seen before the next.
+
+class LoadShedder
+{
+public:
+  LoadShedder(DecodeCounters &counters, unsigned numDecodingThreads, unsigned periodMS, unsigned busyBudgetPercent,
+              RTSPDecodeEngine::DecodeLevelCallback const &onDecodeLevelChanged);
+  virtual ~LoadShedder();
+
+  void addDecoder(StreamDecoder *decoder, RTSPDecodeEngine::StreamOptions const &streamOptions); // called from any thread
+  void removeDecoder(StreamDecoder *decoder);                                                   // ditto
+
+private:
+  void controllerLoop();
+
+private:
+  struct Stream
+  {
+    StreamDecoder *decoder;
+    int priority;
+    RTSPDecodeEngine::DecodeLevel lowestDecodeLevel;
+    unsigned long long lastDecodeTimeUS; // as of the previous evaluation
+    unsigned long long decodeTimeUS;     // during the latest period
+  };
+
+  DecodeCounters &fCounters;
+  unsigned fNumDecodingThreads;
+  unsigned fPeriodMS, fBusyBudgetPercent;
+  RTSPDecodeEngine::DecodeLevelCallback fOnDecodeLevelChanged;
+  unsigned long long fLastDecodeTimeUS;
+  unsigned long long fLastNumQueueOverflows;
+
+  std::mutex fMutex; // guards the following:
+  std::vector<Stream> fStreams;
+  Boolean fStopping;
+  std::condition_variable fStop;
+  std::thread fThread;
+};
+
+#endif
@@ -0,0 +1,220 @@
+// A ring of a H.264 or H.265 video subsession's most recent (compressed) access units, from which a clip - starting before
+// some event - can be exported.
+// Implementation
+
+#include "PreEventBuffer.hh"
+
+PreEventBuffer::PreEventBuffer(H264or5ParameterSets const &parameterSets, unsigned windowSeconds, unsigned arenaSize)
+    : fParameterSets(parameterSets), fWindowUS(windowSeconds * (int64_t)1000000),
+      fArena(arenaSize), fEntries((windowSeconds + PRE_EVENT_MAX_GOP_SECONDS) * PRE_EVENT_MAX_FRAME_RATE),
+      fFirstEntry(0), fNumEntries(0), fUsedBytes(0), fWritePos(0), fWaitingForKeyframe(False),
+      fClipWriter(NULL), fClipRecordingId(0), fClipStartUS(-1), fClipEndUS(-1), fClipPostEventUS(0), fClipLastPTS(-1),
+      fClipWaitingForKeyframe(False), fNumClipsExported(0)
+{
+  fCurrent.offset = fCurrent.size = 0;
+  fCurrent.pts = 0;
+  fCurrent.isKeyframe = False;
+}
+
+PreEventBuffer::~PreEventBuffer()
+{
+  if (fClipWriter != NULL)
+  {
+    commitAccessUnit(); // (so that the clip gets it)
+    if (fClipWriter != NULL)
+      endClip();
+  }
+}
+
+void PreEventBuffer::addNALUnit(unsigned char const *nalUnit, unsigned size, struct timeval presentationTime)
+{
+  // Each access unit's NAL units all have the same presentation time, so a new presentation time begins a new access unit:
+  int64_t pts = presentationTime.tv_sec * (int64_t)1000000 + presentationTime.tv_usec;
+  if (fCurrent.size > 0 && pts != fCurrent.pts)
+    commitAccessUnit();
+  if (fCurrent.size == 0)
+  {
+    fCurrent.offset = fWritePos;
+    fCurrent.pts = pts;
+    fCurrent.isKeyframe = False;
+  }
+
+  // Make room for the NAL unit, by discarding the oldest GOPs:
+  while (fUsedBytes + size > fArena.size())
+  {
+    if (fNumEntries == 0)
+    {
+      // The access unit that's being gathered doesn't fit, even by itself:
+      skipToNextKeyframe();
+      return;
+    }
+    discardOldestGOP();
+  }
+
+  unsigned firstPart = fArena.size() - fWritePos;
+  if (firstPart >= size)
+  {
+    memcpy(&fArena[fWritePos], nalUnit, size);
+  }
+  else
+  {
+    memcpy(&fArena[fWritePos], nalUnit, firstPart);
+    memcpy(&fArena[0], nalUnit + firstPart, size - firstPart);
+  }
+  fWritePos = (fWritePos + size) % fArena.size();
+  fUsedBytes += size;
+  fCurrent.size += size;
+  if (size > 4 && fParameterSets.isRandomAccessPoint(fParameterSets.nalUnitType(nalUnit + 4)))
+    fCurrent.isKeyframe = True;
+}
+
+void PreEventBuffer::skipToNextKeyframe()
+{
+  // The access unit that's being gathered is now incomplete, so forget it:
+  fUsedBytes -= fCurrent.size;
+  fWritePos = fCurrent.offset;
+  fCurrent.size = 0;
+  fWaitingForKeyframe = True;
+}
+
+Boolean PreEventBuffer::startClip(RecordingWriter &writer, std::string const &fileName, RTSPDecodeEngine::RecordFormat format,
+                                  unsigned postEventSeconds)
+{
+  if (fClipWriter != NULL || format == RTSPDecodeEngine::RECORD_NONE)
+    return False;
+
+  std::vector<unsigned char> extradata(fParameterSets.annexBSize());
+  if (!extradata.empty())
+    fParameterSets.copyAnnexB(&extradata[0]);
+  fClipWriter = &writer;
+  fClipRecordingId = writer.newRecordingId();
+  writer.startSegment(fClipRecordingId, fileName, format, fParameterSets.hNumber(), extradata);
+  ++fNumClipsExported;
+
+  // The clip runs until "postEventSeconds" after the newest access unit (or, if we have none yet, after the first to arrive):
+  fClipStartUS = fClipEndUS = fClipLastPTS = -1;
+  fClipPostEventUS = postEventSeconds * (int64_t)1000000;
+  fClipWaitingForKeyframe = True;
+  if (fCurrent.size > 0)
+    fClipEndUS = fCurrent.pts + fClipPostEventUS;
+  else if (fNumEntries > 0)
+    fClipEndUS = entry(fNumEntries - 1).pts + fClipPostEventUS;
+
+  for (unsigned i = 0; i < fNumEntries && fClipWriter != NULL; ++i)
+  {
+    writeToClip(entry(i));
+  }
+  return True;
+}
+
+int64_t PreEventBuffer::windowUS() const
+{
+  if (fNumEntries == 0)
+    return 0;
+  return fEntries[(fFirstEntry + fNumEntries - 1) % fEntries.size()].pts - fEntries[fFirstEntry].pts;
+}
+
+void PreEventBuffer::commitAccessUnit()
+{
+  if (fCurrent.size == 0)
+    return;
+  Entry accessUnit = fCurrent;
+  fCurrent.size = 0;
+  if (accessUnit.isKeyframe)
+    fWaitingForKeyframe = False;
+  if (fWaitingForKeyframe)
+  {
+    // (It may reference a lost access unit.)
+    fUsedBytes -= accessUnit.size;
+    fWritePos = accessUnit.offset;
+    return;
+  }
+
+  if (fClipWriter != NULL)
+    writeToClip(accessUnit);
+
+  // The ring always starts with a keyframe:
+  if (fNumEntries == 0 && !accessUnit.isKeyframe)
+  {
+    fUsedBytes -= accessUnit.size;
+    fWritePos = accessUnit.offset;
+    return;
+  }
+  if (fNumEntries == fEntries.size())
+    discardOldestGOP();
+  entry(fNumEntries++) = accessUnit;
+
+  // Discard the oldest GOP whenever the ones after it still cover the window:
+  while (fNumEntries > 1)
+  {
+    unsigned nextKeyframe = 1;
+    while (nextKeyframe < fNumEntries && !entry(nextKeyframe).isKeyframe)
+      ++nextKeyframe;
+    if (nextKeyframe == fNumEntries || accessUnit.pts - entry(nextKeyframe).pts < fWindowUS)
+      break;
+    discardOldestGOP();
+  }
+}
+
+void PreEventBuffer::discardOldestGOP()
+{
+  do
+  {
+    fUsedBytes -= entry(0).size;
+    fFirstEntry = (fFirstEntry + 1) % fEntries.size();
+    --fNumEntries;
+  } while (fNumEntries > 0 && !entry(0).isKeyframe);
+}
+
+void PreEventBuffer::writeToClip(Entry const &accessUnit)
+{
+  if (fClipWaitingForKeyframe && !accessUnit.isKeyframe)
+    return;
+  fClipWaitingForKeyframe = False;
+  if (fClipStartUS < 0)
+  {
+    fClipStartUS = accessUnit.pts;
+    if (fClipEndUS < 0)
+      fClipEndUS = accessUnit.pts + fClipPostEventUS;
+  }
+  if (accessUnit.pts >= fClipEndUS && fClipLastPTS >= 0)
+  {
+    endClip();
+    return;
+  }
+
+  AVPacket *packet = av_packet_alloc();
+  if (packet == NULL || av_new_packet(packet, accessUnit.size) < 0)
+  {
+    av_packet_free(&packet);
+    fClipWaitingForKeyframe = True;
+    return;
+  }
+  unsigned firstPart = fArena.size() - accessUnit.offset;
+  if (firstPart >= accessUnit.size)
+  {
+    memcpy(packet->data, &fArena[accessUnit.offset], accessUnit.size);
+  }
+  else
+  {
+    memcpy(packet->data, &fArena[accessUnit.offset], firstPart);
+    memcpy(packet->data + firstPart, &fArena[0], accessUnit.size - firstPart);
+  }
+
+  // As with "StreamRecorder", the access units aren't reordered, so the timestamps just need to be strictly increasing:
+  int64_t pts = accessUnit.pts - fClipStartUS;
+  if (fClipLastPTS >= 0 && pts <= fClipLastPTS)
+    pts = fClipLastPTS + 1;
+  fClipLastPTS = pts;
+  packet->pts = packet->dts = pts;
+  if (accessUnit.isKeyframe)
+    packet->flags |= AV_PKT_FLAG_KEY;
+  if (!fClipWriter->write(fClipRecordingId, packet))
+    fClipWaitingForKeyframe = True; // (the disk isn't keeping up)
+}
+
+void PreEventBuffer::endClip()
+{
+  fClipWriter->endSegment(fClipRecordingId);
+  fClipWriter = NULL;
+}
@@ -0,0 +1,80 @@
+// A ring of a H.264 or H.265 video subsession's most recent (compressed) access units, from which a clip - starting before
+// some event - can be exported.
+// C++ header
+
+#ifndef _PRE_EVENT_BUFFER_HH
+#define _PRE_EVENT_BUFFER_HH
+
+#include "liveMedia.hh"
+#include "RTSPDecode.hh"
+#include "H264or5ParameterSets.hh"
+#include "RecordingWriter.hh"
+#include <vector>
+#include <string>
+
+#define PRE_EVENT_MAX_FRAME_RATE 120 // access units per second, for sizing the ring's index...
+#define PRE_EVENT_MAX_GOP_SECONDS 10 // ... which also holds (up to) this much more than the window, back to its first keyframe
+
+// Define a class that keeps (at least) the last "preEventSeconds" of a video subsession, as received, so that clips of incidents
+// can include what led up to them.  Each "DummySink" whose stream has "StreamOptions::preEventSeconds" set owns one of these,
+// which is used only within the stream's event loop.
+// The access units are kept (in Annex B form) in an arena, and indexed by a ring of entries, both of which are allocated once,
+// when the buffer is created.  The oldest access units are discarded a whole GOP at a time, so the ring always starts with a
+// keyframe - from which a clip can be played - and is discarded early only if the arena (or the index) is full.
+
+class PreEventBuffer
+{
+public:
+  PreEventBuffer(H264or5ParameterSets const &parameterSets, unsigned windowSeconds, unsigned arenaSize);
+  // ("parameterSets" must outlive the buffer)
+  virtual ~PreEventBuffer(); // ends any clip that's being exported
+
+  void addNALUnit(unsigned char const *nalUnit, unsigned size, struct timeval presentationTime);
+  // "nalUnit" is preceded by a 4-byte start code (which "size" includes)
+  void skipToNextKeyframe(); // called when a NAL unit has been lost (e.g., truncated)
+
+  Boolean startClip(RecordingWriter &writer, std::string const &fileName, RTSPDecodeEngine::RecordFormat format,
+                    unsigned postEventSeconds);
+  // queues the ring's contents to "writer" (as a new file), followed by the next "postEventSeconds" of the stream as it arrives.
+  // Returns False if a clip is already being exported (or if "format" is RECORD_NONE)
+  Boolean isExportingClip() const { return fClipWriter != NULL; }
+
+  unsigned arenaSize() const { return fArena.size(); }
+  int64_t windowUS() const; // the span of the access units in the ring (from its first keyframe)
+  unsigned long long numClipsExported() const { return fNumClipsExported; }
+
+private:
+  struct Entry
+  {
+    unsigned offset, size; // in the arena (wrapping around its end)
+    int64_t pts;           // in microseconds
+    Boolean isKeyframe;
+  };
+  Entry &entry(unsigned i) { return fEntries[(fFirstEntry + i) % fEntries.size()]; } // the i'th-oldest
+  void commitAccessUnit();
+  void discardOldestGOP();
+  void discardAll();
+  void writeToClip(Entry const &accessUnit);
+  void endClip();
+
+private:
+  H264or5ParameterSets const &fParameterSets;
+  int64_t fWindowUS;
+  std::vector<unsigned char> fArena;
+  std::vector<Entry> fEntries;
+  unsigned fFirstEntry, fNumEntries;
+  unsigned fUsedBytes; // by the entries, and the access unit that's being gathered
+  unsigned fWritePos;  // where the next NAL unit goes
+  Entry fCurrent;      // the access unit that's being gathered (if "fCurrent.size" > 0), just after the newest entry
+  Boolean fWaitingForKeyframe;
+  // The clip that's being exported (if any):
+  RecordingWriter *fClipWriter;
+  unsigned fClipRecordingId;
+  int64_t fClipStartUS, fClipEndUS; // the presentation times of its first access unit, and of when it should end
+  int64_t fClipPostEventUS;
+  int64_t fClipLastPTS;
+  Boolean fClipWaitingForKeyframe;  // set if the writer refused an access unit
+  unsigned long long fNumClipsExported;
+};
+
+#endif
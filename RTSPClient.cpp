@@ -14,15 +14,31 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 **********/
 // Copyright (c) 1996-2020, Live Networks, Inc.  All rights reserved
-// A demo application, showing how to create and run a RTSP client (that can potentially receive multiple streams concurrently).
+// A demo application, showing how to use "librtspdecode" (see "RTSPDecode.hh") to receive, decode, and display multiple
+// RTSP streams concurrently.
 //
 // NOTE: This code - although it builds a running application - is intended only to illustrate how to develop your own RTSP
 // client application.  For a full-featured RTSP client application - with much more functionality, and many options - see
 // "openRTSP": http://www.live555.com/openRTSP/
 
+#include "RTSPDecode.hh"
+#include "FrameMailbox.hh"
+#include "SharedFrameRing.hh"
+#include "AVFrameMat.hh"
 #include "liveMedia.hh"
 #include "BasicUsageEnvironment.hh"
 #include "iostream"
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
 #include <SDL_rect.h>
 #include <SDL_render.h>
 #include <SDL.h>
@@ -33,805 +49,1009 @@ extern "C"
 {
 #include "libavformat/avformat.h"
 #include "libswscale/swscale.h"
+#include "libavutil/imgutils.h"
 #include "linux/videodev2.h"
 #include "sys/mman.h"
 }
 
-AVCodec *codec;
-AVCodecContext *c = NULL;
-AVFrame *frame;
-AVCodecParserContext *avParserContext;
-bool fHaveWrittenFirstFrame = false;
-
-SDL_Window *sdlWindow;
-SDL_Renderer *sdlRenderer;
-SDL_Texture *sdlTexture;
-SDL_Rect sdlRect;
-bool SDLInit = false;
-AVFrame *pFrameYUV;
-struct SwsContext *img_convert_ctx = NULL;
-
-// Forward function definitions:
-void decode_init(void);
-void sdl_init(unsigned int width, unsigned int height);
-int decoderyuv(unsigned char *inbuf, int read_size);
-void sdl_stop(void);
-static int get_char();
-// int decoderyuv(unsigned char * inbuf, int read_size)
-// RTSP 'response handlers':
-void continueAfterDESCRIBE(RTSPClient *rtspClient, int resultCode, char *resultString);
-void continueAfterSETUP(RTSPClient *rtspClient, int resultCode, char *resultString);
-void continueAfterPLAY(RTSPClient *rtspClient, int resultCode, char *resultString);
-
-// Other event handler functions:
-void subsessionAfterPlaying(void *clientData); // called when a stream's subsession (e.g., audio or video substream) ends
-void subsessionByeHandler(void *clientData, char const *reason);
-// called when a RTCP "BYE" is received for a subsession
-void streamTimerHandler(void *clientData);
-// called at the end of a stream's expected duration (if the stream has not already signaled its end using a RTCP "BYE")
-
-// The main streaming routine (for each "rtsp://" URL):
-void openURL(UsageEnvironment &env, char const *progName, char const *rtspURL);
-
-// Used to iterate through each stream's 'subsessions', setting up each one:
-void setupNextSubsession(RTSPClient *rtspClient);
-
-// Used to shut down and close a stream (including its "RTSPClient" object):
-void shutdownStream(RTSPClient *rtspClient, int exitCode = 1);
-
-// A function that outputs a string that identifies each stream (for debugging output).  Modify this if you wish:
-UsageEnvironment &operator<<(UsageEnvironment &env, const RTSPClient &rtspClient)
-{
-  return env << "[URL:\"" << rtspClient.url() << "\"]: ";
-}
+// Define a class that displays a single stream's decoded frames, in its own SDL window.  The thread that decoded each frame
+// just posts it to the display's mailbox (in "frameDecoded()"), which never blocks.  The main thread - because SDL isn't
+// thread-safe - takes the newest frame from the mailbox, and displays it (in "present()").  If the main thread falls behind,
+// the frames that it didn't get to in time are overwritten (and counted), rather than queued.  Frames are displayed through
+// an IYUV (planar 4:2:0) texture, so the decoders' usual output can be uploaded just as it is; only frames in any other pixel
+// format are converted first.
 
-// A function that outputs a string that identifies each subsession (for debugging output).  Modify this if you wish:
-UsageEnvironment &operator<<(UsageEnvironment &env, const MediaSubsession &subsession)
+class StreamDisplay
 {
-  return env << subsession.mediumName() << "/" << subsession.codecName();
-}
+public:
+  StreamDisplay(char const *title);
+  virtual ~StreamDisplay(); // must be called from the main thread
 
-void usage(UsageEnvironment &env, char const *progName)
-{
-  env << "Usage: " << progName << " <rtsp-url-1> ... <rtsp-url-N>\n";
-  env << "\t(where each <rtsp-url-i> is a \"rtsp://\" URL)\n";
-}
+  Boolean frameDecoded(AVFrame *frame);
+  // called from the stream's decoding thread; returns True iff the main thread now needs to be woken, to call "present()"
+  void present(); // called from the main thread, to display the most recently decoded frame (if it hasn't been already)
+  unsigned long long numFramesOverwritten() const { return fMailbox.numFramesOverwritten(); }
 
-char eventLoopWatchVariable = 0;
+private:
+  Boolean allocConvertedFrame(int width, int height, enum AVPixelFormat srcFormat);
+  void freeConvertedFrame();
+  Boolean sdl_init(unsigned int width, unsigned int height);
+  void sdl_stop();
 
-int main(int argc, char **argv)
-{
-  if (argc < 2)
-  {
-    printf("Please type: ./RTSPClient URL1 URL2 URL3 ...\n");
-    return 1;
-  }
-  // Begin by setting up our usage environment:
-  TaskScheduler *scheduler = BasicTaskScheduler::createNew();
-  UsageEnvironment *env = BasicUsageEnvironment::createNew(*scheduler);
+private:
+  char *fTitle;
+  struct SwsContext *fImgConvertCtx;
+
+  FrameMailbox fMailbox;
+
+  // Used only by the main thread.  If the decoded frames can't be uploaded as they are, each is converted into the following
+  // frame, which (with the scaler) is allocated once, and reallocated only if the decoded frames' size or pixel format changes:
+  uint8_t *fConvertedData[4];
+  int fConvertedLinesize[4];
+  int fConvertedWidth, fConvertedHeight;
+  enum AVPixelFormat fScalerSrcFormat;
+  int fDisplayWidth, fDisplayHeight;
+  int fTextureWidth, fTextureHeight;
+
+  SDL_Window *fSdlWindow;
+  SDL_Renderer *fSdlRenderer;
+  SDL_Texture *fSdlTexture;
+  SDL_Rect fSdlRect;
+  Boolean fSDLInit;
+};
 
-  // We need at least one "rtsp://" URL argument:
-  // if (argc < 2) {
-  //   usage(*env, argv[0]);
-  //   return 1;
-  // }
+// Define a class that displays many streams at once, as a grid of tiles within a single SDL window (e.g., for a control-room
+// wall).  Each stream's decoding thread downscales its frames to the stream's tile (in "frameDecoded()") - so that this work
+// is spread across the decoding threads - and posts them to the tile's mailbox.  The main thread uploads each tile's newest
+// frame to the tile's own texture, then draws every tile, and presents the window, just once (in "present()").  Because the
+// renderer waits for vsync, that's at most one present per display refresh, however many streams have new frames.  (Tiles use
+// IYUV textures, like "StreamDisplay"; a frame that already fits its tile, in a format that can be uploaded as it is, isn't
+// scaled at all.)
 
-  // There are argc-1 URLs: argv[1] through argv[argc-1].  Open and start streaming each one:
-  for (int i = 1; i <= argc - 1; ++i)
-  {
-    openURL(*env, argv[0], argv[i]);
-  }
-  // openURL(*env, argv[0], "rtsp://192.168.15.160:8554/h264Live");
 
-  decode_init();
+class MosaicDisplay
+{
+public:
+  MosaicDisplay(unsigned numTiles, int width, int height); // must be called from the main thread
+  virtual ~MosaicDisplay();                                // ditto
 
-  // All subsequent activity takes place within the event loop:
-  env->taskScheduler().doEventLoop(&eventLoopWatchVariable);
-  // This function call does not return, unless, at some point in time, "eventLoopWatchVariable" gets set to something non-zero.
+  Boolean isOpen() const { return fSdlRenderer != NULL; }
+  Boolean frameDecoded(unsigned tileNum, AVFrame *frame);
+  // called from the tile's stream's decoding thread; returns True iff the main thread now needs to be woken, to call "present()"
+  void tileClosed(unsigned tileNum); // called from the main thread, when the tile's stream has closed
+  void present();                    // called from the main thread
+  unsigned long long numFramesOverwritten() const;
 
-  return 0;
+private:
+  static void fitWithin(int width, int height, SDL_Rect const &bounds, SDL_Rect &fitted);
+  // sets "fitted" to the largest "width":"height" rectangle that fits (centered) within "bounds"
 
-  // If you choose to continue the application past this point (i.e., if you comment out the "return 0;" statement above),
-  // and if you don't intend to do anything more with the "TaskScheduler" and "UsageEnvironment" objects,
-  // then you can also reclaim the (small) memory used by these objects by uncommenting the following code:
-  /*
-    env->reclaim(); env = NULL;
-    delete scheduler; scheduler = NULL;
-  */
-}
+private:
+  struct Tile
+  {
+    Tile();
+    ~Tile();
+
+    SDL_Rect rect; // within the window
+    FrameMailbox mailbox;
+
+    // Used only by the stream's decoding thread.  The scaler, and the pool of (tile-sized) buffers that it scales into, are
+    // reallocated only if the decoded frames' size or pixel format changes:
+    struct SwsContext *scaler;
+    int srcWidth, srcHeight;
+    enum AVPixelFormat srcFormat;
+    AVBufferPool *bufferPool;
+    AVFrame *scaledFrame;
+
+    // Used only by the main thread:
+    SDL_Texture *texture;
+    int textureWidth, textureHeight;
+    SDL_Rect displayRect; // where (within "rect") the texture is drawn
+    Boolean closed;
+  };
+  std::vector<Tile *> fTiles;
+  Boolean fRedrawNeeded; // (e.g., because a tile has closed)
+
+  SDL_Window *fSdlWindow;
+  SDL_Renderer *fSdlRenderer;
+};
+
+// The displays of the streams that are open (used only when not running 'headless'), and the ids of those streams that have
+// closed (and whose displays the main thread has yet to delete).  In mosaic mode, each stream's tile is used instead:
+static std::mutex displaysMutex;
+static std::map<unsigned, StreamDisplay *> displays;
+static std::map<unsigned, unsigned> mosaicTiles; // stream id -> tile
+static MosaicDisplay *mosaic = NULL;
+static std::set<unsigned> closedStreams;
 
-// Define a class to hold per-stream state that we maintain throughout each stream's lifetime:
+static std::atomic<unsigned long> numFramesDecoded(0); // in all streams
+static std::atomic<unsigned long> numAnalyticsFrames(0); // ditto
+static std::atomic<unsigned long> numMatFrames(0);       // ditto
+static volatile sig_atomic_t clipRequested = 0;          // set by SIGUSR1
 
-class StreamClientState
+void usage(char const *progName)
 {
-public:
-  StreamClientState();
-  virtual ~StreamClientState();
+  std::cerr << "Usage: " << progName << " [<options>] <rtsp-url-1> ... <rtsp-url-N>\n";
+  std::cerr << "\t(where each <rtsp-url-i> is a \"rtsp://\" URL, and the options are:)\n";
+  std::cerr << "\t-w: decode on a pool of worker threads (0 => one per core), instead of within the event loop\n";
+  std::cerr << "\t-s: spread the streams, round-robin, across this many event loops, each in its own thread (0 => one per core)\n";
+  std::cerr << "\t-t: request RTP-over-TCP, instead of RTP/UDP\n";
+  std::cerr << "\t-H: 'headless': decode, but don't display, the streams (and just report how many frames were decoded)\n";
+  std::cerr << "\t-l: report each stream's latencies (capture->receive, receive->decoded, decoded->delivered) this often\n";
+  std::cerr << "\t-j: append each stream's reception and decoding statistics to this file, as JSON lines, every second\n";
+  std::cerr << "\t-d none|frame|slice: decode each stream on one thread, with frame threads (for throughput), or with slice\n"
+            << "\t    threads and low-delay decoding (for latency)\n";
+  std::cerr << "\t-b: the number of decoder threads to share between the streams, with -d frame|slice (0 => one per core)\n";
+  std::cerr << "\t-m <width>x<height>: show all of the streams, as a grid of tiles, in a single window of this size\n";
+  std::cerr << "\t-L: check this often whether decoding is overloaded and, if so, decode less of the lowest-priority streams\n"
+            << "\t    (reference frames only, then keyframes only).  The streams are prioritized in the order they're given\n";
+  std::cerr << "\t-a <width>x<height>: also make a BGR analytics image, of this size, from each decoded frame (and count them)\n";
+  std::cerr << "\t-A auto|scalar|sse4|avx2|sws: how to make the analytics images (default: auto, the fastest available)\n";
+  std::cerr << "\t-r <num-frames>: also write each stream's frames into a shared-memory ring of this many frames, for other\n"
+            << "\t    processes to read (the ring's path is printed once the stream's first frame has been decoded)\n";
+  std::cerr << "\t-c planes|bgr: also hand each frame to OpenCV, as \"cv::Mat\"s that share the frame's planes, or as a (pooled)\n"
+            << "\t    BGR \"cv::Mat\" (and count them)\n";
+  std::cerr << "\t-R mp4|ts: also record each stream, as received, to files named \"stream<id>-<YYYYmmdd-HHMMSS>.mp4\" (or \".ts\")\n";
+  std::cerr << "\t-S <seconds>: start a new recording file (at the next keyframe) this often (default: 60)\n";
+  std::cerr << "\t-n: only record the streams (with -R), without decoding them; implies -H\n";
+  std::cerr << "\t-e <seconds-before>:<seconds-after>: keep each stream's latest video and, on SIGUSR1, export a clip of each\n"
+            << "\t    stream, from (at least) this long before until this long after, to \"clip<id>-<YYYYmmdd-HHMMSS>.mp4\"\n";
+  std::cerr << "\t-K <stall-seconds>: keep the streams going: reconnect (with backoff) any stream that ends, fails, or receives\n"
+            << "\t    nothing for this long (0 => only those that end or fail)\n";
+  std::cerr << "\t-M <num-streams>: let at most this many streams connect (DESCRIBE/SETUP/PLAY) at once; the rest wait their turn.\n"
+            << "\t    Also reports how long the streams took to decode their first frames\n";
+  std::cerr << "\t-D <directory>: cache each stream's SDP description in this directory, and - when the stream is next opened -\n"
+            << "\t    use it instead of sending DESCRIBE.  Also reports how long the streams took to decode their first frames\n";
+  std::cerr << "\t-V: set up only the streams' video (not their audio, etc.)\n";
+}
 
-public:
-  MediaSubsessionIterator *iter;
-  MediaSession *session;
-  MediaSubsession *subsession;
-  TaskToken streamTimerTask;
-  double duration;
-};
+// Wakes the main thread (from any thread), so that it displays any newly decoded frames, and deletes closed streams' displays:
+static void wakeMainThread()
+{
+  SDL_Event event;
+  memset(&event, 0, sizeof event);
+  event.type = SDL_USEREVENT;
+  SDL_PushEvent(&event);
+}
 
-// If you're streaming just a single stream (i.e., just from a single URL, once), then you can define and use just a single
-// "StreamClientState" structure, as a global variable in your application.  However, because - in this demo application - we're
-// showing how to play multiple streams, concurrently, we can't do that.  Instead, we have to have a separate "StreamClientState"
-// structure for each "RTSPClient".  To do this, we subclass "RTSPClient", and add a "StreamClientState" field to the subclass:
+static Boolean parseDecodeThreading(char const *str, RTSPDecodeEngine::StreamOptions &streamOptions)
+{
+  if (strcmp(str, "none") == 0)
+    streamOptions.decodeThreading = RTSPDecodeEngine::DECODE_THREADING_NONE;
+  else if (strcmp(str, "frame") == 0)
+    streamOptions.decodeThreading = RTSPDecodeEngine::DECODE_THREADING_THROUGHPUT;
+  else if (strcmp(str, "slice") == 0)
+    streamOptions.decodeThreading = RTSPDecodeEngine::DECODE_THREADING_LATENCY;
+  else
+    return False;
+  return True;
+}
 
-class ourRTSPClient : public RTSPClient
+static Boolean parseAnalyticsScaler(char const *str, RTSPDecodeEngine::StreamOptions &streamOptions)
 {
-public:
-  static ourRTSPClient *createNew(UsageEnvironment &env, char const *rtspURL,
-                                  int verbosityLevel = 0,
-                                  char const *applicationName = NULL,
-                                  portNumBits tunnelOverHTTPPortNum = 0);
+  if (strcmp(str, "auto") == 0)
+    streamOptions.analyticsScaler = RTSPDecodeEngine::ANALYTICS_SCALER_AUTO;
+  else if (strcmp(str, "scalar") == 0)
+    streamOptions.analyticsScaler = RTSPDecodeEngine::ANALYTICS_SCALER_SCALAR;
+  else if (strcmp(str, "sse4") == 0)
+    streamOptions.analyticsScaler = RTSPDecodeEngine::ANALYTICS_SCALER_SSE4;
+  else if (strcmp(str, "avx2") == 0)
+    streamOptions.analyticsScaler = RTSPDecodeEngine::ANALYTICS_SCALER_AVX2;
+  else if (strcmp(str, "sws") == 0)
+    streamOptions.analyticsScaler = RTSPDecodeEngine::ANALYTICS_SCALER_SWSCALE;
+  else
+    return False;
+  return True;
+}
 
-protected:
-  ourRTSPClient(UsageEnvironment &env, char const *rtspURL,
-                int verbosityLevel, char const *applicationName, portNumBits tunnelOverHTTPPortNum);
-  // called only by createNew();
-  virtual ~ourRTSPClient();
+// Wraps "onFrame" so that it also writes each frame into a shared-memory ring of "numSlots" frames, for other processes to read
+// (using "SharedFrameRingReader").  The ring is created - and its path printed - when the stream's first frame arrives, because
+// its slots are sized for that frame.  It's closed once the stream's decoder (and so every copy of the callback) is gone:
+struct SharedFrameRingHolder
+{
+  SharedFrameRingHolder() : ring(NULL), failed(False) {}
+  ~SharedFrameRingHolder() { delete ring; }
 
-public:
-  StreamClientState scs;
+  SharedFrameRing *ring;
+  Boolean failed;
 };
 
-// Define a data sink (a subclass of "MediaSink") to receive the data for each subsession (i.e., each audio or video 'substream').
-// In practice, this might be a class (or a chain of classes) that decodes and then renders the incoming audio or video.
-// Or it might be a "FileSink", for outputting the received data into a file (as is done by the "openRTSP" application).
-// In this example code, however, we define a simple 'dummy' sink that receives incoming data, but does nothing with it.
-
-class DummySink : public MediaSink
+static RTSPDecodeEngine::FrameCallback withSharedFrameRing(unsigned numSlots, RTSPDecodeEngine::FrameCallback const &onFrame)
 {
-public:
-  static DummySink *createNew(UsageEnvironment &env,
-                              MediaSubsession &subsession,  // identifies the kind of data that's being received
-                              char const *streamId = NULL); // identifies the stream itself (optional)
-
-private:
-  DummySink(UsageEnvironment &env, MediaSubsession &subsession, char const *streamId);
-  // called only by "createNew()"
-  virtual ~DummySink();
-
-  static void afterGettingFrame(void *clientData, unsigned frameSize,
-                                unsigned numTruncatedBytes,
-                                struct timeval presentationTime,
-                                unsigned durationInMicroseconds);
-  void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
-                         struct timeval presentationTime, unsigned durationInMicroseconds);
-
-private:
-  // redefined virtual functions:
-  virtual Boolean continuePlaying();
+  std::shared_ptr<SharedFrameRingHolder> holder = std::make_shared<SharedFrameRingHolder>();
+  return [numSlots, onFrame, holder](unsigned streamId, AVFrame *frame) {
+    // (A stream's frames are delivered one at a time, so this needs no lock.)
+    if (holder->ring == NULL && !holder->failed)
+    {
+      char name[32];
+      snprintf(name, sizeof name, "rtsp-stream-%u", streamId);
+      holder->ring = SharedFrameRing::createNew(name, numSlots, SharedFrameRing::slotSizeFor(frame));
+      holder->failed = holder->ring == NULL;
+      if (holder->ring != NULL)
+        printf("Stream %u: frames are being shared in \"%s\"\n", streamId, holder->ring->path().c_str());
+    }
+    if (holder->ring != NULL)
+      holder->ring->write(frame);
+    onFrame(streamId, frame);
+  };
+}
 
-private:
-  u_int8_t *fReceiveBuffer;
-  MediaSubsession &fSubsession;
-  char *fStreamId;
+// Wraps "onFrame" so that it also presents each frame to OpenCV (as vision code would), either as "cv::Mat"s that share the
+// frame's planes (which stay valid for as long as the "cv::Mat"s are kept), or converted to a BGR "cv::Mat":
+enum MatOutput
+{
+  MAT_OUTPUT_NONE,
+  MAT_OUTPUT_PLANES,
+  MAT_OUTPUT_BGR
 };
 
-#define RTSP_CLIENT_VERBOSITY_LEVEL 1 // by default, print verbose output from each "RTSPClient"
-
-static unsigned rtspClientCount = 0; // Counts how many streams (i.e., "RTSPClient"s) are currently in use.
+static RTSPDecodeEngine::FrameCallback withMatOutput(MatOutput matOutput, RTSPDecodeEngine::FrameCallback const &onFrame)
+{
+  std::shared_ptr<BGRMatConverter> converter = std::make_shared<BGRMatConverter>(); // (one per stream)
+  return [matOutput, onFrame, converter](unsigned streamId, AVFrame *frame) {
+    std::vector<cv::Mat> planes;
+    if (matOutput == MAT_OUTPUT_PLANES ? AVFrameMat::wrapPlanes(frame, planes) : !converter->convert(frame).empty())
+      ++numMatFrames; // (A real application would pass the "cv::Mat"s on, e.g. to a detector, here.)
+    onFrame(streamId, frame);
+  };
+}
 
-void openURL(UsageEnvironment &env, char const *progName, char const *rtspURL)
+// Prints a stream's latencies (in ms) since its previous report:
+static void reportLatency(unsigned streamId, RTSPDecodeEngine::LatencyReport const &report)
 {
-  // Begin by creating a "RTSPClient" object.  Note that there is a separate "RTSPClient" object for each stream that we wish
-  // to receive (even if more than stream uses the same "rtsp://" URL).
-  RTSPClient *rtspClient = ourRTSPClient::createNew(env, rtspURL, RTSP_CLIENT_VERBOSITY_LEVEL, progName);
-  if (rtspClient == NULL)
+  RTSPDecodeEngine::LatencySummary const *stages[3] = {&report.captureToReceive, &report.receiveToDecoded, &report.decodedToDelivered};
+  char const *stageNames[3] = {"capture->receive", "receive->decoded", "decoded->delivered"};
+  printf("Stream %u latency (p50/p99/max ms):", streamId);
+  for (unsigned i = 0; i < 3; ++i)
   {
-    env << "Failed to create a RTSP client for URL \"" << rtspURL << "\": " << env.getResultMsg() << "\n";
-    return;
+    if (stages[i]->count == 0)
+      printf("  %s -", stageNames[i]); // (e.g., capture->receive, before the stream has been synchronized using RTCP)
+    else
+      printf("  %s %.1f/%.1f/%.1f", stageNames[i], stages[i]->p50US / 1000.0, stages[i]->p99US / 1000.0, stages[i]->maxUS / 1000.0);
   }
-
-  ++rtspClientCount;
-
-  // Next, send a RTSP "DESCRIBE" command, to get a SDP description for the stream.
-  // Note that this command - like all RTSP commands - is sent asynchronously; we do not block, waiting for a response.
-  // Instead, the following function call returns immediately, and we handle the RTSP response later, from within the event loop:
-  rtspClient->sendDescribeCommand(continueAfterDESCRIBE);
+  printf("\n");
 }
 
-// Implementation of the RTSP 'response handlers':
+// Prints each change that the load shedder makes to how much of a stream is decoded:
+static void reportDecodeLevel(unsigned streamId, RTSPDecodeEngine::DecodeLevel decodeLevel, unsigned busyPercent)
+{
+  char const *levelName = decodeLevel == RTSPDecodeEngine::DECODE_FULL               ? "full"
+                          : decodeLevel == RTSPDecodeEngine::DECODE_REFERENCE_FRAMES ? "reference frames only"
+                                                                                     : "keyframes only";
+  printf("Decoders are %u%% busy; decoding stream %u: %s\n", busyPercent, streamId, levelName);
+}
 
-void continueAfterDESCRIBE(RTSPClient *rtspClient, int resultCode, char *resultString)
+int main(int argc, char **argv)
 {
-  do
+  if (argc < 2)
   {
-    UsageEnvironment &env = rtspClient->envir();                 // alias
-    StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
+    printf("Please type: ./RTSPClient [options] URL1 URL2 URL3 ...\n");
+    return 1;
+  }
 
-    if (resultCode != 0)
+  // Any options come before the URLs:
+  RTSPDecodeEngine::Options options;
+  options.applicationName = argv[0];
+  RTSPDecodeEngine::StreamOptions streamOptions;
+  Boolean headless = False;
+  int mosaicWidth = 0, mosaicHeight = 0; // 0 => each stream gets its own window
+  unsigned sharedRingSlots = 0;          // 0 => the frames aren't shared with other processes
+  MatOutput matOutput = MAT_OUTPUT_NONE;
+  unsigned postEventSeconds = 0;
+  int firstURL = 1;
+  while (firstURL < argc && argv[firstURL][0] == '-')
+  {
+    if (strcmp(argv[firstURL], "-w") == 0 && firstURL + 1 < argc)
     {
-      env << *rtspClient << "Failed to get a SDP description: " << resultString << "\n";
-      delete[] resultString;
-      break;
+      options.numDecodeWorkers = atoi(argv[firstURL + 1]);
+      firstURL += 2;
     }
-
-    char *const sdpDescription = resultString;
-    env << *rtspClient << "Got a SDP description:\n"
-        << sdpDescription << "\n";
-
-    // Create a media session object from this SDP description:
-    scs.session = MediaSession::createNew(env, sdpDescription);
-    delete[] sdpDescription; // because we don't need it anymore
-    if (scs.session == NULL)
+    else if (strcmp(argv[firstURL], "-s") == 0 && firstURL + 1 < argc)
     {
-      env << *rtspClient << "Failed to create a MediaSession object from the SDP description: " << env.getResultMsg() << "\n";
-      break;
+      options.numEventLoops = (unsigned)atoi(argv[firstURL + 1]);
+      firstURL += 2;
     }
-    else if (!scs.session->hasSubsessions())
+    else if (strcmp(argv[firstURL], "-t") == 0)
     {
-      env << *rtspClient << "This session has no media subsessions (i.e., no \"m=\" lines)\n";
-      break;
+      options.streamUsingTCP = true;
+      ++firstURL;
     }
-
-    // Then, create and set up our data source objects for the session.  We do this by iterating over the session's 'subsessions',
-    // calling "MediaSubsession::initiate()", and then sending a RTSP "SETUP" command, on each one.
-    // (Each 'subsession' will have its own data source.)
-    scs.iter = new MediaSubsessionIterator(*scs.session);
-    setupNextSubsession(rtspClient);
-    return;
-  } while (0);
-
-  // An unrecoverable error occurred with this stream.
-  shutdownStream(rtspClient);
-}
-
-// By default, we request that the server stream its data using RTP/UDP.
-// If, instead, you want to request that the server stream via RTP-over-TCP, change the following to True:
-#define REQUEST_STREAMING_OVER_TCP False
-
-void setupNextSubsession(RTSPClient *rtspClient)
-{
-  UsageEnvironment &env = rtspClient->envir();                 // alias
-  StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
-
-  scs.subsession = scs.iter->next();
-  if (scs.subsession != NULL)
-  {
-    if (!scs.subsession->initiate())
+    else if (strcmp(argv[firstURL], "-H") == 0)
     {
-      env << *rtspClient << "Failed to initiate the \"" << *scs.subsession << "\" subsession: " << env.getResultMsg() << "\n";
-      setupNextSubsession(rtspClient); // give up on this subsession; go to the next one
+      headless = True;
+      ++firstURL;
     }
-    else
+    else if (strcmp(argv[firstURL], "-l") == 0 && firstURL + 1 < argc)
     {
-      env << *rtspClient << "Initiated the \"" << *scs.subsession << "\" subsession (";
-      if (scs.subsession->rtcpIsMuxed())
-      {
-        env << "client port " << scs.subsession->clientPortNum();
-      }
-      else
-      {
-        env << "client ports " << scs.subsession->clientPortNum() << "-" << scs.subsession->clientPortNum() + 1;
-      }
-      env << ")\n";
-
-      // Continue setting up this subsession, by sending a RTSP "SETUP" command:
-      rtspClient->sendSetupCommand(*scs.subsession, continueAfterSETUP, False, REQUEST_STREAMING_OVER_TCP);
+      options.latencyReportPeriodMS = (unsigned)(atof(argv[firstURL + 1]) * 1000);
+      options.onLatencyReport = reportLatency;
+      firstURL += 2;
     }
-    return;
-  }
-
-  // We've finished setting up all of the subsessions.  Now, send a RTSP "PLAY" command to start the streaming:
-  if (scs.session->absStartTime() != NULL)
-  {
-    // Special case: The stream is indexed by 'absolute' time, so send an appropriate "PLAY" command:
-    rtspClient->sendPlayCommand(*scs.session, continueAfterPLAY, scs.session->absStartTime(), scs.session->absEndTime());
-  }
-  else
-  {
-    scs.duration = scs.session->playEndTime() - scs.session->playStartTime();
-    rtspClient->sendPlayCommand(*scs.session, continueAfterPLAY);
-  }
-}
-
-void continueAfterSETUP(RTSPClient *rtspClient, int resultCode, char *resultString)
-{
-  do
-  {
-    UsageEnvironment &env = rtspClient->envir();                 // alias
-    StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
-
-    if (resultCode != 0)
+    else if (strcmp(argv[firstURL], "-j") == 0 && firstURL + 1 < argc)
     {
-      env << *rtspClient << "Failed to set up the \"" << *scs.subsession << "\" subsession: " << resultString << "\n";
-      break;
+      options.statsLogFileName = argv[firstURL + 1];
+      firstURL += 2;
     }
-
-    env << *rtspClient << "Set up the \"" << *scs.subsession << "\" subsession (";
-    if (scs.subsession->rtcpIsMuxed())
+    else if (strcmp(argv[firstURL], "-d") == 0 && firstURL + 1 < argc && parseDecodeThreading(argv[firstURL + 1], streamOptions))
     {
-      env << "client port " << scs.subsession->clientPortNum();
+      firstURL += 2;
     }
-    else
+    else if (strcmp(argv[firstURL], "-b") == 0 && firstURL + 1 < argc)
     {
-      env << "client ports " << scs.subsession->clientPortNum() << "-" << scs.subsession->clientPortNum() + 1;
+      options.decodeThreadBudget = (unsigned)atoi(argv[firstURL + 1]);
+      firstURL += 2;
     }
-    env << ")\n";
-
-    // Having successfully setup the subsession, create a data sink for it, and call "startPlaying()" on it.
-    // (This will prepare the data sink to receive data; the actual flow of data from the client won't start happening until later,
-    // after we've sent a RTSP "PLAY" command.)
-
-    scs.subsession->sink = DummySink::createNew(env, *scs.subsession, rtspClient->url());
-    // perhaps use your own custom "MediaSink" subclass instead
-    if (scs.subsession->sink == NULL)
+    else if (strcmp(argv[firstURL], "-m") == 0 && firstURL + 1 < argc &&
+             sscanf(argv[firstURL + 1], "%dx%d", &mosaicWidth, &mosaicHeight) == 2 && mosaicWidth > 0 && mosaicHeight > 0)
     {
-      env << *rtspClient << "Failed to create a data sink for the \"" << *scs.subsession
-          << "\" subsession: " << env.getResultMsg() << "\n";
-      break;
+      firstURL += 2;
     }
-
-    env << *rtspClient << "Created a data sink for the \"" << *scs.subsession << "\" subsession\n";
-    scs.subsession->miscPtr = rtspClient; // a hack to let subsession handler functions get the "RTSPClient" from the subsession
-    scs.subsession->sink->startPlaying(*(scs.subsession->readSource()),
-                                       subsessionAfterPlaying, scs.subsession);
-    // Also set a handler to be called if a RTCP "BYE" arrives for this subsession:
-    if (scs.subsession->rtcpInstance() != NULL)
+    else if (strcmp(argv[firstURL], "-L") == 0 && firstURL + 1 < argc)
     {
-      scs.subsession->rtcpInstance()->setByeWithReasonHandler(subsessionByeHandler, scs.subsession);
+      options.loadSheddingPeriodMS = (unsigned)(atof(argv[firstURL + 1]) * 1000);
+      options.onDecodeLevelChanged = reportDecodeLevel;
+      firstURL += 2;
     }
-  } while (0);
-  delete[] resultString;
-
-  // Set up the next subsession, if any:
-  setupNextSubsession(rtspClient);
-}
-
-void continueAfterPLAY(RTSPClient *rtspClient, int resultCode, char *resultString)
-{
-  Boolean success = False;
-
-  do
-  {
-    UsageEnvironment &env = rtspClient->envir();                 // alias
-    StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
-
-    if (resultCode != 0)
+    else if (strcmp(argv[firstURL], "-a") == 0 && firstURL + 1 < argc &&
+             sscanf(argv[firstURL + 1], "%ux%u", &streamOptions.analyticsWidth, &streamOptions.analyticsHeight) == 2)
     {
-      env << *rtspClient << "Failed to start playing session: " << resultString << "\n";
-      break;
+      streamOptions.onAnalyticsFrame = [](unsigned, RTSPDecodeEngine::AnalyticsImage const &) { ++numAnalyticsFrames; };
+      firstURL += 2;
     }
-
-    // Set a timer to be handled at the end of the stream's expected duration (if the stream does not already signal its end
-    // using a RTCP "BYE").  This is optional.  If, instead, you want to keep the stream active - e.g., so you can later
-    // 'seek' back within it and do another RTSP "PLAY" - then you can omit this code.
-    // (Alternatively, if you don't want to receive the entire stream, you could set this timer for some shorter value.)
-    if (scs.duration > 0)
+    else if (strcmp(argv[firstURL], "-A") == 0 && firstURL + 1 < argc && parseAnalyticsScaler(argv[firstURL + 1], streamOptions))
     {
-      unsigned const delaySlop = 2; // number of seconds extra to delay, after the stream's expected duration.  (This is optional.)
-      scs.duration += delaySlop;
-      unsigned uSecsToDelay = (unsigned)(scs.duration * 1000000);
-      scs.streamTimerTask = env.taskScheduler().scheduleDelayedTask(uSecsToDelay, (TaskFunc *)streamTimerHandler, rtspClient);
+      firstURL += 2;
     }
-
-    env << *rtspClient << "Started playing session";
-    if (scs.duration > 0)
+    else if (strcmp(argv[firstURL], "-r") == 0 && firstURL + 1 < argc)
     {
-      env << " (for up to " << scs.duration << " seconds)";
+      sharedRingSlots = (unsigned)atoi(argv[firstURL + 1]);
+      firstURL += 2;
+    }
+    else if (strcmp(argv[firstURL], "-R") == 0 && firstURL + 1 < argc &&
+             (strcmp(argv[firstURL + 1], "mp4") == 0 || strcmp(argv[firstURL + 1], "ts") == 0))
+    {
+      streamOptions.recordFormat = strcmp(argv[firstURL + 1], "mp4") == 0 ? RTSPDecodeEngine::RECORD_MP4 : RTSPDecodeEngine::RECORD_MPEG_TS;
+      firstURL += 2;
+    }
+    else if (strcmp(argv[firstURL], "-S") == 0 && firstURL + 1 < argc)
+    {
+      streamOptions.recordSegmentSeconds = (unsigned)atoi(argv[firstURL + 1]);
+      firstURL += 2;
+    }
+    else if (strcmp(argv[firstURL], "-n") == 0)
+    {
+      streamOptions.decode = false;
+      headless = True; // (there'd be nothing to display)
+      ++firstURL;
+    }
+    else if (strcmp(argv[firstURL], "-e") == 0 && firstURL + 1 < argc &&
+             sscanf(argv[firstURL + 1], "%u:%u", &streamOptions.preEventSeconds, &postEventSeconds) == 2)
+    {
+      signal(SIGUSR1, [](int) { clipRequested = 1; });
+      firstURL += 2;
+    }
+    else if (strcmp(argv[firstURL], "-K") == 0 && firstURL + 1 < argc)
+    {
+      streamOptions.reconnect = true;
+      streamOptions.stallTimeoutMS = (unsigned)(atof(argv[firstURL + 1]) * 1000);
+      firstURL += 2;
+    }
+    else if (strcmp(argv[firstURL], "-M") == 0 && firstURL + 1 < argc)
+    {
+      options.maxConcurrentConnects = (unsigned)atoi(argv[firstURL + 1]);
+      firstURL += 2;
+    }
+    else if (strcmp(argv[firstURL], "-D") == 0 && firstURL + 1 < argc)
+    {
+      options.sdpCacheDirectory = argv[firstURL + 1];
+      firstURL += 2;
+    }
+    else if (strcmp(argv[firstURL], "-V") == 0)
+    {
+      streamOptions.videoOnly = true;
+      ++firstURL;
+    }
+    else if (strcmp(argv[firstURL], "-c") == 0 && firstURL + 1 < argc &&
+             (strcmp(argv[firstURL + 1], "planes") == 0 || strcmp(argv[firstURL + 1], "bgr") == 0))
+    {
+      matOutput = strcmp(argv[firstURL + 1], "planes") == 0 ? MAT_OUTPUT_PLANES : MAT_OUTPUT_BGR;
+      firstURL += 2;
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
     }
-    env << "...\n";
-
-    success = True;
-  } while (0);
-  delete[] resultString;
-
-  if (!success)
-  {
-    // An unrecoverable error occurred with this stream.
-    shutdownStream(rtspClient);
   }
-}
-
-// Implementation of the other event handlers:
-
-void subsessionAfterPlaying(void *clientData)
-{
-  MediaSubsession *subsession = (MediaSubsession *)clientData;
-  RTSPClient *rtspClient = (RTSPClient *)(subsession->miscPtr);
 
-  // Begin by closing this subsession's stream:
-  Medium::close(subsession->sink);
-  subsession->sink = NULL;
-
-  // Next, check whether *all* subsessions' streams have now been closed:
-  MediaSession &session = subsession->parentSession();
-  MediaSubsessionIterator iter(session);
-  while ((subsession = iter.next()) != NULL)
+  // We need at least one "rtsp://" URL argument:
+  if (firstURL >= argc)
   {
-    if (subsession->sink != NULL)
-      return; // this subsession is still active
+    usage(argv[0]);
+    return 1;
   }
 
-  // All subsessions' streams have now been closed, so shutdown the client:
-  shutdownStream(rtspClient);
-}
-
-void subsessionByeHandler(void *clientData, char const *reason)
-{
-  MediaSubsession *subsession = (MediaSubsession *)clientData;
-  RTSPClient *rtspClient = (RTSPClient *)subsession->miscPtr;
-  UsageEnvironment &env = rtspClient->envir(); // alias
-
-  env << *rtspClient << "Received RTCP \"BYE\"";
-  if (reason != NULL)
+  if (!headless)
   {
-    env << " (reason:\"" << reason << "\")";
-    delete[](char *) reason;
+    // SDL is used only from this (the main) thread:
+    if (SDL_Init(SDL_INIT_VIDEO))
+    {
+      printf("Could not initialize SDL - %s\n", SDL_GetError());
+      return 1;
+    }
+    options.onStreamClosed = [](unsigned streamId) {
+      std::lock_guard<std::mutex> lock(displaysMutex);
+      closedStreams.insert(streamId);
+      wakeMainThread();
+    };
+    if (mosaicWidth > 0)
+    {
+      mosaic = new MosaicDisplay(argc - firstURL, mosaicWidth, mosaicHeight);
+      if (!mosaic->isOpen())
+      {
+        delete mosaic;
+        SDL_Quit();
+        return 1;
+      }
+    }
   }
-  env << " on \"" << *subsession << "\" subsession\n";
-
-  // Now act as if the subsession had closed:
-  subsessionAfterPlaying(subsession);
-}
-
-void streamTimerHandler(void *clientData)
-{
-  ourRTSPClient *rtspClient = (ourRTSPClient *)clientData;
-  StreamClientState &scs = rtspClient->scs; // alias
-
-  scs.streamTimerTask = NULL;
-
-  // Shut down the stream:
-  shutdownStream(rtspClient);
-}
 
-void shutdownStream(RTSPClient *rtspClient, int exitCode)
-{
-  UsageEnvironment &env = rtspClient->envir();                 // alias
-  StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
-
-  // First, check whether any subsessions have still to be closed:
-  if (scs.session != NULL)
+  int exitCode = 1; // the streams all ended (or failed), rather than the user quitting
   {
-    Boolean someSubsessionsWereActive = False;
-    MediaSubsessionIterator iter(*scs.session);
-    MediaSubsession *subsession;
+    RTSPDecodeEngine engine(options);
+
+    // Each stream's frame callback also feeds the optional outputs (a shared-memory ring, and/or OpenCV):
+    auto withOutputs = [sharedRingSlots, matOutput](RTSPDecodeEngine::FrameCallback onFrame) -> RTSPDecodeEngine::FrameCallback {
+      if (matOutput != MAT_OUTPUT_NONE)
+        onFrame = withMatOutput(matOutput, onFrame);
+      if (sharedRingSlots > 0)
+        onFrame = withSharedFrameRing(sharedRingSlots, onFrame);
+      return onFrame;
+    };
+
+    // There are argc-firstURL URLs: argv[firstURL] through argv[argc-1].  Open and start streaming each one:
+    std::vector<unsigned> streamIds; // (for reporting what's been recorded, and how quickly the streams started)
+    for (int i = firstURL; i <= argc - 1; ++i)
+    {
+      streamOptions.priority = argc - i; // so that, under load, the last stream is the first to be shed
+      if (headless)
+      {
+        RTSPDecodeEngine::FrameCallback onFrame = [](unsigned, AVFrame *) { ++numFramesDecoded; };
+        streamIds.push_back(engine.openStream(argv[i], withOutputs(onFrame), streamOptions));
+        continue;
+      }
+      if (mosaic != NULL)
+      {
+        unsigned tileNum = i - firstURL; // the streams fill the grid in the order they're given
+        RTSPDecodeEngine::FrameCallback onFrame = [tileNum](unsigned, AVFrame *frame) {
+          ++numFramesDecoded;
+          if (mosaic->frameDecoded(tileNum, frame))
+            wakeMainThread();
+        };
+        std::lock_guard<std::mutex> lock(displaysMutex);
+        unsigned streamId = engine.openStream(argv[i], withOutputs(onFrame), streamOptions);
+        mosaicTiles[streamId] = tileNum;
+        streamIds.push_back(streamId);
+        continue;
+      }
+
+      StreamDisplay *display = new StreamDisplay(argv[i]); // each stream gets its own window, titled with its URL
+      RTSPDecodeEngine::FrameCallback onFrame = [display](unsigned, AVFrame *frame) {
+        ++numFramesDecoded;
+        if (display->frameDecoded(frame))
+          wakeMainThread();
+      };
+      std::lock_guard<std::mutex> lock(displaysMutex);
+      unsigned streamId = engine.openStream(argv[i], withOutputs(onFrame), streamOptions);
+      displays[streamId] = display;
+      streamIds.push_back(streamId);
+    }
 
-    while ((subsession = iter.next()) != NULL)
+    // All subsequent activity takes place within the engine's threads, until the final stream has ended.  Meanwhile, this
+    // thread displays the frames that they decode (or, if 'headless', just reports how many have been decoded):
+    std::chrono::steady_clock::time_point lastReport = std::chrono::steady_clock::now();
+    while (engine.numOpenStreams() > 0)
     {
-      if (subsession->sink != NULL)
+      if (headless)
       {
-        Medium::close(subsession->sink);
-        subsession->sink = NULL;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      else
+      {
+        SDL_Event event;
+        if (SDL_WaitEventTimeout(&event, 100))
+        {
+          // Handle this event, and any others that are pending (such as wake-ups from other streams), before drawing once:
+          Boolean quit = event.type == SDL_QUIT;
+          while (!quit && SDL_PollEvent(&event))
+          {
+            quit = event.type == SDL_QUIT;
+          }
+          if (quit)
+          {
+            exitCode = 0;
+            break;
+          }
+        }
 
-        if (subsession->rtcpInstance() != NULL)
         {
-          subsession->rtcpInstance()->setByeHandler(NULL, NULL); // in case the server sends a RTCP "BYE" while handling "TEARDOWN"
+          std::lock_guard<std::mutex> lock(displaysMutex);
+          for (std::set<unsigned>::iterator it = closedStreams.begin(); it != closedStreams.end(); ++it)
+          {
+            if (mosaic != NULL)
+            {
+              mosaic->tileClosed(mosaicTiles[*it]);
+              mosaicTiles.erase(*it);
+              continue;
+            }
+            delete displays[*it];
+            displays.erase(*it);
+          }
+          closedStreams.clear();
+          for (std::map<unsigned, StreamDisplay *>::iterator it = displays.begin(); it != displays.end(); ++it)
+          {
+            it->second->present();
+          }
+        }
+        if (mosaic != NULL)
+        {
+          mosaic->present(); // (without holding the lock, because this waits for vsync)
         }
+      }
 
-        someSubsessionsWereActive = True;
+      if (clipRequested)
+      {
+        clipRequested = 0;
+        char timeStr[20];
+        time_t timeNow = time(NULL);
+        struct tm localTime;
+        localtime_r(&timeNow, &localTime);
+        strftime(timeStr, sizeof timeStr, "%Y%m%d-%H%M%S", &localTime);
+        for (unsigned i = 0; i < streamIds.size(); ++i)
+        {
+          char fileName[100];
+          snprintf(fileName, sizeof fileName, "clip%u-%s.mp4", streamIds[i], timeStr);
+          engine.exportClip(streamIds[i], fileName, postEventSeconds);
+        }
       }
-    }
 
-    if (someSubsessionsWereActive)
-    {
-      // Send a RTSP "TEARDOWN" command, to tell the server to shutdown the stream.
-      // Don't bother handling the response to the "TEARDOWN".
-      rtspClient->sendTeardownCommand(*scs.session, NULL);
+      if (std::chrono::steady_clock::now() - lastReport >= std::chrono::seconds(5))
+      {
+        printf("Decoded %lu frames (from %u streams)", (unsigned long)numFramesDecoded, engine.numOpenStreams());
+        if (streamOptions.onAnalyticsFrame)
+          printf("; made %lu analytics images", (unsigned long)numAnalyticsFrames);
+        if (matOutput != MAT_OUTPUT_NONE)
+          printf("; handed %lu frames to OpenCV", (unsigned long)numMatFrames);
+        if (streamOptions.recordFormat != RTSPDecodeEngine::RECORD_NONE || streamOptions.preEventSeconds > 0)
+        {
+          unsigned long long numAccessUnitsRecorded = 0, numRecordedFiles = 0, numClipsExported = 0;
+          for (unsigned i = 0; i < streamIds.size(); ++i)
+          {
+            RTSPDecodeEngine::StreamStats stats;
+            if (engine.getStreamStats(streamIds[i], stats))
+            {
+              numAccessUnitsRecorded += stats.numAccessUnitsRecorded;
+              numRecordedFiles += stats.numRecordedFiles;
+              numClipsExported += stats.numClipsExported;
+            }
+          }
+          if (streamOptions.recordFormat != RTSPDecodeEngine::RECORD_NONE)
+            printf("; recorded %llu access units (to %llu files)", numAccessUnitsRecorded, numRecordedFiles);
+          if (streamOptions.preEventSeconds > 0)
+            printf("; exported %llu clips", numClipsExported);
+        }
+        if (options.maxConcurrentConnects > 0 || options.sdpCacheDirectory != NULL)
+        {
+          // How quickly the streams started:
+          unsigned numStarted = 0;
+          int maxTimeToFirstFrameMS = 0;
+          for (unsigned i = 0; i < streamIds.size(); ++i)
+          {
+            RTSPDecodeEngine::StreamStats stats;
+            if (engine.getStreamStats(streamIds[i], stats) && stats.timeToFirstFrameMS >= 0)
+            {
+              ++numStarted;
+              if (stats.timeToFirstFrameMS > maxTimeToFirstFrameMS)
+                maxTimeToFirstFrameMS = stats.timeToFirstFrameMS;
+            }
+          }
+          printf("; %u streams have decoded a frame (the slowest after %d ms)", numStarted, maxTimeToFirstFrameMS);
+        }
+        if (!headless)
+        {
+          // (Frames that were decoded faster than we could display them:)
+          std::lock_guard<std::mutex> lock(displaysMutex);
+          unsigned long long numFramesOverwritten = mosaic != NULL ? mosaic->numFramesOverwritten() : 0;
+          for (std::map<unsigned, StreamDisplay *>::iterator it = displays.begin(); it != displays.end(); ++it)
+          {
+            numFramesOverwritten += it->second->numFramesOverwritten();
+          }
+          printf("; %llu were overwritten before they could be displayed", numFramesOverwritten);
+        }
+        printf("\n");
+        lastReport = std::chrono::steady_clock::now();
+      }
     }
+    // (Leaving this scope closes any streams that are still open, and stops the engine's threads.)
   }
 
-  env << *rtspClient << "Closing the stream.\n";
-  Medium::close(rtspClient);
-  // Note that this will also cause this stream's "StreamClientState" structure to get reclaimed.
-
-  if (--rtspClientCount == 0)
+  for (std::map<unsigned, StreamDisplay *>::iterator it = displays.begin(); it != displays.end(); ++it)
+  {
+    delete it->second;
+  }
+  displays.clear();
+  delete mosaic; // (the engine has stopped, so no more frames can be posted to it)
+  mosaic = NULL;
+  if (!headless)
   {
-    // The final stream has ended, so exit the application now.
-    // (Of course, if you're embedding this code into your own application, you might want to comment this out,
-    // and replace it with "eventLoopWatchVariable = 1;", so that we leave the LIVE555 event loop, and continue running "main()".)
-    exit(exitCode);
+    SDL_Quit();
   }
+  printf("Decoded %lu frames in all\n", (unsigned long)numFramesDecoded);
+  return exitCode;
 }
 
-// Implementation of "ourRTSPClient":
+// Implementation of "StreamDisplay":
 
-ourRTSPClient *ourRTSPClient::createNew(UsageEnvironment &env, char const *rtspURL,
-                                        int verbosityLevel, char const *applicationName, portNumBits tunnelOverHTTPPortNum)
+// The decoders' usual output - planar 8-bit 4:2:0 - has the same layout as an IYUV texture, so can be uploaded just as it is:
+static Boolean isUploadableAsIYUV(enum AVPixelFormat format)
 {
-  return new ourRTSPClient(env, rtspURL, verbosityLevel, applicationName, tunnelOverHTTPPortNum);
+  return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
 }
 
-ourRTSPClient::ourRTSPClient(UsageEnvironment &env, char const *rtspURL,
-                             int verbosityLevel, char const *applicationName, portNumBits tunnelOverHTTPPortNum)
-    : RTSPClient(env, rtspURL, verbosityLevel, applicationName, tunnelOverHTTPPortNum, -1)
+StreamDisplay::StreamDisplay(char const *title)
+    : fImgConvertCtx(NULL),
+      fConvertedWidth(0), fConvertedHeight(0), fScalerSrcFormat(AV_PIX_FMT_NONE),
+      fDisplayWidth(0), fDisplayHeight(0), fTextureWidth(0), fTextureHeight(0),
+      fSdlWindow(NULL), fSdlRenderer(NULL), fSdlTexture(NULL), fSDLInit(False)
 {
+  fTitle = strDup(title);
+  memset(fConvertedData, 0, sizeof fConvertedData);
+  memset(fConvertedLinesize, 0, sizeof fConvertedLinesize);
 }
 
-ourRTSPClient::~ourRTSPClient()
+StreamDisplay::~StreamDisplay()
 {
+  if (fSDLInit)
+  {
+    sdl_stop();
+  }
+  sws_freeContext(fImgConvertCtx);
+  freeConvertedFrame();
+  delete[] fTitle;
 }
 
-// Implementation of "StreamClientState":
-
-StreamClientState::StreamClientState()
-    : iter(NULL), session(NULL), subsession(NULL), streamTimerTask(NULL), duration(0.0)
+Boolean StreamDisplay::frameDecoded(AVFrame *frame)
 {
+  // (If the main thread hasn't yet taken the previous frame, it's already been woken.)
+  return fMailbox.post(frame);
 }
 
-StreamClientState::~StreamClientState()
+Boolean StreamDisplay::allocConvertedFrame(int width, int height, enum AVPixelFormat srcFormat)
 {
-  delete iter;
-  if (session != NULL)
+  freeConvertedFrame();
+  sws_freeContext(fImgConvertCtx);
+  fImgConvertCtx = sws_getContext(width, height, srcFormat, width, height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+  if (fImgConvertCtx == NULL)
   {
-    // We also need to delete "session", and unschedule "streamTimerTask" (if set)
-    UsageEnvironment &env = session->envir(); // alias
-
-    env.taskScheduler().unscheduleDelayedTask(streamTimerTask);
-    Medium::close(session);
+    fprintf(stderr, "Could not create a scaler for %dx%d frames\n", width, height);
+    return False;
   }
-}
-
-// Implementation of "DummySink":
-
-// Even though we're not going to be doing anything with the incoming data, we still need to receive it.
-// Define the size of the buffer that we'll use:
-#define DUMMY_SINK_RECEIVE_BUFFER_SIZE 100000
 
-DummySink *DummySink::createNew(UsageEnvironment &env, MediaSubsession &subsession, char const *streamId)
-{
-  return new DummySink(env, subsession, streamId);
-}
-
-DummySink::DummySink(UsageEnvironment &env, MediaSubsession &subsession, char const *streamId)
-    : MediaSink(env),
-      fSubsession(subsession)
-{
-  fStreamId = strDup(streamId);
-  fReceiveBuffer = new u_int8_t[DUMMY_SINK_RECEIVE_BUFFER_SIZE + 4];
-  char head[4] = {0x00, 0x00, 0x00, 0x01};
-  memcpy(fReceiveBuffer, head, 4);
+  if (av_image_alloc(fConvertedData, fConvertedLinesize, width, height, AV_PIX_FMT_YUV420P, 32) < 0)
+  {
+    fprintf(stderr, "Could not allocate a %dx%d display frame\n", width, height);
+    sws_freeContext(fImgConvertCtx);
+    fImgConvertCtx = NULL;
+    return False;
+  }
+  fConvertedWidth = width;
+  fConvertedHeight = height;
+  fScalerSrcFormat = srcFormat;
+  return True;
 }
 
-DummySink::~DummySink()
+void StreamDisplay::freeConvertedFrame()
 {
-  delete[] fReceiveBuffer;
-  delete[] fStreamId;
+  av_freep(&fConvertedData[0]); // "av_image_alloc()" allocates all of a frame's planes in one buffer
 }
 
-void DummySink::afterGettingFrame(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
-                                  struct timeval presentationTime, unsigned durationInMicroseconds)
+void StreamDisplay::present()
 {
-  DummySink *sink = (DummySink *)clientData;
-  unsigned int SPropRecords = -1;
-  SPropRecord *p_record = parseSPropParameterSets(sink->fSubsession.fmtp_spropparametersets(), SPropRecords);
-  //sps pps 以数组的形式保存SPropRecord中
-  SPropRecord &sps = p_record[0];
-  SPropRecord &pps = p_record[1];
-  sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
-}
-
-// If you don't want to see debugging output for each received frame, then comment out the following line:
-// #define DEBUG_PRINT_EACH_RECEIVED_FRAME 1
-
-void DummySink::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
-                                  struct timeval presentationTime, unsigned /*durationInMicroseconds*/)
-{
-  // We've just received a frame of data.  (Optionally) print out information about it:
-#ifdef DEBUG_PRINT_EACH_RECEIVED_FRAME
-  if (fStreamId != NULL)
-    envir() << "Stream \"" << fStreamId << "\"; ";
-  envir() << fSubsession.mediumName() << "/" << fSubsession.codecName() << ":\tReceived " << frameSize << " bytes";
-  if (numTruncatedBytes > 0)
-    envir() << " (with " << numTruncatedBytes << " bytes truncated)";
-  char uSecsStr[6 + 1]; // used to output the 'microseconds' part of the presentation time
-  sprintf(uSecsStr, "%06u", (unsigned)presentationTime.tv_usec);
-  envir() << ".\tPresentation time: " << (int)presentationTime.tv_sec << "." << uSecsStr;
-  if (fSubsession.rtpSource() != NULL && !fSubsession.rtpSource()->hasBeenSynchronizedUsingRTCP())
+  AVFrame *frame = fMailbox.take();
+  if (frame == NULL)
+    return; // no new frame since we last displayed one
+
+  // Upload the decoder's own planes (with their own linesizes), unless the frame's format is one that the texture can't take:
+  uint8_t *const *planes = frame->data;
+  int const *linesizes = frame->linesize;
+  enum AVPixelFormat srcFormat = (enum AVPixelFormat)frame->format;
+  if (!isUploadableAsIYUV(srcFormat))
   {
-    envir() << "!"; // mark the debugging output to indicate that this presentation time is not RTCP-synchronized
+    if (fImgConvertCtx == NULL || frame->width != fConvertedWidth || frame->height != fConvertedHeight || srcFormat != fScalerSrcFormat)
+    {
+      // This is the first such frame, or the stream has changed resolution (or format) mid-stream:
+      if (!allocConvertedFrame(frame->width, frame->height, srcFormat))
+        return;
+    }
+    sws_scale(fImgConvertCtx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height,
+              fConvertedData, fConvertedLinesize);
+    planes = fConvertedData;
+    linesizes = fConvertedLinesize;
   }
-#ifdef DEBUG_PRINT_NPT
-  envir() << "\tNPT: " << fSubsession.getNormalPlayTime(presentationTime);
-#endif
-  envir() << "\n";
-#endif
-  unsigned char const start_code[4] = {0x00, 0x00, 0x00, 0x01};
-  static unsigned char *tmp = NULL;
-
-  if (!fHaveWrittenFirstFrame)
+  fDisplayWidth = frame->width;
+  fDisplayHeight = frame->height;
+
+  if (!fSDLInit)
   {
-    unsigned numSPropRecords;
-    SPropRecord *sPropRecords = parseSPropParameterSets(fSubsession.fmtp_spropparametersets(), numSPropRecords);
-    envir() << "numSPropRecords = " << numSPropRecords << "\n";
-    unsigned int totalsize = 0;
-    for (unsigned i = 0; i < numSPropRecords; ++i)
-    {
-      totalsize = totalsize + 4 + sPropRecords[i].sPropLength;
-    }
-    envir() << "totalsize = " << totalsize << "\n";
-    tmp = (unsigned char *)realloc(tmp, totalsize);
-    c->extradata_size = totalsize;
-    c->extradata = tmp;
-    for (unsigned i = 0; i < numSPropRecords; ++i)
-    {
-      memcpy(tmp, start_code, 4);
-      memcpy(tmp + 4, sPropRecords[i].sPropBytes, sPropRecords[i].sPropLength);
-      tmp = tmp + 4 + sPropRecords[i].sPropLength;
-      printf("sPropRecords[%d].sPropLength = %d\n", i, sPropRecords[i].sPropLength);
-    }
-    delete[] sPropRecords;
-    fHaveWrittenFirstFrame = True; // for next time
+    fSDLInit = sdl_init(fDisplayWidth, fDisplayHeight);
+    if (!fSDLInit)
+      return;
   }
-  for (size_t i = 0; i < 22; i++)
+  else if (fDisplayWidth != fTextureWidth || fDisplayHeight != fTextureHeight)
   {
-    printf("%0.2X ", *(c->extradata + i));
+    // The stream has changed resolution, so replace the texture (and resize the window to match):
+    SDL_DestroyTexture(fSdlTexture);
+    fSdlTexture = SDL_CreateTexture(fSdlRenderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, fDisplayWidth, fDisplayHeight);
+    if (fSdlTexture == NULL)
+    {
+      printf("SDL: could not create SDL_Texture - %s\n", SDL_GetError());
+      sdl_stop();
+      return;
+    }
+    fTextureWidth = fDisplayWidth;
+    fTextureHeight = fDisplayHeight;
+    SDL_SetWindowSize(fSdlWindow, fDisplayWidth, fDisplayHeight);
   }
-  printf("\n");
-  // if(get_char() == 27) //SDL运行的时候不能在这里检测键盘
-  // {
-  //   if(SDLInit)
-  //   {
-  //     sdl_stop();
-  //   }
-  //   printf("exit ....");
-  //   exit(0);
-  // }
-  decoderyuv(fReceiveBuffer, frameSize);
-
-  // Then continue, to request the next frame of data:
-  continuePlaying();
-}
+  SDL_UpdateYUVTexture(fSdlTexture, NULL, planes[0], linesizes[0], planes[1], linesizes[1], planes[2], linesizes[2]);
 
-Boolean DummySink::continuePlaying()
-{
-  if (fSource == NULL)
-    return False; // sanity check (should not happen)
+  fSdlRect.x = 0;
+  fSdlRect.y = 0;
+  fSdlRect.w = fDisplayWidth;
+  fSdlRect.h = fDisplayHeight;
 
-  // Request the next frame of data from our input source.  "afterGettingFrame()" will get called later, when it arrives:
-  fSource->getNextFrame(fReceiveBuffer + 4, DUMMY_SINK_RECEIVE_BUFFER_SIZE,
-                        afterGettingFrame, this,
-                        onSourceClosure, this);
-  return True;
+  SDL_RenderClear(fSdlRenderer);
+  SDL_RenderCopy(fSdlRenderer, fSdlTexture, NULL, &fSdlRect);
+  SDL_RenderPresent(fSdlRenderer);
 }
 
-void decode_init(void)
+Boolean StreamDisplay::sdl_init(unsigned int width, unsigned int height)
 {
-  avcodec_register_all();
-  codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-  if (NULL == codec)
+  fSdlWindow = SDL_CreateWindow(fTitle != NULL ? fTitle : "Simplest Video Play SDL2",
+                                SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+  if (fSdlWindow == 0)
   {
-    fprintf(stderr, "Codec not found\n");
-    exit(1);
+    printf("SDL: could not create SDL_Window - %s\n", SDL_GetError());
+    return False;
   }
 
-  c = avcodec_alloc_context3(codec);
-  if (NULL == c)
+  fSdlRenderer = SDL_CreateRenderer(fSdlWindow, -1, SDL_RENDERER_ACCELERATED);
+  if (fSdlRenderer == NULL)
   {
-    fprintf(stderr, "Could not allocate video codec context\n");
-    exit(1);
+    printf("SDL: could not create SDL_Renderer - %s\n", SDL_GetError());
+    sdl_stop();
+    return False;
   }
-
-  avParserContext = av_parser_init(AV_CODEC_ID_H264);
-  if (NULL == avParserContext)
+  fSdlTexture = SDL_CreateTexture(fSdlRenderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, width, height);
+  if (fSdlTexture == NULL)
   {
-    fprintf(stderr, "Could not init avParserContext\n");
-    exit(1);
+    printf("SDL: could not create SDL_Texture - %s\n", SDL_GetError());
+    sdl_stop();
+    return False;
   }
+  fTextureWidth = width;
+  fTextureHeight = height;
+  return True;
+}
+
+void StreamDisplay::sdl_stop()
+{
+  if (fSdlTexture != NULL)
+    SDL_DestroyTexture(fSdlTexture);
+  if (fSdlRenderer != NULL)
+    SDL_DestroyRenderer(fSdlRenderer);
+  if (fSdlWindow != NULL)
+    SDL_DestroyWindow(fSdlWindow);
+  fSdlTexture = NULL;
+  fSdlRenderer = NULL;
+  fSdlWindow = NULL;
+  fSDLInit = False;
+}
+
+// Implementation of "MosaicDisplay":
+
+MosaicDisplay::Tile::Tile()
+    : scaler(NULL), srcWidth(0), srcHeight(0), srcFormat(AV_PIX_FMT_NONE), bufferPool(NULL),
+      texture(NULL), textureWidth(0), textureHeight(0), closed(False)
+{
+  scaledFrame = av_frame_alloc();
+  memset(&displayRect, 0, sizeof displayRect);
+}
+
+MosaicDisplay::Tile::~Tile()
+{
+  if (texture != NULL)
+    SDL_DestroyTexture(texture);
+  av_frame_free(&scaledFrame);
+  av_buffer_pool_uninit(&bufferPool); // (the pool is actually freed once the mailbox has released the last of its buffers)
+  sws_freeContext(scaler);
+}
 
-  if (avcodec_open2(c, codec, NULL) < 0)
+MosaicDisplay::MosaicDisplay(unsigned numTiles, int width, int height)
+    : fRedrawNeeded(True), fSdlWindow(NULL), fSdlRenderer(NULL)
+{
+  // Lay the tiles out in a grid that's as near to square as we can make it:
+  unsigned numColumns = (unsigned)ceil(sqrt((double)numTiles));
+  unsigned numRows = (numTiles + numColumns - 1) / numColumns;
+  int tileWidth = width / numColumns, tileHeight = height / numRows;
+  for (unsigned i = 0; i < numTiles; ++i)
   {
-    fprintf(stderr, "Could not open codec\n");
-    exit(1);
+    Tile *tile = new Tile;
+    tile->rect.x = (i % numColumns) * tileWidth;
+    tile->rect.y = (i / numColumns) * tileHeight;
+    tile->rect.w = tileWidth;
+    tile->rect.h = tileHeight;
+    fTiles.push_back(tile);
   }
 
-  frame = av_frame_alloc();
-  if (NULL == frame)
+  fSdlWindow = SDL_CreateWindow("RTSPClient mosaic", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                width, height, SDL_WINDOW_OPENGL);
+  if (fSdlWindow == NULL)
   {
-    fprintf(stderr, "Could not allocate video frame\n");
-    exit(1);
+    printf("SDL: could not create SDL_Window - %s\n", SDL_GetError());
+    return;
   }
-  pFrameYUV = av_frame_alloc();
+  fSdlRenderer = SDL_CreateRenderer(fSdlWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  if (fSdlRenderer == NULL)
+    printf("SDL: could not create SDL_Renderer - %s\n", SDL_GetError());
 }
 
-int decoderyuv(unsigned char *inbuf, int read_size)
-{
-  int got_frame;
-  unsigned char *buf = (unsigned char *)malloc((read_size + c->extradata_size) * 2);
-  printf("read_size = %d, extradata_size = %d , total size = %d\n", read_size, c->extradata_size, read_size + c->extradata_size);
-  memcpy(buf, c->extradata, c->extradata_size);
-  memcpy(buf + c->extradata_size, inbuf, read_size);
-  AVPacket avpkt = {0};
-  av_init_packet(&avpkt);
-  avpkt.data = buf;
-  avpkt.size = read_size + c->extradata_size;
-  int decode_len = avcodec_decode_video2(c, frame, &got_frame, &avpkt);
-  std::cout << "decode_len = " << decode_len << std::endl;
-  // exit(1);
-  if (decode_len < 0)
-    fprintf(stderr, "Error while decoding frame \n");
-  if (got_frame)
+MosaicDisplay::~MosaicDisplay()
+{
+  for (unsigned i = 0; i < fTiles.size(); ++i)
   {
-    std::cout << "width = " << frame->width << ", height = " << frame->height << std::endl;
-    if (!SDLInit)
-    {
-      sdl_init(frame->width, frame->height);
-      // sdl_init(100, 100);
-      SDLInit = true;
-    }
-    printf("c->width = %d, c->height = %d, c->pix_fmt = %d\n", c->width, c->height, c->pix_fmt);
-    enum AVPixelFormat FMT = AV_PIX_FMT_NV12;
-    uint8_t *yuv = (uint8_t *)av_malloc(avpicture_get_size(FMT, frame->width, frame->height) * sizeof(uint8_t));
-    avpicture_fill((AVPicture *)pFrameYUV, yuv, FMT, frame->width, frame->height);
-    img_convert_ctx = sws_getContext(c->width, c->height, c->pix_fmt, c->width, c->height, FMT, 2, NULL, NULL, NULL);
-    sws_scale(img_convert_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, pFrameYUV->data, pFrameYUV->linesize);
-    SDL_UpdateTexture(sdlTexture, NULL, yuv, c->width);
-
-    sdlRect.x = 0;
-    sdlRect.y = 0;
-    sdlRect.w = c->width;
-    sdlRect.h = c->height;
-
-    SDL_RenderClear(sdlRenderer);
-    SDL_RenderCopy(sdlRenderer, sdlTexture, NULL, &sdlRect);
-    SDL_RenderPresent(sdlRenderer);
-
-    av_free(yuv);
-    // SDL_Delay(33);
+    delete fTiles[i]; // (destroys its texture, so before the renderer)
   }
-  free(buf);
+  if (fSdlRenderer != NULL)
+    SDL_DestroyRenderer(fSdlRenderer);
+  if (fSdlWindow != NULL)
+    SDL_DestroyWindow(fSdlWindow);
 }
 
-void sdl_init(unsigned int width, unsigned int height)
+void MosaicDisplay::fitWithin(int width, int height, SDL_Rect const &bounds, SDL_Rect &fitted)
 {
-  if (SDL_Init(SDL_INIT_VIDEO))
+  if ((long long)width * bounds.h > (long long)height * bounds.w)
   {
-    printf("Could not initialize SDL - %s\n", SDL_GetError());
-    exit(1);
+    fitted.w = bounds.w;
+    fitted.h = (int)((long long)height * bounds.w / width);
   }
-  sdlWindow = SDL_CreateWindow("Simplest Video Play SDL2", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                               width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
-  if (sdlWindow == 0)
+  else
   {
-    printf("SDL: could not create SDL_Window - exiting:%s\n", SDL_GetError());
-    exit(1);
+    fitted.h = bounds.h;
+    fitted.w = (int)((long long)width * bounds.h / height);
   }
+  fitted.x = bounds.x + (bounds.w - fitted.w) / 2;
+  fitted.y = bounds.y + (bounds.h - fitted.h) / 2;
+}
 
-  sdlRenderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_ACCELERATED);
-  if (sdlRenderer == NULL)
-  {
-    printf("SDL: could not create SDL_Renderer - exiting:%s\n", SDL_GetError());
-    exit(1);
-  }
-  sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_NV12, SDL_TEXTUREACCESS_STREAMING, width, height);
-  if (sdlTexture == NULL)
+Boolean MosaicDisplay::frameDecoded(unsigned tileNum, AVFrame *frame)
+{
+  Tile &tile = *fTiles[tileNum]; // alias
+  enum AVPixelFormat srcFormat = (enum AVPixelFormat)frame->format;
+  if (frame->width != tile.srcWidth || frame->height != tile.srcHeight || srcFormat != tile.srcFormat)
   {
-    printf("SDL: could not create SDL_Texture - exiting:%s\n", SDL_GetError());
-    exit(1);
+    // This is the first frame, or the stream has changed resolution (or format) mid-stream.  Scale its frames down to fit the
+    // tile (but never up - the renderer can do that), with even dimensions, as 4:2:0 needs:
+    SDL_Rect fitted;
+    fitWithin(frame->width, frame->height, tile.rect, fitted);
+    int scaledWidth = (fitted.w < frame->width ? fitted.w : frame->width) & ~1;
+    int scaledHeight = (fitted.h < frame->height ? fitted.h : frame->height) & ~1;
+    if (scaledWidth < 2 || scaledHeight < 2)
+      return False;
+    av_buffer_pool_uninit(&tile.bufferPool);
+    tile.srcWidth = tile.srcHeight = 0;
+    if (scaledWidth == frame->width && scaledHeight == frame->height && isUploadableAsIYUV(srcFormat))
+    {
+      // The frames need neither scaling nor conversion:
+      sws_freeContext(tile.scaler);
+      tile.scaler = NULL;
+    }
+    else
+    {
+      tile.scaler = sws_getCachedContext(tile.scaler, frame->width, frame->height, srcFormat,
+                                         scaledWidth, scaledHeight, AV_PIX_FMT_YUV420P, SWS_AREA, NULL, NULL, NULL);
+      if (tile.scaler == NULL)
+      {
+        fprintf(stderr, "Could not create a scaler for %dx%d frames\n", frame->width, frame->height);
+        return False;
+      }
+      tile.bufferPool = av_buffer_pool_init(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, scaledWidth, scaledHeight, 32), NULL);
+      if (tile.bufferPool == NULL)
+        return False;
+    }
+    tile.scaledFrame->width = scaledWidth;
+    tile.scaledFrame->height = scaledHeight;
+    tile.scaledFrame->format = AV_PIX_FMT_YUV420P;
+    tile.srcWidth = frame->width;
+    tile.srcHeight = frame->height;
+    tile.srcFormat = srcFormat;
   }
+
+  if (tile.scaler == NULL)
+    return tile.mailbox.post(frame); // the decoder's own frame (so its buffers are shared, not copied)
+
+  // Scale into a buffer from the tile's pool (so that, once the pool has filled, nothing more is allocated), then post it:
+  AVFrame *scaled = tile.scaledFrame; // alias
+  scaled->buf[0] = av_buffer_pool_get(tile.bufferPool);
+  if (scaled->buf[0] == NULL)
+    return False;
+  av_image_fill_arrays(scaled->data, scaled->linesize, scaled->buf[0]->data, AV_PIX_FMT_YUV420P, scaled->width, scaled->height, 32);
+  sws_scale(tile.scaler, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, scaled->data, scaled->linesize);
+  Boolean wakeNeeded = tile.mailbox.post(scaled);
+  av_buffer_unref(&scaled->buf[0]); // (the mailbox holds its own reference)
+  return wakeNeeded;
 }
 
-void sdl_stop(void)
+void MosaicDisplay::tileClosed(unsigned tileNum)
 {
-  SDL_DestroyTexture(sdlTexture);
-  SDL_DestroyRenderer(sdlRenderer);
-  SDL_DestroyWindow(sdlWindow);
-  SDL_Quit();
+  Tile &tile = *fTiles[tileNum]; // alias
+  tile.closed = True;
+  if (tile.texture != NULL)
+  {
+    SDL_DestroyTexture(tile.texture);
+    tile.texture = NULL;
+  }
+  fRedrawNeeded = True;
 }
 
-int get_char()
+void MosaicDisplay::present()
 {
-    fd_set rfds;
-    struct timeval tv;
-    int ch = 0;
-
-    FD_ZERO(&rfds);
-    FD_SET(0, &rfds);
-    tv.tv_sec = 0;
-    tv.tv_usec = 1; //设置等待超时时间
+  // Upload each tile's newest frame (if it has one) to the tile's texture:
+  for (unsigned i = 0; i < fTiles.size(); ++i)
+  {
+    Tile &tile = *fTiles[i]; // alias
+    AVFrame *frame = tile.mailbox.take();
+    if (frame == NULL || tile.closed)
+      continue;
 
-    //检测键盘是否有输入
-    if (select(1, &rfds, NULL, NULL, &tv) > 0)
+    if (tile.texture == NULL || frame->width != tile.textureWidth || frame->height != tile.textureHeight)
     {
-        ch = getchar(); 
+      if (tile.texture != NULL)
+        SDL_DestroyTexture(tile.texture);
+      tile.texture = SDL_CreateTexture(fSdlRenderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+      if (tile.texture == NULL)
+      {
+        printf("SDL: could not create SDL_Texture - %s\n", SDL_GetError());
+        continue;
+      }
+      tile.textureWidth = frame->width;
+      tile.textureHeight = frame->height;
+      fitWithin(frame->width, frame->height, tile.rect, tile.displayRect);
     }
+    SDL_UpdateYUVTexture(tile.texture, NULL, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1],
+                         frame->data[2], frame->linesize[2]);
+    fRedrawNeeded = True;
+  }
+  if (!fRedrawNeeded)
+    return;
+  fRedrawNeeded = False;
 
-    return ch;
-}
\ No newline at end of file
+  // Then draw every tile, and present the whole window, once:
+  SDL_RenderClear(fSdlRenderer);
+  for (unsigned i = 0; i < fTiles.size(); ++i)
+  {
+    if (fTiles[i]->texture != NULL)
+      SDL_RenderCopy(fSdlRenderer, fTiles[i]->texture, NULL, &fTiles[i]->displayRect);
+  }
+  SDL_RenderPresent(fSdlRenderer);
+}
+
+unsigned long long MosaicDisplay::numFramesOverwritten() const
+{
+  unsigned long long total = 0;
+  for (unsigned i = 0; i < fTiles.size(); ++i)
+  {
+    total += fTiles[i]->mailbox.numFramesOverwritten();
+  }
+  return total;
+}
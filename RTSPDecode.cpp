@@ -0,0 +1,1712 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "librtspdecode": the RTSP client logic (based on LIVE555's "testRTSPClient" demo application), with each stream's video
+// decoded by its own "StreamDecoder", and the streams' event loops run in threads owned by a "RTSPDecodeEngine".
+
+#include "RTSPDecode.hh"
+#include "StreamDecoder.hh"
+#include "DecodeWorkerPool.hh"
+#include "LoadShedder.hh"
+#include "StreamRecorder.hh"
+#include "PreEventBuffer.hh"
+#include "ReceiveBufferPool.hh"
+#include "BasicUsageEnvironment.hh"
+#include <string>
+#include <thread>
+#include <random>
+
+// Forward function definitions:
+// RTSP 'response handlers':
+void continueAfterDESCRIBE(RTSPClient *rtspClient, int resultCode, char *resultString);
+void continueAfterSETUP(RTSPClient *rtspClient, int resultCode, char *resultString);
+void continueAfterPLAY(RTSPClient *rtspClient, int resultCode, char *resultString);
+
+// Other event handler functions:
+void subsessionAfterPlaying(void *clientData); // called when a stream's subsession (e.g., audio or video substream) ends
+void subsessionByeHandler(void *clientData, char const *reason);
+// called when a RTCP "BYE" is received for a subsession
+void streamTimerHandler(void *clientData);
+// called at the end of a stream's expected duration (if the stream has not already signaled its end using a RTCP "BYE")
+
+// Used to iterate through each stream's 'subsessions', setting up each one:
+void setupNextSubsession(RTSPClient *rtspClient);
+
+// Used to shut down and close a stream (including its "RTSPClient" object):
+void shutdownStream(RTSPClient *rtspClient);
+
+// A function that outputs a string that identifies each stream (for debugging output).  Modify this if you wish:
+UsageEnvironment &operator<<(UsageEnvironment &env, const RTSPClient &rtspClient)
+{
+  return env << "[URL:\"" << rtspClient.url() << "\"]: ";
+}
+
+// A function that outputs a string that identifies each subsession (for debugging output).  Modify this if you wish:
+UsageEnvironment &operator<<(UsageEnvironment &env, const MediaSubsession &subsession)
+{
+  return env << subsession.mediumName() << "/" << subsession.codecName();
+}
+
+#define SUPERVISION_PERIOD_MS 1000 // how often the streams that are to be reconnected are checked for stalls
+
+// Define a structure that keeps a reconnecting stream's decoder (and its parameter sets) between connections, so that if the
+// stream comes back with the same session parameters, its decoder needn't be set up again:
+
+struct CachedDecoder
+{
+  CachedDecoder() : decoder(NULL), parameterSets(NULL) {}
+  ~CachedDecoder() { clear(); }
+  void clear()
+  {
+    delete decoder;
+    delete parameterSets;
+    decoder = NULL;
+    parameterSets = NULL;
+  }
+
+  std::string sessionParameters; // of the subsession that the decoder was set up for (see "sessionParametersOf()")
+  StreamDecoder *decoder;        // NULL if none is cached
+  H264or5ParameterSets *parameterSets;
+};
+
+// Define a structure to hold the state of each stream that lasts across its connections (a stream is reconnected only if
+// "StreamOptions::reconnect" is set, or if the SDP description that it connected with was stale).  Unlike the stream's
+// "RTSPClient", this lasts until the stream is closed:
+
+struct SupervisedStream
+{
+  SupervisedStream(EventLoopShard &shard, char const *url, unsigned streamId, RTSPDecodeEngine::FrameCallback const &onFrame,
+                   RTSPDecodeEngine::StreamOptions const &streamOptions)
+      : shard(shard), url(url), streamId(streamId), onFrame(onFrame), streamOptions(streamOptions),
+        usedCachedSDP(False), played(False), reconnectTask(NULL), waitingForConnectSlot(False), numFailures(0), numReconnects(0),
+        closing(False), lastNumNALUnits(0), timeToPlayMS(-1)
+  {
+    lastProgressTime.tv_sec = lastProgressTime.tv_usec = 0;
+    startTime = lastProgressTime;
+  }
+
+  EventLoopShard &shard;
+  std::string url;
+  unsigned streamId;
+  RTSPDecodeEngine::FrameCallback onFrame;
+  RTSPDecodeEngine::StreamOptions streamOptions;
+  std::string sdpDescription; // from the last "DESCRIBE"; while this is set, connecting skips the "DESCRIBE"
+  Boolean usedCachedSDP;      // (by the current connection)
+  Boolean played;             // the current connection got as far as "PLAY"
+  CachedDecoder cachedDecoder;
+  TaskToken reconnectTask;    // non-NULL while waiting to reconnect
+  Boolean waitingForConnectSlot; // see "Options::maxConcurrentConnects"
+  unsigned numFailures;       // connections in a row that received nothing
+  unsigned numReconnects;
+  Boolean closing;            // "closeStream()" has been called, so the stream won't be reconnected again
+  u_int64_t lastNumNALUnits;  // received by the current connection, as of "lastProgressTime"
+  struct timeval lastProgressTime;
+  struct timeval startTime;   // when the stream (last) started connecting, including any wait for a connection slot
+  int timeToPlayMS;           // from "startTime" until the "PLAY" succeeded (-1 => not yet)
+};
+
+// Define a class that runs one LIVE555 event loop - with its own "TaskScheduler" and "UsageEnvironment" - in its own thread.
+// LIVE555 objects must only ever be used from the thread that runs their event loop, so each stream stays within one shard,
+// and other threads ask the shard to do things (such as opening or closing a stream) by posting it commands.
+
+class EventLoopShard
+{
+public:
+  EventLoopShard(RTSPDecodeEngine &engine);
+  virtual ~EventLoopShard(); // closes the shard's remaining streams, and stops its event loop
+
+  void post(std::function<void()> const &command); // called from any thread; "command" is run within the event loop
+
+  // The following are called only within the event loop:
+  RTSPDecodeEngine &engine() { return fEngine; }
+  DecodeWorkerPool *decodeWorkerPool() { return fEngine.fDecodeWorkerPool; }
+  LoadShedder *loadShedder() { return fEngine.fLoadShedder; }
+  RecordingWriter *recordingWriter() { return fEngine.fRecordingWriter; }
+  DecodeCounters &counters() { return *fEngine.fCounters; }
+  unsigned decodeThreadsFor(unsigned streamId, RTSPDecodeEngine::StreamOptions const &streamOptions) { return fEngine.decodeThreadsFor(streamId, streamOptions); }
+  void openURL(char const *rtspURL, unsigned streamId, RTSPDecodeEngine::FrameCallback const &onFrame,
+               RTSPDecodeEngine::StreamOptions const &streamOptions);
+  void closeStream(unsigned streamId);
+  void exportClip(unsigned streamId, std::string const &fileName, unsigned postEventSeconds, RTSPDecodeEngine::RecordFormat format);
+  void streamClosed(unsigned streamId); // called by "shutdownStream()"
+  void connectSlotGranted(unsigned streamId); // see "RTSPDecodeEngine::acquireConnectSlot()"
+  void connectFinished(RTSPClient *rtspClient); // called once the stream has "PLAY"ed, or is being shut down
+
+private:
+  void requestConnect(SupervisedStream *stream);
+  void connect(SupervisedStream *stream);
+  void scheduleReconnect(SupervisedStream *stream);
+  static void reconnect(void *clientData);
+  void reconnect(SupervisedStream *stream);
+  static void superviseStreams(void *clientData);
+  void superviseStreams();
+  static void runCommands(void *clientData);
+  void runCommands();
+  static void reportLatency(void *clientData);
+  void reportLatency();
+  static void gatherStats(void *clientData);
+  void gatherStats();
+
+private:
+  RTSPDecodeEngine &fEngine;
+  TaskScheduler *fScheduler;
+  UsageEnvironment *fEnv;
+  EventTriggerId fCommandTrigger;
+  TaskToken fLatencyReportTask;
+  TaskToken fStatsTask;
+  TaskToken fSupervisionTask;
+  std::mutex fCommandMutex;
+  std::vector<std::function<void()> > fCommands;
+  std::map<unsigned, RTSPClient *> fClients; // the shard's open streams, by id
+  std::map<unsigned, SupervisedStream *> fSupervisedStreams; // all of the shard's streams (by id), even between connections
+  std::minstd_rand fRandom;                                  // for jittering the reconnection delays
+  char volatile fWatchVariable;
+  std::thread fThread;
+};
+
+// Define a class to hold per-stream state that we maintain throughout each stream's lifetime:
+
+class StreamClientState
+{
+public:
+  StreamClientState();
+  virtual ~StreamClientState();
+
+public:
+  MediaSubsessionIterator *iter;
+  MediaSession *session;
+  MediaSubsession *subsession;
+  TaskToken streamTimerTask;
+  double duration;
+};
+
+// If you're streaming just a single stream (i.e., just from a single URL, once), then you can define and use just a single
+// "StreamClientState" structure, as a global variable in your application.  However, because - in this demo application - we're
+// showing how to play multiple streams, concurrently, we can't do that.  Instead, we have to have a separate "StreamClientState"
+// structure for each "RTSPClient".  To do this, we subclass "RTSPClient", and add a "StreamClientState" field to the subclass:
+
+class ourRTSPClient : public RTSPClient
+{
+public:
+  static ourRTSPClient *createNew(UsageEnvironment &env, char const *rtspURL,
+                                  EventLoopShard &shard, unsigned streamId, RTSPDecodeEngine::FrameCallback const &onFrame,
+                                  int verbosityLevel = 0,
+                                  char const *applicationName = NULL,
+                                  portNumBits tunnelOverHTTPPortNum = 0);
+
+protected:
+  ourRTSPClient(UsageEnvironment &env, char const *rtspURL,
+                EventLoopShard &shard, unsigned streamId, RTSPDecodeEngine::FrameCallback const &onFrame,
+                int verbosityLevel, char const *applicationName, portNumBits tunnelOverHTTPPortNum);
+  // called only by createNew();
+  virtual ~ourRTSPClient();
+
+public:
+  StreamClientState scs;
+  EventLoopShard &shard;                   // the event loop that the stream belongs to
+  unsigned streamId;                       // the engine's id for the stream
+  RTSPDecodeEngine::FrameCallback onFrame; // given each of the stream's decoded video frames
+  RTSPDecodeEngine::StreamOptions streamOptions;
+  SupervisedStream *supervision;           // the stream's state across connections
+  Boolean holdsConnectSlot;                // until the stream has "PLAY"ed (see "Options::maxConcurrentConnects")
+};
+
+// Define a data sink (a subclass of "MediaSink") to receive the data for each subsession (i.e., each audio or video 'substream').
+// In practice, this might be a class (or a chain of classes) that decodes and then renders the incoming audio or video.
+// Or it might be a "FileSink", for outputting the received data into a file (as is done by the "openRTSP" application).
+// In this example code, however, we define a simple 'dummy' sink that receives incoming data, but does nothing with it.
+
+class DummySink : public MediaSink
+{
+public:
+  static DummySink *createNew(UsageEnvironment &env,
+                              MediaSubsession &subsession, // identifies the kind of data that's being received
+                              char const *streamId,        // identifies the stream itself (for debugging output)
+                              unsigned streamNum, RTSPDecodeEngine::FrameCallback const &onFrame,
+                              DecodeWorkerPool *decodeWorkerPool, // NULL => decode within the event loop
+                              LoadShedder *loadShedder,           // NULL => the stream is never shed
+                              RecordingWriter *recordingWriter,   // NULL => the stream isn't recorded
+                              CachedDecoder *cachedDecoder,       // NULL => the stream isn't to be reconnected
+                              DecodeCounters &counters, RTSPDecodeEngine::StreamOptions const &streamOptions);
+
+  // Counts of the frames that were too big for our receive buffer (and so were truncated, and not decoded):
+  u_int64_t numBytesReceived() const { return fNumBytesReceived; }
+  u_int64_t numNALUnitsReceived() const { return fNumNALUnitsReceived; }
+  unsigned numTruncatedFrames() const { return fNumTruncatedFrames; }
+  u_int64_t numTruncatedBytes() const { return fNumTruncatedBytes; }
+  unsigned receiveBufferSize() const { return ReceiveBufferPool::capacityOf(fReceiveBufferSizeClass); }
+  StreamDecoder *decoder() const { return fDecoder; } // NULL unless this subsession carries H.264 or H.265 video (and is decoded)
+  StreamRecorder *recorder() const { return fRecorder; } // NULL unless this subsession carries H.264 or H.265 video, and is recorded
+  PreEventBuffer *preEventBuffer() const { return fPreEventBuffer; } // ditto, with a pre-event buffer
+
+private:
+  DummySink(UsageEnvironment &env, MediaSubsession &subsession, char const *streamId,
+            DecodeWorkerPool *decodeWorkerPool, LoadShedder *loadShedder, DecodeCounters &counters);
+  // called only by "createNew()"
+  virtual ~DummySink();
+
+  static void afterGettingFrame(void *clientData, unsigned frameSize,
+                                unsigned numTruncatedBytes,
+                                struct timeval presentationTime,
+                                unsigned durationInMicroseconds);
+  void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+                         struct timeval presentationTime, unsigned durationInMicroseconds);
+
+private:
+  // redefined virtual functions:
+  virtual Boolean continuePlaying();
+
+  void resizeReceiveBuffer(unsigned frameSize, unsigned numTruncatedBytes);
+
+private:
+  u_int8_t *fReceiveBuffer;
+  unsigned fReceiveBufferSizeClass;
+  unsigned fLargestFrameSinceResize;
+  struct timeval fLastResizeTime;
+  u_int64_t fNumBytesReceived;
+  u_int64_t fNumNALUnitsReceived;
+  unsigned fNumTruncatedFrames;
+  u_int64_t fNumTruncatedBytes;
+  MediaSubsession &fSubsession;
+  char *fStreamId;
+  H264or5ParameterSets *fParameterSets; // NULL unless this subsession carries H.264 or H.265 video
+  StreamDecoder *fDecoder;           // ditto
+  StreamRecorder *fRecorder;         // ditto
+  PreEventBuffer *fPreEventBuffer;   // ditto
+  CachedDecoder *fCachedDecoder;     // where our decoder is kept, when we're closed, for the stream's next connection (if any)
+  std::string fSessionParameters;
+  DecodeWorkerPool *fDecodeWorkerPool;
+  LoadShedder *fLoadShedder;
+  DecodeCounters &fCounters;
+};
+
+#define RTSP_CLIENT_VERBOSITY_LEVEL 1 // by default, print verbose output from each "RTSPClient"
+
+// Implementation of "RTSPDecodeEngine":
+
+RTSPDecodeEngine::Options::Options()
+    : numEventLoops(1), numDecodeWorkers(-1), streamUsingTCP(false),
+      verbosityLevel(RTSP_CLIENT_VERBOSITY_LEVEL), applicationName("librtspdecode"), latencyReportPeriodMS(0),
+      statsPeriodMS(1000), statsLogFileName(NULL), decodeThreadBudget(0),
+      loadSheddingPeriodMS(0), decodeBusyBudgetPercent(80), reconnectMinDelayMS(500), reconnectMaxDelayMS(30000),
+      maxConcurrentConnects(0), sdpCacheDirectory(NULL)
+{
+}
+
+RTSPDecodeEngine::StreamOptions::StreamOptions()
+    : decodeThreading(DECODE_THREADING_NONE), decodeThreads(0), priority(0), lowestDecodeLevel(DECODE_KEYFRAMES),
+      analyticsWidth(0), analyticsHeight(0), analyticsScaler(ANALYTICS_SCALER_AUTO),
+      recordFormat(RECORD_NONE), recordSegmentSeconds(60), decode(true), preEventSeconds(0), preEventBufferSize(16 * 1024 * 1024),
+      reconnect(false), stallTimeoutMS(10000), videoOnly(false)
+{
+}
+
+RTSPDecodeEngine::RTSPDecodeEngine(Options const &options)
+    : fOptions(options), fDecodeWorkerPool(NULL), fLoadShedder(NULL), fRecordingWriter(NULL), fCounters(new DecodeCounters), fStatsLog(NULL),
+      fNumDecodeThreadsAllocated(0), fNumConnecting(0), fStopping(false), fNextStreamId(1), fNextShard(0)
+{
+  // Each video stream opens its own decoder (see "StreamDecoder"), but the codecs only need to be registered once:
+  static std::once_flag codecsRegistered;
+  std::call_once(codecsRegistered, avcodec_register_all);
+
+  if (fOptions.statsLogFileName != NULL)
+  {
+    fStatsLog = fopen(fOptions.statsLogFileName, "a");
+    if (fStatsLog == NULL)
+      fprintf(stderr, "Could not open the statistics log \"%s\"\n", fOptions.statsLogFileName);
+  }
+
+  if (fOptions.numDecodeWorkers >= 0)
+  {
+    fDecodeWorkerPool = new DecodeWorkerPool(fOptions.numDecodeWorkers);
+  }
+
+  unsigned numEventLoops = fOptions.numEventLoops;
+  if (numEventLoops == 0)
+    numEventLoops = std::thread::hardware_concurrency();
+  if (numEventLoops == 0)
+    numEventLoops = 1; // the core count isn't known
+  for (unsigned i = 0; i < numEventLoops; ++i)
+  {
+    fShards.push_back(new EventLoopShard(*this));
+  }
+
+  if (fOptions.loadSheddingPeriodMS > 0)
+  {
+    // Decoding happens on the worker threads if there are any, otherwise within the event loops:
+    unsigned numDecodingThreads = fDecodeWorkerPool != NULL ? fDecodeWorkerPool->numWorkers() : fShards.size();
+    fLoadShedder = new LoadShedder(*fCounters, numDecodingThreads, fOptions.loadSheddingPeriodMS, fOptions.decodeBusyBudgetPercent,
+                                   fOptions.onDecodeLevelChanged);
+  }
+}
+
+RTSPDecodeEngine::~RTSPDecodeEngine()
+{
+  {
+    // Don't let any more (queued) streams connect, because their event loops may already have stopped:
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStopping = true;
+  }
+  // Stop the event loops (closing their streams) first, so that nothing more gets submitted to the decode workers:
+  for (unsigned i = 0; i < fShards.size(); ++i)
+  {
+    delete fShards[i];
+  }
+  delete fLoadShedder; // (by now, every decoder has been removed from it)
+  delete fDecodeWorkerPool;
+  delete fRecordingWriter; // (each stream's recorder has ended its file, so this just finishes writing them)
+  delete fCounters;
+  if (fStatsLog != NULL)
+    fclose(fStatsLog);
+}
+
+unsigned RTSPDecodeEngine::openStream(char const *rtspURL, FrameCallback const &onFrame, StreamOptions const &streamOptions)
+{
+  unsigned streamId;
+  EventLoopShard *shard;
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    streamId = fNextStreamId++;
+    shard = fShards[fNextShard++ % fShards.size()];
+    fStreams[streamId] = shard;
+    if ((streamOptions.recordFormat != RECORD_NONE || streamOptions.preEventSeconds > 0) && fRecordingWriter == NULL)
+      fRecordingWriter = new RecordingWriter; // (which also writes exported clips)
+  }
+
+  std::string url(rtspURL);
+  shard->post([shard, url, streamId, onFrame, streamOptions]() { shard->openURL(url.c_str(), streamId, onFrame, streamOptions); });
+  return streamId;
+}
+
+void RTSPDecodeEngine::closeStream(unsigned streamId)
+{
+  EventLoopShard *shard;
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::map<unsigned, EventLoopShard *>::iterator it = fStreams.find(streamId);
+    if (it == fStreams.end())
+      return; // the stream has already closed
+    shard = it->second;
+  }
+  shard->post([shard, streamId]() { shard->closeStream(streamId); });
+}
+
+bool RTSPDecodeEngine::exportClip(unsigned streamId, char const *fileName, unsigned postEventSeconds, RecordFormat format)
+{
+  EventLoopShard *shard;
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::map<unsigned, EventLoopShard *>::iterator it = fStreams.find(streamId);
+    if (it == fStreams.end())
+      return false;
+    shard = it->second;
+  }
+  std::string name(fileName);
+  shard->post([shard, streamId, name, postEventSeconds, format]() { shard->exportClip(streamId, name, postEventSeconds, format); });
+  return true;
+}
+
+unsigned RTSPDecodeEngine::numOpenStreams()
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  return fStreams.size();
+}
+
+void RTSPDecodeEngine::getTotals(Totals &totals) const
+{
+  totals.numFramesDecoded = fCounters->numFramesDecoded;
+  totals.decodeTimeUS = fCounters->decodeTimeUS;
+  totals.numDroppedAccessUnits = fCounters->numDroppedAccessUnits;
+  totals.numTruncatedFrames = fCounters->numTruncatedFrames;
+}
+
+unsigned RTSPDecodeEngine::decodeThreadsFor(unsigned streamId, StreamOptions const &streamOptions)
+{
+  if (streamOptions.decodeThreading == DECODE_THREADING_NONE)
+    return 1;
+  if (streamOptions.decodeThreads > 0)
+    return streamOptions.decodeThreads; // (outside the budget)
+
+  unsigned budget = fOptions.decodeThreadBudget;
+  if (budget == 0)
+    budget = std::thread::hardware_concurrency();
+  if (budget == 0)
+    budget = 1; // the core count isn't known
+  std::lock_guard<std::mutex> lock(fMutex);
+  std::map<unsigned, unsigned>::iterator it = fDecodeThreads.find(streamId);
+  if (it != fDecodeThreads.end())
+    return it->second; // the stream has reconnected, so keeps the threads that it was given before
+
+  // Give the stream an equal share of the budget, among all of the streams that are open (including those that were opened
+  // together with it, but haven't been set up yet) - but no more than what's left of the budget, so that streams opened later
+  // can't oversubscribe it.  Each stream gets at least one thread, though, even once the budget has run out:
+  unsigned share = budget / (fStreams.empty() ? 1 : fStreams.size());
+  unsigned remaining = budget > fNumDecodeThreadsAllocated ? budget - fNumDecodeThreadsAllocated : 0;
+  if (share > remaining)
+    share = remaining;
+  if (share == 0)
+    share = 1;
+  fDecodeThreads[streamId] = share;
+  fNumDecodeThreadsAllocated += share;
+  return share;
+}
+
+bool RTSPDecodeEngine::getStreamStats(unsigned streamId, StreamStats &stats)
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  std::map<unsigned, StreamStats>::iterator it = fStreamStats.find(streamId);
+  if (it == fStreamStats.end())
+    return false;
+  stats = it->second;
+  return true;
+}
+
+// Writes "str" as a JSON string:
+static void writeJSONString(FILE *fid, char const *str)
+{
+  fputc('"', fid);
+  for (; *str != '\0'; ++str)
+  {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\')
+      fprintf(fid, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(fid, "\\u%04x", c);
+    else
+      fputc(c, fid);
+  }
+  fputc('"', fid);
+}
+
+void RTSPDecodeEngine::updateStreamStats(unsigned streamId, StreamStats const &stats)
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  if (fStreams.count(streamId) == 0)
+    return; // the stream has just closed
+  fStreamStats[streamId] = stats;
+
+  if (fStatsLog != NULL)
+  {
+    // (We hold "fMutex", so lines from different event loops don't get interleaved.)
+    struct timeval timeNow;
+    gettimeofday(&timeNow, NULL);
+    fprintf(fStatsLog, "{\"time\":%ld.%06ld,\"stream\":%u,\"url\":", (long)timeNow.tv_sec, (long)timeNow.tv_usec, streamId);
+    writeJSONString(fStatsLog, stats.url.c_str());
+    fprintf(fStatsLog, ",\"bytes_received\":%llu,\"nal_units_received\":%llu,\"truncated_frames\":%llu"
+                       ",\"frames_decoded\":%llu,\"decode_errors\":%llu,\"dropped_access_units\":%llu,\"receive_buffer_size\":%u"
+                       ",\"rtp_packets_received\":%llu,\"rtp_packets_expected\":%llu,\"rtp_packets_lost\":%lld"
+                       ",\"jitter_ms\":%.3f,\"max_inter_packet_gap_us\":%u,\"decode_level\":%d"
+                       ",\"access_units_recorded\":%llu,\"recorded_files\":%llu,\"clips_exported\":%llu,\"reconnects\":%u"
+                       ",\"time_to_play_ms\":%d,\"time_to_first_frame_ms\":%d}\n",
+            stats.numBytesReceived, stats.numNALUnitsReceived, stats.numTruncatedFrames,
+            stats.numFramesDecoded, stats.numDecodeErrors, stats.numDroppedAccessUnits, stats.receiveBufferSize,
+            stats.numRTPPacketsReceived, stats.numRTPPacketsExpected, stats.numRTPPacketsLost,
+            stats.jitterMS, stats.maxInterPacketGapUS, (int)stats.decodeLevel,
+            stats.numAccessUnitsRecorded, stats.numRecordedFiles, stats.numClipsExported,
+            stats.numReconnects, stats.timeToPlayMS, stats.timeToFirstFrameMS);
+    fflush(fStatsLog);
+  }
+}
+
+bool RTSPDecodeEngine::acquireConnectSlot(EventLoopShard *shard, unsigned streamId)
+{
+  if (fOptions.maxConcurrentConnects == 0)
+    return true;
+  std::lock_guard<std::mutex> lock(fMutex);
+  if (fNumConnecting < fOptions.maxConcurrentConnects)
+  {
+    ++fNumConnecting;
+    return true;
+  }
+  fConnectQueue.push_back(std::make_pair(shard, streamId));
+  return false;
+}
+
+void RTSPDecodeEngine::releaseConnectSlot()
+{
+  if (fOptions.maxConcurrentConnects == 0)
+    return;
+  std::lock_guard<std::mutex> lock(fMutex);
+  if (!fConnectQueue.empty() && !fStopping)
+  {
+    // Hand the slot straight to the stream that has waited longest (which may be in another event loop).  (We post while
+    // holding "fMutex", so that the engine's destructor can't stop that event loop in the meantime.)
+    EventLoopShard *shard = fConnectQueue.front().first;
+    unsigned streamId = fConnectQueue.front().second;
+    fConnectQueue.pop_front();
+    shard->post([shard, streamId]() { shard->connectSlotGranted(streamId); });
+  }
+  else if (fNumConnecting > 0)
+  {
+    --fNumConnecting;
+  }
+}
+
+void RTSPDecodeEngine::streamClosed(unsigned streamId)
+{
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStreams.erase(streamId);
+    fStreamStats.erase(streamId);
+    std::map<unsigned, unsigned>::iterator it = fDecodeThreads.find(streamId);
+    if (it != fDecodeThreads.end())
+    {
+      // Return the stream's decoder threads to the budget:
+      fNumDecodeThreadsAllocated -= it->second;
+      fDecodeThreads.erase(it);
+    }
+  }
+  if (fOptions.onStreamClosed)
+  {
+    fOptions.onStreamClosed(streamId);
+  }
+}
+
+// Each stream's SDP description can be cached (see "Options::sdpCacheDirectory") in a file that's named from a hash (64-bit
+// FNV-1a) of the stream's URL:
+static std::string cachedSDPFileName(char const *sdpCacheDirectory, std::string const &url)
+{
+  u_int64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned i = 0; i < url.size(); ++i)
+  {
+    hash ^= (unsigned char)url[i];
+    hash *= 0x100000001b3ULL;
+  }
+  char fileName[30];
+  sprintf(fileName, "/%016llx.sdp", (unsigned long long)hash);
+  return std::string(sdpCacheDirectory) + fileName;
+}
+
+static std::string loadCachedSDP(char const *sdpCacheDirectory, std::string const &url)
+{
+  std::string sdpDescription;
+  FILE *fid = fopen(cachedSDPFileName(sdpCacheDirectory, url).c_str(), "r");
+  if (fid == NULL)
+    return sdpDescription; // (the stream hasn't been described before)
+  char buf[4096];
+  size_t numBytes;
+  while ((numBytes = fread(buf, 1, sizeof buf, fid)) > 0)
+  {
+    sdpDescription.append(buf, numBytes);
+  }
+  fclose(fid);
+  return sdpDescription;
+}
+
+static void saveCachedSDP(char const *sdpCacheDirectory, std::string const &url, std::string const &sdpDescription)
+{
+  // Write a temporary file, then rename it, so that an interrupted write never leaves a partial description:
+  std::string fileName = cachedSDPFileName(sdpCacheDirectory, url);
+  std::string tempFileName = fileName + ".tmp";
+  FILE *fid = fopen(tempFileName.c_str(), "w");
+  if (fid == NULL)
+    return;
+  Boolean written = fwrite(sdpDescription.data(), 1, sdpDescription.size(), fid) == sdpDescription.size();
+  written = fclose(fid) == 0 && written;
+  if (!written || rename(tempFileName.c_str(), fileName.c_str()) != 0)
+    remove(tempFileName.c_str());
+}
+
+static void removeCachedSDP(char const *sdpCacheDirectory, std::string const &url)
+{
+  remove(cachedSDPFileName(sdpCacheDirectory, url).c_str());
+}
+
+// Implementation of "EventLoopShard":
+
+EventLoopShard::EventLoopShard(RTSPDecodeEngine &engine)
+    : fEngine(engine), fLatencyReportTask(NULL), fStatsTask(NULL), fSupervisionTask(NULL), fRandom(std::random_device()()),
+      fWatchVariable(0)
+{
+  fScheduler = BasicTaskScheduler::createNew();
+  fEnv = BasicUsageEnvironment::createNew(*fScheduler);
+  fCommandTrigger = fScheduler->createEventTrigger(runCommands);
+  if (fEngine.options().latencyReportPeriodMS > 0)
+  {
+    fLatencyReportTask = fScheduler->scheduleDelayedTask(fEngine.options().latencyReportPeriodMS * 1000, reportLatency, this);
+  }
+  if (fEngine.options().statsPeriodMS > 0)
+  {
+    fStatsTask = fScheduler->scheduleDelayedTask(fEngine.options().statsPeriodMS * 1000, gatherStats, this);
+  }
+  fThread = std::thread([this]() { fScheduler->doEventLoop(&fWatchVariable); });
+}
+
+EventLoopShard::~EventLoopShard()
+{
+  post([this]() {
+    fScheduler->unscheduleDelayedTask(fLatencyReportTask);
+    fScheduler->unscheduleDelayedTask(fStatsTask);
+    fScheduler->unscheduleDelayedTask(fSupervisionTask);
+    // Don't reconnect any more streams (and close those that are waiting to reconnect, or to connect):
+    std::vector<unsigned> waitingStreams;
+    for (std::map<unsigned, SupervisedStream *>::iterator it = fSupervisedStreams.begin(); it != fSupervisedStreams.end(); ++it)
+    {
+      it->second->closing = True;
+      if (it->second->reconnectTask != NULL || it->second->waitingForConnectSlot)
+      {
+        fScheduler->unscheduleDelayedTask(it->second->reconnectTask);
+        waitingStreams.push_back(it->first);
+      }
+    }
+    for (unsigned i = 0; i < waitingStreams.size(); ++i)
+    {
+      streamClosed(waitingStreams[i]);
+    }
+    while (!fClients.empty())
+    {
+      shutdownStream(fClients.begin()->second); // also removes it from "fClients"
+    }
+    fWatchVariable = 1; // so that "doEventLoop()" returns
+  });
+  fThread.join();
+
+  fScheduler->deleteEventTrigger(fCommandTrigger);
+  fEnv->reclaim();
+  delete fScheduler;
+}
+
+void EventLoopShard::post(std::function<void()> const &command)
+{
+  {
+    std::lock_guard<std::mutex> lock(fCommandMutex);
+    fCommands.push_back(command);
+  }
+  fScheduler->triggerEvent(fCommandTrigger, this);
+}
+
+void EventLoopShard::runCommands(void *clientData)
+{
+  ((EventLoopShard *)clientData)->runCommands();
+}
+
+void EventLoopShard::runCommands()
+{
+  std::vector<std::function<void()> > commands;
+  {
+    std::lock_guard<std::mutex> lock(fCommandMutex);
+    commands.swap(fCommands);
+  }
+  for (unsigned i = 0; i < commands.size(); ++i)
+  {
+    commands[i]();
+  }
+}
+
+void EventLoopShard::reportLatency(void *clientData)
+{
+  ((EventLoopShard *)clientData)->reportLatency();
+}
+
+void EventLoopShard::reportLatency()
+{
+  for (std::map<unsigned, RTSPClient *>::iterator it = fClients.begin(); it != fClients.end(); ++it)
+  {
+    StreamClientState &scs = ((ourRTSPClient *)it->second)->scs; // alias
+    if (scs.session == NULL)
+      continue; // the stream hasn't been set up yet
+
+    MediaSubsessionIterator iter(*scs.session);
+    MediaSubsession *subsession;
+    while ((subsession = iter.next()) != NULL)
+    {
+      DummySink *sink = (DummySink *)subsession->sink;
+      if (sink != NULL && sink->decoder() != NULL)
+      {
+        RTSPDecodeEngine::LatencyReport report;
+        sink->decoder()->latency().takeReport(report);
+        if (fEngine.options().onLatencyReport)
+          fEngine.options().onLatencyReport(it->first, report);
+      }
+    }
+  }
+
+  fLatencyReportTask = fScheduler->scheduleDelayedTask(fEngine.options().latencyReportPeriodMS * 1000, reportLatency, this);
+}
+
+void EventLoopShard::gatherStats(void *clientData)
+{
+  ((EventLoopShard *)clientData)->gatherStats();
+}
+
+void EventLoopShard::gatherStats()
+{
+  for (std::map<unsigned, RTSPClient *>::iterator it = fClients.begin(); it != fClients.end(); ++it)
+  {
+    StreamClientState &scs = ((ourRTSPClient *)it->second)->scs; // alias
+    if (scs.session == NULL)
+      continue; // the stream hasn't been set up yet
+
+    RTSPDecodeEngine::StreamStats stats;
+    stats.url = it->second->url();
+    stats.numBytesReceived = stats.numNALUnitsReceived = stats.numTruncatedFrames = 0;
+    stats.numFramesDecoded = stats.numDecodeErrors = stats.numDroppedAccessUnits = 0;
+    stats.receiveBufferSize = 0;
+    stats.numRTPPacketsReceived = stats.numRTPPacketsExpected = 0;
+    stats.numRTPPacketsLost = 0;
+    stats.jitterMS = 0.0;
+    stats.maxInterPacketGapUS = 0;
+    stats.decodeLevel = RTSPDecodeEngine::DECODE_FULL;
+    stats.numAccessUnitsRecorded = stats.numRecordedFiles = stats.numClipsExported = 0;
+    SupervisedStream *stream = ((ourRTSPClient *)it->second)->supervision; // alias
+    stats.numReconnects = stream->numReconnects;
+    stats.timeToPlayMS = stream->timeToPlayMS;
+    stats.timeToFirstFrameMS = -1;
+    int64_t startTimeUS = stream->startTime.tv_sec * (int64_t)1000000 + stream->startTime.tv_usec;
+
+    MediaSubsessionIterator iter(*scs.session);
+    MediaSubsession *subsession;
+    while ((subsession = iter.next()) != NULL)
+    {
+      DummySink *sink = (DummySink *)subsession->sink;
+      if (sink != NULL)
+      {
+        stats.numBytesReceived += sink->numBytesReceived();
+        stats.numNALUnitsReceived += sink->numNALUnitsReceived();
+        stats.numTruncatedFrames += sink->numTruncatedFrames();
+        stats.receiveBufferSize += sink->receiveBufferSize();
+        if (sink->decoder() != NULL)
+        {
+          stats.numFramesDecoded += sink->decoder()->numFramesDecoded();
+          stats.numDecodeErrors += sink->decoder()->numDecodeErrors();
+          stats.numDroppedAccessUnits += sink->decoder()->numDroppedAccessUnits();
+          if (sink->decoder()->decodeLevel() > stats.decodeLevel)
+            stats.decodeLevel = sink->decoder()->decodeLevel();
+          int64_t firstFrameTimeUS = sink->decoder()->firstFrameTime();
+          if (firstFrameTimeUS > 0)
+          {
+            int timeToFirstFrameMS = firstFrameTimeUS > startTimeUS ? (int)((firstFrameTimeUS - startTimeUS) / 1000) : 0;
+            if (stats.timeToFirstFrameMS < 0 || timeToFirstFrameMS < stats.timeToFirstFrameMS)
+              stats.timeToFirstFrameMS = timeToFirstFrameMS;
+          }
+        }
+        if (sink->recorder() != NULL)
+        {
+          stats.numAccessUnitsRecorded += sink->recorder()->numAccessUnitsRecorded();
+          stats.numRecordedFiles += sink->recorder()->numRecordedFiles();
+        }
+        if (sink->preEventBuffer() != NULL)
+          stats.numClipsExported += sink->preEventBuffer()->numClipsExported();
+      }
+
+      RTPSource *rtpSource = subsession->rtpSource();
+      if (rtpSource == NULL)
+        continue;
+      RTPReceptionStatsDB::Iterator statsIter(rtpSource->receptionStatsDB());
+      RTPReceptionStats *receptionStats;
+      while ((receptionStats = statsIter.next(True)) != NULL)
+      {
+        stats.numRTPPacketsReceived += receptionStats->totNumPacketsReceived();
+        stats.numRTPPacketsExpected += receptionStats->totNumPacketsExpected();
+        if (rtpSource->timestampFrequency() > 0)
+        {
+          double jitterMS = 1000.0 * receptionStats->jitter() / rtpSource->timestampFrequency(); // "jitter()" is in RTP timestamp units
+          if (jitterMS > stats.jitterMS)
+            stats.jitterMS = jitterMS;
+        }
+        if (receptionStats->maxInterPacketGapUS() > stats.maxInterPacketGapUS)
+          stats.maxInterPacketGapUS = receptionStats->maxInterPacketGapUS();
+      }
+    }
+    stats.numRTPPacketsLost = (long long)stats.numRTPPacketsExpected - (long long)stats.numRTPPacketsReceived;
+
+    fEngine.updateStreamStats(it->first, stats);
+  }
+
+  fStatsTask = fScheduler->scheduleDelayedTask(fEngine.options().statsPeriodMS * 1000, gatherStats, this);
+}
+
+void EventLoopShard::superviseStreams(void *clientData)
+{
+  ((EventLoopShard *)clientData)->superviseStreams();
+}
+
+void EventLoopShard::superviseStreams()
+{
+  struct timeval timeNow;
+  gettimeofday(&timeNow, NULL);
+  std::vector<RTSPClient *> stalledClients;
+  for (std::map<unsigned, SupervisedStream *>::iterator it = fSupervisedStreams.begin(); it != fSupervisedStreams.end(); ++it)
+  {
+    SupervisedStream *stream = it->second; // alias
+    if (!stream->streamOptions.reconnect)
+      continue;
+    std::map<unsigned, RTSPClient *>::iterator client = fClients.find(it->first);
+    if (client == fClients.end())
+      continue; // the stream is waiting to (re)connect
+
+    // The stream is making progress for as long as its sinks are receiving something:
+    u_int64_t numNALUnits = 0;
+    StreamClientState &scs = ((ourRTSPClient *)client->second)->scs; // alias
+    if (scs.session != NULL)
+    {
+      MediaSubsessionIterator iter(*scs.session);
+      MediaSubsession *subsession;
+      while ((subsession = iter.next()) != NULL)
+      {
+        if (subsession->sink != NULL)
+          numNALUnits += ((DummySink *)subsession->sink)->numNALUnitsReceived();
+      }
+    }
+    if (numNALUnits > stream->lastNumNALUnits)
+    {
+      stream->lastNumNALUnits = numNALUnits;
+      stream->lastProgressTime = timeNow;
+      stream->numFailures = 0;
+      continue;
+    }
+
+    int64_t msSinceProgress = (timeNow.tv_sec - stream->lastProgressTime.tv_sec) * (int64_t)1000 +
+                              (timeNow.tv_usec - stream->lastProgressTime.tv_usec) / 1000;
+    if (stream->streamOptions.stallTimeoutMS > 0 && msSinceProgress >= stream->streamOptions.stallTimeoutMS)
+    {
+      *fEnv << *client->second << "Received nothing for " << (unsigned)msSinceProgress << " ms; reconnecting\n";
+      stalledClients.push_back(client->second);
+    }
+  }
+  // (Shut down the stalled streams - which then reconnect - only now, because that changes "fClients":)
+  for (unsigned i = 0; i < stalledClients.size(); ++i)
+  {
+    shutdownStream(stalledClients[i]);
+  }
+
+  // (Keep supervising for as long as any stream is to be reconnected:)
+  fSupervisionTask = NULL;
+  for (std::map<unsigned, SupervisedStream *>::iterator it = fSupervisedStreams.begin(); it != fSupervisedStreams.end(); ++it)
+  {
+    if (it->second->streamOptions.reconnect)
+    {
+      fSupervisionTask = fScheduler->scheduleDelayedTask(SUPERVISION_PERIOD_MS * 1000, superviseStreams, this);
+      break;
+    }
+  }
+}
+
+void EventLoopShard::openURL(char const *rtspURL, unsigned streamId, RTSPDecodeEngine::FrameCallback const &onFrame,
+                             RTSPDecodeEngine::StreamOptions const &streamOptions)
+{
+  SupervisedStream *stream = new SupervisedStream(*this, rtspURL, streamId, onFrame, streamOptions);
+  fSupervisedStreams[streamId] = stream;
+  if (streamOptions.reconnect && fSupervisionTask == NULL)
+    fSupervisionTask = fScheduler->scheduleDelayedTask(SUPERVISION_PERIOD_MS * 1000, superviseStreams, this);
+
+  // Start with the SDP description that we were given the last time the application ran (if any):
+  if (fEngine.options().sdpCacheDirectory != NULL)
+    stream->sdpDescription = loadCachedSDP(fEngine.options().sdpCacheDirectory, stream->url);
+  requestConnect(stream);
+}
+
+void EventLoopShard::requestConnect(SupervisedStream *stream)
+{
+  gettimeofday(&stream->startTime, NULL);
+  stream->timeToPlayMS = -1;
+  stream->waitingForConnectSlot = !fEngine.acquireConnectSlot(this, stream->streamId);
+  if (!stream->waitingForConnectSlot)
+    connect(stream);
+  // (Otherwise, "connectSlotGranted()" is called - from the event loop - once another stream's connection has finished.)
+}
+
+void EventLoopShard::connectSlotGranted(unsigned streamId)
+{
+  std::map<unsigned, SupervisedStream *>::iterator it = fSupervisedStreams.find(streamId);
+  if (it == fSupervisedStreams.end() || !it->second->waitingForConnectSlot)
+  {
+    // The stream has since been closed, so pass the slot on:
+    fEngine.releaseConnectSlot();
+    return;
+  }
+  it->second->waitingForConnectSlot = False;
+  connect(it->second);
+}
+
+void EventLoopShard::connectFinished(RTSPClient *rtspClient)
+{
+  ourRTSPClient *client = (ourRTSPClient *)rtspClient;
+  if (client->holdsConnectSlot)
+  {
+    client->holdsConnectSlot = False;
+    fEngine.releaseConnectSlot();
+  }
+}
+
+void EventLoopShard::connect(SupervisedStream *stream)
+{
+  UsageEnvironment &env = *fEnv; // alias
+
+  // Begin by creating a "RTSPClient" object.  Note that there is a separate "RTSPClient" object for each stream that we wish
+  // to receive (even if more than stream uses the same "rtsp://" URL).
+  RTSPClient *rtspClient = ourRTSPClient::createNew(env, stream->url.c_str(), *this, stream->streamId, stream->onFrame,
+                                                    fEngine.options().verbosityLevel, fEngine.options().applicationName);
+  if (rtspClient == NULL)
+  {
+    env << "Failed to create a RTSP client for URL \"" << stream->url.c_str() << "\": " << env.getResultMsg() << "\n";
+    fEngine.releaseConnectSlot();
+    streamClosed(stream->streamId); // (which reconnects later, if the stream is to be reconnected)
+    return;
+  }
+
+  ((ourRTSPClient *)rtspClient)->streamOptions = stream->streamOptions;
+  ((ourRTSPClient *)rtspClient)->supervision = stream;
+  ((ourRTSPClient *)rtspClient)->holdsConnectSlot = True;
+  fClients[stream->streamId] = rtspClient;
+
+  stream->played = False;
+  stream->lastNumNALUnits = 0;
+  gettimeofday(&stream->lastProgressTime, NULL); // (so that a connection that hangs before "PLAY" also stalls)
+  stream->usedCachedSDP = !stream->sdpDescription.empty();
+  if (stream->usedCachedSDP)
+  {
+    // Skip the "DESCRIBE" (a round trip), and set up the session that we were given last time:
+    env << *rtspClient << "Reusing the SDP description from a previous connection\n";
+    continueAfterDESCRIBE(rtspClient, 0, strDup(stream->sdpDescription.c_str()));
+    return;
+  }
+
+  // Next, send a RTSP "DESCRIBE" command, to get a SDP description for the stream.
+  // Note that this command - like all RTSP commands - is sent asynchronously; we do not block, waiting for a response.
+  // Instead, the following function call returns immediately, and we handle the RTSP response later, from within the event loop:
+  rtspClient->sendDescribeCommand(continueAfterDESCRIBE);
+}
+
+void EventLoopShard::scheduleReconnect(SupervisedStream *stream)
+{
+  // Back off exponentially while the attempts keep failing, with 'jitter', so that many streams that were dropped together
+  // (e.g., by a network outage) don't all reconnect together:
+  unsigned exponent = stream->numFailures < 16 ? stream->numFailures : 16;
+  u_int64_t delayMS = (u_int64_t)fEngine.options().reconnectMinDelayMS << exponent;
+  if (delayMS > fEngine.options().reconnectMaxDelayMS)
+    delayMS = fEngine.options().reconnectMaxDelayMS;
+  delayMS = delayMS / 2 + fRandom() % (delayMS / 2 + 1);
+  ++stream->numFailures;
+
+  *fEnv << "[URL:\"" << stream->url.c_str() << "\"]: Reconnecting in " << (unsigned)delayMS << " ms\n";
+  stream->reconnectTask = fScheduler->scheduleDelayedTask(delayMS * 1000, reconnect, stream);
+}
+
+void EventLoopShard::reconnect(void *clientData)
+{
+  SupervisedStream *stream = (SupervisedStream *)clientData;
+  stream->shard.reconnect(stream);
+}
+
+void EventLoopShard::reconnect(SupervisedStream *stream)
+{
+  stream->reconnectTask = NULL;
+  if (!stream->usedCachedSDP || stream->played)
+    ++stream->numReconnects; // (not counting a retry with a "DESCRIBE"; see "streamClosed()")
+  requestConnect(stream);
+}
+
+void EventLoopShard::closeStream(unsigned streamId)
+{
+  std::map<unsigned, SupervisedStream *>::iterator supervision = fSupervisedStreams.find(streamId);
+  if (supervision != fSupervisedStreams.end())
+  {
+    supervision->second->closing = True;
+    if (supervision->second->reconnectTask != NULL || supervision->second->waitingForConnectSlot)
+    {
+      // The stream is between connections, so there's nothing to shut down:
+      fScheduler->unscheduleDelayedTask(supervision->second->reconnectTask);
+      streamClosed(streamId);
+      return;
+    }
+  }
+
+  std::map<unsigned, RTSPClient *>::iterator it = fClients.find(streamId);
+  if (it != fClients.end())
+  {
+    shutdownStream(it->second);
+  }
+}
+
+void EventLoopShard::exportClip(unsigned streamId, std::string const &fileName, unsigned postEventSeconds,
+                                RTSPDecodeEngine::RecordFormat format)
+{
+  std::map<unsigned, RTSPClient *>::iterator it = fClients.find(streamId);
+  if (it == fClients.end())
+    return; // the stream has just closed
+  StreamClientState &scs = ((ourRTSPClient *)it->second)->scs; // alias
+  if (scs.session != NULL)
+  {
+    // Export the first video subsession that has a pre-event buffer (there's usually just one):
+    MediaSubsessionIterator iter(*scs.session);
+    MediaSubsession *subsession;
+    while ((subsession = iter.next()) != NULL)
+    {
+      DummySink *sink = (DummySink *)subsession->sink;
+      if (sink == NULL || sink->preEventBuffer() == NULL)
+        continue;
+      if (sink->preEventBuffer()->startClip(*recordingWriter(), fileName, format, postEventSeconds))
+        *fEnv << *it->second << "Exporting a clip (of " << (unsigned)(sink->preEventBuffer()->windowUS() / 1000) << " ms, plus the next "
+              << postEventSeconds << " seconds) to \"" << fileName.c_str() << "\"\n";
+      else
+        *fEnv << *it->second << "Not exporting a clip to \"" << fileName.c_str() << "\", because the previous clip hasn't ended yet\n";
+      return;
+    }
+  }
+  *fEnv << *it->second << "Can't export a clip: the stream has no pre-event buffer (yet)\n";
+}
+
+void EventLoopShard::streamClosed(unsigned streamId)
+{
+  fClients.erase(streamId);
+  std::map<unsigned, SupervisedStream *>::iterator supervision = fSupervisedStreams.find(streamId);
+  if (supervision != fSupervisedStreams.end())
+  {
+    SupervisedStream *stream = supervision->second; // alias
+    if (!stream->closing && stream->usedCachedSDP && !stream->played)
+    {
+      // The connection skipped the "DESCRIBE", but failed to set up the session, so perhaps the session has changed (e.g., after
+      // the camera was reconfigured).  Forget the SDP description, and try again - straight away - with a "DESCRIBE":
+      stream->sdpDescription.clear();
+      if (fEngine.options().sdpCacheDirectory != NULL)
+        removeCachedSDP(fEngine.options().sdpCacheDirectory, stream->url);
+      stream->reconnectTask = fScheduler->scheduleDelayedTask(0, reconnect, stream);
+      return;
+    }
+    if (!stream->closing && stream->streamOptions.reconnect)
+    {
+      // Rather than closing the stream, connect to it again:
+      scheduleReconnect(stream);
+      return;
+    }
+    delete supervision->second; // (also deleting any decoder that it had cached)
+    fSupervisedStreams.erase(supervision);
+  }
+  fEngine.streamClosed(streamId);
+}
+
+// Implementation of the RTSP 'response handlers':
+
+void continueAfterDESCRIBE(RTSPClient *rtspClient, int resultCode, char *resultString)
+{
+  do
+  {
+    UsageEnvironment &env = rtspClient->envir();                 // alias
+    StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
+
+    if (resultCode != 0)
+    {
+      env << *rtspClient << "Failed to get a SDP description: " << resultString << "\n";
+      delete[] resultString;
+      break;
+    }
+
+    char *const sdpDescription = resultString;
+    env << *rtspClient << "Got a SDP description:\n"
+        << sdpDescription << "\n";
+    ourRTSPClient *client = (ourRTSPClient *)rtspClient; // alias
+    if (!client->supervision->usedCachedSDP)
+    {
+      client->supervision->sdpDescription = sdpDescription; // for reconnecting
+      char const *sdpCacheDirectory = client->shard.engine().options().sdpCacheDirectory;
+      if (sdpCacheDirectory != NULL)
+        saveCachedSDP(sdpCacheDirectory, client->supervision->url, client->supervision->sdpDescription);
+    }
+
+    // Create a media session object from this SDP description:
+    scs.session = MediaSession::createNew(env, sdpDescription);
+    delete[] sdpDescription; // because we don't need it anymore
+    if (scs.session == NULL)
+    {
+      env << *rtspClient << "Failed to create a MediaSession object from the SDP description: " << env.getResultMsg() << "\n";
+      break;
+    }
+    else if (!scs.session->hasSubsessions())
+    {
+      env << *rtspClient << "This session has no media subsessions (i.e., no \"m=\" lines)\n";
+      break;
+    }
+
+    // Then, create and set up our data source objects for the session.  We do this by iterating over the session's 'subsessions',
+    // calling "MediaSubsession::initiate()", and then sending a RTSP "SETUP" command, on each one.
+    // (Each 'subsession' will have its own data source.)
+    scs.iter = new MediaSubsessionIterator(*scs.session);
+    setupNextSubsession(rtspClient);
+    return;
+  } while (0);
+
+  // An unrecoverable error occurred with this stream.
+  shutdownStream(rtspClient);
+}
+
+void setupNextSubsession(RTSPClient *rtspClient)
+{
+  UsageEnvironment &env = rtspClient->envir();                 // alias
+  StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
+
+  scs.subsession = scs.iter->next();
+  if (scs.subsession != NULL)
+  {
+    if (((ourRTSPClient *)rtspClient)->streamOptions.videoOnly && strcmp(scs.subsession->mediumName(), "video") != 0)
+    {
+      env << *rtspClient << "Skipping the \"" << *scs.subsession << "\" subsession (only video is wanted)\n";
+      setupNextSubsession(rtspClient);
+    }
+    else if (!scs.subsession->initiate())
+    {
+      env << *rtspClient << "Failed to initiate the \"" << *scs.subsession << "\" subsession: " << env.getResultMsg() << "\n";
+      setupNextSubsession(rtspClient); // give up on this subsession; go to the next one
+    }
+    else
+    {
+      env << *rtspClient << "Initiated the \"" << *scs.subsession << "\" subsession (";
+      if (scs.subsession->rtcpIsMuxed())
+      {
+        env << "client port " << scs.subsession->clientPortNum();
+      }
+      else
+      {
+        env << "client ports " << scs.subsession->clientPortNum() << "-" << scs.subsession->clientPortNum() + 1;
+      }
+      env << ")\n";
+
+      // Continue setting up this subsession, by sending a RTSP "SETUP" command:
+      // (By default, we request that the server stream its data using RTP/UDP; "Options::streamUsingTCP" requests RTP-over-TCP.)
+      Boolean streamUsingTCP = ((ourRTSPClient *)rtspClient)->shard.engine().options().streamUsingTCP;
+      rtspClient->sendSetupCommand(*scs.subsession, continueAfterSETUP, False, streamUsingTCP);
+    }
+    return;
+  }
+
+  // We've finished setting up all of the subsessions.  Now, send a RTSP "PLAY" command to start the streaming:
+  if (scs.session->absStartTime() != NULL)
+  {
+    // Special case: The stream is indexed by 'absolute' time, so send an appropriate "PLAY" command:
+    rtspClient->sendPlayCommand(*scs.session, continueAfterPLAY, scs.session->absStartTime(), scs.session->absEndTime());
+  }
+  else
+  {
+    scs.duration = scs.session->playEndTime() - scs.session->playStartTime();
+    rtspClient->sendPlayCommand(*scs.session, continueAfterPLAY);
+  }
+}
+
+void continueAfterSETUP(RTSPClient *rtspClient, int resultCode, char *resultString)
+{
+  do
+  {
+    UsageEnvironment &env = rtspClient->envir();                 // alias
+    StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
+
+    if (resultCode != 0)
+    {
+      env << *rtspClient << "Failed to set up the \"" << *scs.subsession << "\" subsession: " << resultString << "\n";
+      break;
+    }
+
+    env << *rtspClient << "Set up the \"" << *scs.subsession << "\" subsession (";
+    if (scs.subsession->rtcpIsMuxed())
+    {
+      env << "client port " << scs.subsession->clientPortNum();
+    }
+    else
+    {
+      env << "client ports " << scs.subsession->clientPortNum() << "-" << scs.subsession->clientPortNum() + 1;
+    }
+    env << ")\n";
+
+    // Having successfully setup the subsession, create a data sink for it, and call "startPlaying()" on it.
+    // (This will prepare the data sink to receive data; the actual flow of data from the client won't start happening until later,
+    // after we've sent a RTSP "PLAY" command.)
+
+    ourRTSPClient *client = (ourRTSPClient *)rtspClient; // alias
+    RTSPDecodeEngine::StreamOptions streamOptions = client->streamOptions;
+    streamOptions.decodeThreads = client->shard.decodeThreadsFor(client->streamId, streamOptions);
+    scs.subsession->sink = DummySink::createNew(env, *scs.subsession, rtspClient->url(),
+                                                client->streamId, client->onFrame, client->shard.decodeWorkerPool(),
+                                                client->shard.loadShedder(), client->shard.recordingWriter(),
+                                                streamOptions.reconnect ? &client->supervision->cachedDecoder : NULL,
+                                                client->shard.counters(), streamOptions);
+    // perhaps use your own custom "MediaSink" subclass instead
+    if (scs.subsession->sink == NULL)
+    {
+      env << *rtspClient << "Failed to create a data sink for the \"" << *scs.subsession
+          << "\" subsession: " << env.getResultMsg() << "\n";
+      break;
+    }
+
+    env << *rtspClient << "Created a data sink for the \"" << *scs.subsession << "\" subsession\n";
+    scs.subsession->miscPtr = rtspClient; // a hack to let subsession handler functions get the "RTSPClient" from the subsession
+    scs.subsession->sink->startPlaying(*(scs.subsession->readSource()),
+                                       subsessionAfterPlaying, scs.subsession);
+    // Also set a handler to be called if a RTCP "BYE" arrives for this subsession:
+    if (scs.subsession->rtcpInstance() != NULL)
+    {
+      scs.subsession->rtcpInstance()->setByeWithReasonHandler(subsessionByeHandler, scs.subsession);
+    }
+  } while (0);
+  delete[] resultString;
+
+  // Set up the next subsession, if any:
+  setupNextSubsession(rtspClient);
+}
+
+void continueAfterPLAY(RTSPClient *rtspClient, int resultCode, char *resultString)
+{
+  Boolean success = False;
+
+  do
+  {
+    UsageEnvironment &env = rtspClient->envir();                 // alias
+    StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
+
+    if (resultCode != 0)
+    {
+      env << *rtspClient << "Failed to start playing session: " << resultString << "\n";
+      break;
+    }
+
+    // Set a timer to be handled at the end of the stream's expected duration (if the stream does not already signal its end
+    // using a RTCP "BYE").  This is optional.  If, instead, you want to keep the stream active - e.g., so you can later
+    // 'seek' back within it and do another RTSP "PLAY" - then you can omit this code.
+    // (Alternatively, if you don't want to receive the entire stream, you could set this timer for some shorter value.)
+    if (scs.duration > 0)
+    {
+      unsigned const delaySlop = 2; // number of seconds extra to delay, after the stream's expected duration.  (This is optional.)
+      scs.duration += delaySlop;
+      unsigned uSecsToDelay = (unsigned)(scs.duration * 1000000);
+      scs.streamTimerTask = env.taskScheduler().scheduleDelayedTask(uSecsToDelay, (TaskFunc *)streamTimerHandler, rtspClient);
+    }
+
+    env << *rtspClient << "Started playing session";
+    if (scs.duration > 0)
+    {
+      env << " (for up to " << scs.duration << " seconds)";
+    }
+    env << "...\n";
+
+    ourRTSPClient *client = (ourRTSPClient *)rtspClient; // alias
+    SupervisedStream *stream = client->supervision;      // alias
+    stream->played = True;
+    struct timeval timeNow;
+    gettimeofday(&timeNow, NULL);
+    stream->timeToPlayMS = (int)((timeNow.tv_sec - stream->startTime.tv_sec) * 1000 + (timeNow.tv_usec - stream->startTime.tv_usec) / 1000);
+    success = True;
+  } while (0);
+  delete[] resultString;
+
+  // The stream has finished connecting, so let another stream connect:
+  ((ourRTSPClient *)rtspClient)->shard.connectFinished(rtspClient);
+
+  if (!success)
+  {
+    // An unrecoverable error occurred with this stream.
+    shutdownStream(rtspClient);
+  }
+}
+
+// Implementation of the other event handlers:
+
+void subsessionAfterPlaying(void *clientData)
+{
+  MediaSubsession *subsession = (MediaSubsession *)clientData;
+  RTSPClient *rtspClient = (RTSPClient *)(subsession->miscPtr);
+
+  // Begin by closing this subsession's stream:
+  Medium::close(subsession->sink);
+  subsession->sink = NULL;
+
+  // Next, check whether *all* subsessions' streams have now been closed:
+  MediaSession &session = subsession->parentSession();
+  MediaSubsessionIterator iter(session);
+  while ((subsession = iter.next()) != NULL)
+  {
+    if (subsession->sink != NULL)
+      return; // this subsession is still active
+  }
+
+  // All subsessions' streams have now been closed, so shutdown the client:
+  shutdownStream(rtspClient);
+}
+
+void subsessionByeHandler(void *clientData, char const *reason)
+{
+  MediaSubsession *subsession = (MediaSubsession *)clientData;
+  RTSPClient *rtspClient = (RTSPClient *)subsession->miscPtr;
+  UsageEnvironment &env = rtspClient->envir(); // alias
+
+  env << *rtspClient << "Received RTCP \"BYE\"";
+  if (reason != NULL)
+  {
+    env << " (reason:\"" << reason << "\")";
+    delete[](char *) reason;
+  }
+  env << " on \"" << *subsession << "\" subsession\n";
+
+  // Now act as if the subsession had closed:
+  subsessionAfterPlaying(subsession);
+}
+
+void streamTimerHandler(void *clientData)
+{
+  ourRTSPClient *rtspClient = (ourRTSPClient *)clientData;
+  StreamClientState &scs = rtspClient->scs; // alias
+
+  scs.streamTimerTask = NULL;
+
+  // Shut down the stream:
+  shutdownStream(rtspClient);
+}
+
+void shutdownStream(RTSPClient *rtspClient)
+{
+  UsageEnvironment &env = rtspClient->envir();                 // alias
+  StreamClientState &scs = ((ourRTSPClient *)rtspClient)->scs; // alias
+
+  // First, check whether any subsessions have still to be closed:
+  if (scs.session != NULL)
+  {
+    Boolean someSubsessionsWereActive = False;
+    MediaSubsessionIterator iter(*scs.session);
+    MediaSubsession *subsession;
+
+    while ((subsession = iter.next()) != NULL)
+    {
+      if (subsession->sink != NULL)
+      {
+        Medium::close(subsession->sink);
+        subsession->sink = NULL;
+
+        if (subsession->rtcpInstance() != NULL)
+        {
+          subsession->rtcpInstance()->setByeHandler(NULL, NULL); // in case the server sends a RTCP "BYE" while handling "TEARDOWN"
+        }
+
+        someSubsessionsWereActive = True;
+      }
+    }
+
+    if (someSubsessionsWereActive)
+    {
+      // Send a RTSP "TEARDOWN" command, to tell the server to shutdown the stream.
+      // Don't bother handling the response to the "TEARDOWN".
+      rtspClient->sendTeardownCommand(*scs.session, NULL);
+    }
+  }
+
+  ourRTSPClient *client = (ourRTSPClient *)rtspClient; // alias
+  EventLoopShard &shard = client->shard;
+  unsigned streamId = client->streamId;
+  shard.connectFinished(rtspClient); // (if it hadn't yet)
+
+  env << *rtspClient << "Closing the stream.\n";
+  Medium::close(rtspClient);
+  // Note that this will also cause this stream's "StreamClientState" structure to get reclaimed.
+
+  // Rather than exiting (as the demo application did) when the final stream has ended, tell the shard - which reconnects
+  // the stream, if it's supervised, and otherwise tells the engine - and let the application decide what to do:
+  shard.streamClosed(streamId);
+}
+
+// Implementation of "ourRTSPClient":
+
+ourRTSPClient *ourRTSPClient::createNew(UsageEnvironment &env, char const *rtspURL,
+                                        EventLoopShard &shard, unsigned streamId, RTSPDecodeEngine::FrameCallback const &onFrame,
+                                        int verbosityLevel, char const *applicationName, portNumBits tunnelOverHTTPPortNum)
+{
+  return new ourRTSPClient(env, rtspURL, shard, streamId, onFrame, verbosityLevel, applicationName, tunnelOverHTTPPortNum);
+}
+
+ourRTSPClient::ourRTSPClient(UsageEnvironment &env, char const *rtspURL,
+                             EventLoopShard &shard, unsigned streamId, RTSPDecodeEngine::FrameCallback const &onFrame,
+                             int verbosityLevel, char const *applicationName, portNumBits tunnelOverHTTPPortNum)
+    : RTSPClient(env, rtspURL, verbosityLevel, applicationName, tunnelOverHTTPPortNum, -1),
+      shard(shard), streamId(streamId), onFrame(onFrame), supervision(NULL), holdsConnectSlot(False)
+{
+}
+
+ourRTSPClient::~ourRTSPClient()
+{
+}
+
+// Implementation of "StreamClientState":
+
+StreamClientState::StreamClientState()
+    : iter(NULL), session(NULL), subsession(NULL), streamTimerTask(NULL), duration(0.0)
+{
+}
+
+StreamClientState::~StreamClientState()
+{
+  delete iter;
+  if (session != NULL)
+  {
+    // We also need to delete "session", and unschedule "streamTimerTask" (if set)
+    UsageEnvironment &env = session->envir(); // alias
+
+    env.taskScheduler().unscheduleDelayedTask(streamTimerTask);
+    Medium::close(session);
+  }
+}
+
+// Implementation of "DummySink":
+
+// Returns what a subsession's decoder is set up from, so that it can be reused (by a reconnected stream) only if this is unchanged:
+static std::string sessionParametersOf(MediaSubsession &subsession)
+{
+  char const *sPropStrs[4] = {subsession.fmtp_spropparametersets(), subsession.fmtp_spropvps(), subsession.fmtp_spropsps(),
+                              subsession.fmtp_sproppps()};
+  std::string sessionParameters = subsession.codecName();
+  for (unsigned i = 0; i < 4; ++i)
+  {
+    sessionParameters += ';';
+    if (sPropStrs[i] != NULL)
+      sessionParameters += sPropStrs[i];
+  }
+  return sessionParameters;
+}
+
+DummySink *DummySink::createNew(UsageEnvironment &env, MediaSubsession &subsession, char const *streamId,
+                                unsigned streamNum, RTSPDecodeEngine::FrameCallback const &onFrame,
+                                DecodeWorkerPool *decodeWorkerPool, LoadShedder *loadShedder, RecordingWriter *recordingWriter,
+                                CachedDecoder *cachedDecoder, DecodeCounters &counters,
+                                RTSPDecodeEngine::StreamOptions const &streamOptions)
+{
+  DummySink *sink = new DummySink(env, subsession, streamId, decodeWorkerPool, loadShedder, counters);
+  // Choose the decoder from the SDP, so that H.264 and H.265 streams can be mixed freely:
+  if (H264or5ParameterSets::hNumberFor(subsession) != 0)
+  {
+    std::string sessionParameters = sessionParametersOf(subsession);
+    if (cachedDecoder != NULL && cachedDecoder->decoder != NULL && cachedDecoder->sessionParameters == sessionParameters)
+    {
+      // The stream has reconnected, with the same session parameters, so carry on with its previous decoder (which was reset,
+      // to wait for a keyframe, when the previous connection closed):
+      sink->fParameterSets = cachedDecoder->parameterSets;
+      sink->fDecoder = cachedDecoder->decoder;
+      cachedDecoder->parameterSets = NULL;
+      cachedDecoder->decoder = NULL;
+      sink->fDecoder->resetFirstFrameTime(); // (so that "timeToFirstFrameMS" is measured from this connection)
+      env << "Stream \"" << streamId << "\"; reusing the decoder from the previous connection\n";
+    }
+    else
+    {
+      if (cachedDecoder != NULL)
+        cachedDecoder->clear(); // (the session has changed)
+      sink->fParameterSets = new H264or5ParameterSets(subsession);
+      if (streamOptions.decode)
+      {
+        sink->fDecoder = StreamDecoder::createNew(env, streamId, *sink->fParameterSets, streamNum, onFrame, counters, streamOptions);
+        if (sink->fDecoder == NULL)
+        {
+          Medium::close(sink);
+          return NULL;
+        }
+      }
+    }
+    if (sink->fDecoder != NULL && loadShedder != NULL)
+      loadShedder->addDecoder(sink->fDecoder, streamOptions);
+    sink->fCachedDecoder = cachedDecoder;
+    sink->fSessionParameters = sessionParameters;
+    if (recordingWriter != NULL && streamOptions.recordFormat != RTSPDecodeEngine::RECORD_NONE)
+    {
+      sink->fRecorder = new StreamRecorder(*recordingWriter, *sink->fParameterSets, streamNum, streamOptions);
+    }
+    if (recordingWriter != NULL && streamOptions.preEventSeconds > 0)
+    {
+      sink->fPreEventBuffer = new PreEventBuffer(*sink->fParameterSets, streamOptions.preEventSeconds, streamOptions.preEventBufferSize);
+    }
+  }
+  return sink;
+}
+
+DummySink::DummySink(UsageEnvironment &env, MediaSubsession &subsession, char const *streamId,
+                     DecodeWorkerPool *decodeWorkerPool, LoadShedder *loadShedder, DecodeCounters &counters)
+    : MediaSink(env),
+      fReceiveBufferSizeClass(0), fLargestFrameSinceResize(0),
+      fNumBytesReceived(0), fNumNALUnitsReceived(0), fNumTruncatedFrames(0), fNumTruncatedBytes(0),
+      fSubsession(subsession), fParameterSets(NULL), fDecoder(NULL), fRecorder(NULL), fPreEventBuffer(NULL), fCachedDecoder(NULL),
+      fDecodeWorkerPool(decodeWorkerPool), fLoadShedder(loadShedder),
+      fCounters(counters)
+{
+  fStreamId = strDup(streamId);
+  fReceiveBuffer = receiveBufferPool.acquire(fReceiveBufferSizeClass);
+  gettimeofday(&fLastResizeTime, NULL);
+}
+
+DummySink::~DummySink()
+{
+  if (fDecoder != NULL && fLoadShedder != NULL)
+  {
+    fLoadShedder->removeDecoder(fDecoder);
+  }
+  if (fDecoder != NULL && fDecodeWorkerPool != NULL)
+  {
+    fDecodeWorkerPool->cancel(fDecoder);
+  }
+  if (fDecoder != NULL)
+  {
+    fDecoder->flush();
+  }
+  delete fRecorder;
+  delete fPreEventBuffer;
+  if (fDecoder != NULL && fCachedDecoder != NULL)
+  {
+    // Keep the decoder (and the parameter sets that it uses), in case the stream reconnects:
+    fCachedDecoder->clear();
+    fCachedDecoder->sessionParameters = fSessionParameters;
+    fCachedDecoder->decoder = fDecoder;
+    fCachedDecoder->parameterSets = fParameterSets;
+  }
+  else
+  {
+    delete fDecoder;
+    delete fParameterSets;
+  }
+  receiveBufferPool.release(fReceiveBuffer, fReceiveBufferSizeClass);
+  delete[] fStreamId;
+}
+
+void DummySink::afterGettingFrame(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                  struct timeval presentationTime, unsigned durationInMicroseconds)
+{
+  DummySink *sink = (DummySink *)clientData;
+  sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+}
+
+// If you don't want to see debugging output for each received frame, then comment out the following line:
+// #define DEBUG_PRINT_EACH_RECEIVED_FRAME 1
+
+void DummySink::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+                                  struct timeval presentationTime, unsigned /*durationInMicroseconds*/)
+{
+  // We've just received a frame of data.  (Optionally) print out information about it:
+#ifdef DEBUG_PRINT_EACH_RECEIVED_FRAME
+  if (fStreamId != NULL)
+    envir() << "Stream \"" << fStreamId << "\"; ";
+  envir() << fSubsession.mediumName() << "/" << fSubsession.codecName() << ":\tReceived " << frameSize << " bytes";
+  if (numTruncatedBytes > 0)
+    envir() << " (with " << numTruncatedBytes << " bytes truncated)";
+  char uSecsStr[6 + 1]; // used to output the 'microseconds' part of the presentation time
+  sprintf(uSecsStr, "%06u", (unsigned)presentationTime.tv_usec);
+  envir() << ".\tPresentation time: " << (int)presentationTime.tv_sec << "." << uSecsStr;
+  if (fSubsession.rtpSource() != NULL && !fSubsession.rtpSource()->hasBeenSynchronizedUsingRTCP())
+  {
+    envir() << "!"; // mark the debugging output to indicate that this presentation time is not RTCP-synchronized
+  }
+#ifdef DEBUG_PRINT_NPT
+  envir() << "\tNPT: " << fSubsession.getNormalPlayTime(presentationTime);
+#endif
+  envir() << "\n";
+#endif
+  fNumBytesReceived += frameSize + numTruncatedBytes;
+  ++fNumNALUnitsReceived;
+  if (numTruncatedBytes > 0)
+  {
+    // The frame didn't fit.  Don't decode what's left of it; instead, skip to the next keyframe (as later frames may refer
+    // to this one), and make sure that the next such frame will fit:
+    ++fNumTruncatedFrames;
+    fNumTruncatedBytes += numTruncatedBytes;
+    ++fCounters.numTruncatedFrames;
+    if (fDecoder != NULL)
+      fDecoder->skipToNextKeyframe();
+    if (fRecorder != NULL)
+      fRecorder->skipToNextKeyframe();
+    if (fPreEventBuffer != NULL)
+      fPreEventBuffer->skipToNextKeyframe();
+    resizeReceiveBuffer(frameSize, numTruncatedBytes);
+    continuePlaying();
+    return;
+  }
+  if (frameSize > fLargestFrameSinceResize)
+    fLargestFrameSinceResize = frameSize;
+
+  if (fParameterSets != NULL && fParameterSets->update(fReceiveBuffer + 4, frameSize))
+  {
+    if (fStreamId != NULL)
+      envir() << "Stream \"" << fStreamId << "\"; ";
+    envir() << "received a new in-band parameter set (now have " << fParameterSets->numParameterSets() << ")\n";
+    if (fRecorder != NULL)
+      fRecorder->parameterSetsChanged();
+  }
+  if (fRecorder != NULL)
+  {
+    // Record the NAL unit as received (the receive buffer already has a start code before it):
+    fRecorder->addNALUnit(fReceiveBuffer, 4 + frameSize, presentationTime);
+  }
+  if (fPreEventBuffer != NULL)
+  {
+    fPreEventBuffer->addNALUnit(fReceiveBuffer, 4 + frameSize, presentationTime);
+  }
+  if (fDecoder != NULL)
+  {
+    // Measure how long the frame took to reach us - if its presentation time is the sender's wall-clock capture time:
+    struct timeval receiveTime;
+    gettimeofday(&receiveTime, NULL);
+    int64_t receiveTimeUS = receiveTime.tv_sec * (int64_t)1000000 + receiveTime.tv_usec;
+    if (fSubsession.rtpSource() != NULL && fSubsession.rtpSource()->hasBeenSynchronizedUsingRTCP())
+    {
+      fDecoder->latency().captureToReceive.record(receiveTimeUS - (presentationTime.tv_sec * (int64_t)1000000 + presentationTime.tv_usec));
+    }
+
+    // The decoder gathers the NAL units into access units - each of which ends at the RTP marker bit - and decodes those:
+    Boolean endsAccessUnit = fSubsession.rtpSource() != NULL && fSubsession.rtpSource()->curPacketMarkerBit();
+    fDecoder->addNALUnit(fReceiveBuffer, 4 + frameSize, presentationTime, receiveTimeUS, endsAccessUnit, fDecodeWorkerPool);
+  }
+
+  // Move down a size class if our frames have been much smaller than the buffer for a while:
+  if (fReceiveBufferSizeClass > 0)
+  {
+    resizeReceiveBuffer(frameSize, 0);
+  }
+
+  // Then continue, to request the next frame of data:
+  continuePlaying();
+}
+
+void DummySink::resizeReceiveBuffer(unsigned frameSize, unsigned numTruncatedBytes)
+{
+  unsigned newSizeClass;
+  if (numTruncatedBytes > 0)
+  {
+    newSizeClass = ReceiveBufferPool::sizeClassFor(frameSize + numTruncatedBytes);
+    if (newSizeClass <= fReceiveBufferSizeClass)
+      return; // we're already as big as we can get
+  }
+  else
+  {
+    struct timeval timeNow;
+    gettimeofday(&timeNow, NULL);
+    int64_t uSecsSinceResize = (timeNow.tv_sec - fLastResizeTime.tv_sec) * (int64_t)1000000 + (timeNow.tv_usec - fLastResizeTime.tv_usec);
+    if (uSecsSinceResize < RECEIVE_BUFFER_SHRINK_PERIOD_US)
+      return;
+
+    // Keep room for twice the largest frame seen lately:
+    newSizeClass = ReceiveBufferPool::sizeClassFor(2 * fLargestFrameSinceResize);
+    fLargestFrameSinceResize = frameSize;
+    fLastResizeTime = timeNow;
+    if (newSizeClass >= fReceiveBufferSizeClass)
+      return;
+  }
+
+  envir() << "Stream \"" << (fStreamId != NULL ? fStreamId : "") << "\"; " << (numTruncatedBytes > 0 ? "growing" : "shrinking")
+          << " the receive buffer to " << ReceiveBufferPool::capacityOf(newSizeClass) << " bytes\n";
+  receiveBufferPool.release(fReceiveBuffer, fReceiveBufferSizeClass);
+  fReceiveBuffer = receiveBufferPool.acquire(newSizeClass);
+  fReceiveBufferSizeClass = newSizeClass;
+  gettimeofday(&fLastResizeTime, NULL);
+}
+
+Boolean DummySink::continuePlaying()
+{
+  if (fSource == NULL)
+    return False; // sanity check (should not happen)
+
+  // Request the next frame of data from our input source.  "afterGettingFrame()" will get called later, when it arrives:
+  fSource->getNextFrame(fReceiveBuffer + 4, receiveBufferSize(),
+                        afterGettingFrame, this,
+                        onSourceClosure, this);
+  return True;
+}
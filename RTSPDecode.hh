@@ -0,0 +1,230 @@
+// "librtspdecode": receives, and decodes, any number of RTSP H.264 or H.265 streams concurrently, handing each decoded frame to the
+// application through a callback.  It does no display of its own, so it can be used 'headless' (e.g., for analytics).
+// C++ header
+
+#ifndef _RTSP_DECODE_HH
+#define _RTSP_DECODE_HH
+
+#include <functional>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+
+struct AVFrame;
+struct DecodeCounters;
+class EventLoopShard;
+class DecodeWorkerPool;
+class LoadShedder;
+class RecordingWriter;
+
+// Define a class that owns the LIVE555 event loop(s) - each in its own thread - and the (optional) decode worker threads, for
+// all of the application's streams.  Its public member functions may be called from any thread, including from callbacks.
+
+class RTSPDecodeEngine
+{
+public:
+  typedef std::function<void(unsigned streamId, AVFrame *frame)> FrameCallback;
+  // Called (from an event loop or decode worker thread) for each decoded frame.  "frame->pts" is the frame's presentation time,
+  // in microseconds.  The frame is valid only until the callback returns, unless the callback takes its own reference to it
+  // (using "av_frame_ref()").  The callback must not block for long, because other streams may be waiting on the same thread.
+  // When a stream closes, the frames that its decoder was still holding are delivered (from its event loop thread) first.
+  typedef std::function<void(unsigned streamId)> StreamClosedCallback;
+  // Called (from the stream's event loop thread) when a stream ends, fails, or is closed with "closeStream()".  (A stream with
+  // "StreamOptions::reconnect" set is reconnected instead, so it closes only when "closeStream()" is called.)
+
+  struct LatencySummary
+  {
+    unsigned long count; // the number of frames measured
+    long long p50US, p99US, maxUS;
+  };
+  struct LatencyReport
+  {
+    LatencySummary captureToReceive;   // measured only once the stream's presentation times are synchronized using RTCP
+    LatencySummary receiveToDecoded;   // (including any time spent waiting for a decode worker)
+    LatencySummary decodedToDelivered; // i.e., until the frame callback returns
+  };
+  typedef std::function<void(unsigned streamId, LatencyReport const &report)> LatencyReportCallback;
+  // Called (from the stream's event loop thread) periodically, with the latencies of the frames since the previous report.
+  // ("captureToReceive" compares the sender's clock with ours, so it's meaningful only if both are synchronized, e.g. by NTP.)
+
+  enum DecodeLevel // how much of a stream is decoded; under load, the lowest-priority streams are moved down these levels first
+  {
+    DECODE_FULL,
+    DECODE_REFERENCE_FRAMES, // skip the pictures that nothing references (e.g., non-reference B-frames)
+    DECODE_KEYFRAMES         // decode only IDR pictures (or, for H.265, IRAP pictures)
+  };
+  typedef std::function<void(unsigned streamId, DecodeLevel decodeLevel, unsigned busyPercent)> DecodeLevelCallback;
+  // Called (from the load shedder's thread) whenever the load shedder moves a stream to another decode level (see
+  // "Options::loadSheddingPeriodMS"), with how busy - as a percentage - the decoding threads were.  (Each stream's current
+  // level is also in its "StreamStats", and so in the statistics log.)
+
+  struct Options
+  {
+    Options();
+
+    unsigned numEventLoops; // the streams are spread, round-robin, across this many event loops (0 => one per core)
+    int numDecodeWorkers;   // decode on a pool of this many worker threads (0 => one per core); -1 => within the event loops
+    bool streamUsingTCP;    // request RTP-over-TCP, rather than RTP/UDP
+    int verbosityLevel;     // of each stream's "RTSPClient"
+    char const *applicationName;
+    StreamClosedCallback onStreamClosed; // optional
+    unsigned latencyReportPeriodMS;      // 0 => latencies aren't reported
+    LatencyReportCallback onLatencyReport;
+    unsigned statsPeriodMS;              // how often each stream's statistics are gathered (for "getStreamStats()", and the log)
+    char const *statsLogFileName;        // if non-NULL, each stream's statistics are appended to this file, as JSON lines
+    unsigned decodeThreadBudget;         // decoder threads to share between the open streams (0 => one per core).  Each stream
+                                         // gets - until it's closed - an equal share among the streams open when it's set up,
+                                         // or what's left of the budget if that's less (but always at least one thread).  So
+                                         // open all of the streams up front, for them all to get an equal share
+    unsigned loadSheddingPeriodMS;       // how often to check whether decoding is overloaded (0 => streams are never shed)
+    unsigned decodeBusyBudgetPercent;    // decoding is overloaded once its threads are busier than this
+    DecodeLevelCallback onDecodeLevelChanged; // optional
+    unsigned reconnectMinDelayMS;        // the delay before reconnecting a stream, which doubles (up to "reconnectMaxDelayMS")
+    unsigned reconnectMaxDelayMS;        // for each attempt in a row that fails.  (Each delay is randomized, to 50-100% of it.)
+    unsigned maxConcurrentConnects;      // streams that may be connecting (i.e., before "PLAY") at once; the rest wait (0 => no limit)
+    char const *sdpCacheDirectory;       // if non-NULL, each stream's SDP description is saved here, and - when the stream is next
+                                         // opened, e.g. after a restart - used instead of sending "DESCRIBE"
+  };
+
+  RTSPDecodeEngine(Options const &options = Options());
+  virtual ~RTSPDecodeEngine(); // closes any streams that are still open
+
+  enum DecodeThreading
+  {
+    DECODE_THREADING_NONE,       // decode on a single thread
+    DECODE_THREADING_THROUGHPUT, // frame threads: the most throughput, but each extra thread delays output by a frame
+    DECODE_THREADING_LATENCY     // slice threads (which help only if the stream is encoded as several slices per frame),
+                                 // with AV_CODEC_FLAG_LOW_DELAY
+  };
+  enum AnalyticsScaler // how a stream's analytics images are made (see "StreamOptions::analyticsWidth")
+  {
+    ANALYTICS_SCALER_AUTO,   // the fastest of the following that this CPU supports
+    ANALYTICS_SCALER_SCALAR, // our own kernels, without vector instructions
+    ANALYTICS_SCALER_SSE4,   // ditto, using SSE4.1 (x86 only)
+    ANALYTICS_SCALER_AVX2,   // ditto, using AVX2 (x86 only)
+    ANALYTICS_SCALER_SWSCALE // libswscale (also used for frames that our kernels can't handle; see "ThumbnailScaler")
+  };
+  struct AnalyticsImage
+  {
+    unsigned char const *bgr; // packed BGR24 (e.g., for wrapping in a "cv::Mat" of type CV_8UC3)
+    unsigned width, height, stride;
+    int64_t pts; // the frame's presentation time, in microseconds
+  };
+  typedef std::function<void(unsigned streamId, AnalyticsImage const &image)> AnalyticsCallback;
+  // Called (from the same thread, and just after, the frame callback) with a small BGR copy of each decoded frame.  The image
+  // is valid only until the callback returns.
+  enum RecordFormat // of the files that a stream's (compressed) video is recorded to, as received - i.e., without decoding it
+  {
+    RECORD_NONE,
+    RECORD_MP4,    // fragmented MP4 (which stays playable if it's cut short)
+    RECORD_MPEG_TS
+  };
+
+  struct StreamOptions
+  {
+    StreamOptions();
+
+    DecodeThreading decodeThreading;
+    unsigned decodeThreads; // 0 => the stream's share of "Options::decodeThreadBudget" (see below), when it is first set up
+    int priority;                  // under load, streams with lower priorities are shed first
+    DecodeLevel lowestDecodeLevel; // the furthest that the stream may be shed (DECODE_FULL => never)
+    unsigned analyticsWidth, analyticsHeight; // if non-0, also deliver each frame, downscaled to this size, to "onAnalyticsFrame"
+    AnalyticsScaler analyticsScaler;
+    AnalyticsCallback onAnalyticsFrame;
+    RecordFormat recordFormat;     // if not RECORD_NONE, also record the stream (if it's H.264 or H.265)...
+    std::string recordFilePrefix;  // ... to files named "<prefix>-<YYYYmmdd-HHMMSS>.mp4" (or ".ts"); "" => "stream<id>"
+    unsigned recordSegmentSeconds; // each file is ended, at the next keyframe, once it's this long
+    bool decode;                   // false => only record the stream (with no decoder, so "onFrame" is never called)
+    unsigned preEventSeconds;      // if non-0, keep (at least) this much of the stream's latest video, for "exportClip()"...
+    unsigned preEventBufferSize;   // ... in at most this many bytes (if the video is bigger, less of it is kept)
+    bool reconnect;                // reconnect (with backoff) whenever the stream ends, fails, or stalls - until "closeStream()"
+    unsigned stallTimeoutMS;       // with "reconnect": the stream has stalled if nothing is received for this long (0 => never)
+    bool videoOnly;                // set up only the stream's video (saving a "SETUP" round trip for each other subsession)
+  };
+
+  unsigned openStream(char const *rtspURL, FrameCallback const &onFrame, StreamOptions const &streamOptions = StreamOptions());
+  // Starts receiving and decoding "rtspURL".  Returns an id (never 0) that identifies the stream in callbacks.
+  void closeStream(unsigned streamId);
+  unsigned numOpenStreams();
+  bool exportClip(unsigned streamId, char const *fileName, unsigned postEventSeconds, RecordFormat format = RECORD_MP4);
+  // Starts writing a clip of the stream (which must have "StreamOptions::preEventSeconds" set) to "fileName": the video in
+  // its pre-event buffer (starting with a keyframe), followed by the next "postEventSeconds" of it.  The file is written in the
+  // background.  Returns false if the stream isn't open.  (Any clip that the stream is still exporting is left to finish.)
+
+  struct Totals
+  {
+    unsigned long long numFramesDecoded;
+    unsigned long long decodeTimeUS;          // time spent in the decoder (summed over all threads)
+    unsigned long long numDroppedAccessUnits; // skipped while waiting for a keyframe, or because a decode queue was full
+    unsigned long long numTruncatedFrames;    // too big for the receive buffer, and so not decoded
+  };
+  void getTotals(Totals &totals) const; // summed over all streams, since the engine was created
+
+  struct StreamStats
+  {
+    std::string url;
+    // What the stream's sinks have received, and what has been done with it:
+    unsigned long long numBytesReceived;
+    unsigned long long numNALUnitsReceived;
+    unsigned long long numTruncatedFrames;    // too big for the receive buffer, and so not decoded
+    unsigned long long numFramesDecoded;
+    unsigned long long numDecodeErrors;
+    unsigned long long numDroppedAccessUnits; // skipped while waiting for a keyframe, or because the decode queue was full
+    unsigned receiveBufferSize;
+    // From the RTP receivers' reception statistics (summed over all of the stream's RTP sources):
+    unsigned long long numRTPPacketsReceived;
+    unsigned long long numRTPPacketsExpected; // (by sequence number)
+    long long numRTPPacketsLost;              // expected - received; negative if packets were duplicated
+    double jitterMS;                          // the RFC 3550 interarrival jitter (the largest, over the stream's sources)
+    unsigned maxInterPacketGapUS;
+    DecodeLevel decodeLevel; // the stream's current decode level (which may have been lowered by load shedding)
+    // If the stream is being recorded:
+    unsigned long long numAccessUnitsRecorded; // queued to be written (i.e., not counting those refused because the disk fell behind)
+    unsigned long long numRecordedFiles;
+    unsigned long long numClipsExported;
+    unsigned numReconnects; // (the other counts are since the stream last connected)
+    // Since the stream (last) started connecting - including any wait for "Options::maxConcurrentConnects" - or -1 if not yet:
+    int timeToPlayMS;       // until the "PLAY" succeeded
+    int timeToFirstFrameMS; // until the first frame was decoded
+  };
+  bool getStreamStats(unsigned streamId, StreamStats &stats);
+  // returns the stream's statistics as of when they were last gathered (at most "Options::statsPeriodMS" ago),
+  // or false if the stream isn't open (or its statistics haven't been gathered yet)
+
+  Options const &options() const { return fOptions; }
+
+private:
+  friend class EventLoopShard;
+  void streamClosed(unsigned streamId); // called by the stream's event loop
+  void updateStreamStats(unsigned streamId, StreamStats const &stats); // ditto
+  unsigned decodeThreadsFor(unsigned streamId, StreamOptions const &streamOptions); // ditto
+  bool acquireConnectSlot(EventLoopShard *shard, unsigned streamId);
+  // ditto; returns false if "Options::maxConcurrentConnects" streams are already connecting, in which case the stream is
+  // queued, and the shard's "connectSlotGranted()" is called once it may connect
+  void releaseConnectSlot(); // ditto, once a stream has finished connecting (or has failed to)
+
+private:
+  Options fOptions;
+  std::vector<EventLoopShard *> fShards;
+  DecodeWorkerPool *fDecodeWorkerPool; // NULL means decode inline, within the event loops
+  LoadShedder *fLoadShedder;           // NULL unless "Options::loadSheddingPeriodMS" was given
+  RecordingWriter *fRecordingWriter;   // created when the first stream that's to be recorded is opened (guarded by "fMutex")
+  DecodeCounters *fCounters;
+  std::mutex fMutex;                   // guards the following:
+  std::map<unsigned, EventLoopShard *> fStreams;
+  std::map<unsigned, StreamStats> fStreamStats;
+  FILE *fStatsLog; // NULL unless "Options::statsLogFileName" was given
+  std::map<unsigned, unsigned> fDecodeThreads; // the budgeted decoder threads given to each stream (by id)
+  unsigned fNumDecodeThreadsAllocated;         // their total
+  unsigned fNumConnecting;
+  std::deque<std::pair<EventLoopShard *, unsigned> > fConnectQueue; // streams waiting to connect
+  bool fStopping;                                                     // (once set, no more streams are let connect)
+  unsigned fNextStreamId;
+  unsigned fNextShard;
+};
+
+#endif
@@ -0,0 +1,60 @@
+// A pool of (start-code-prefixed, padded) buffers for receiving NAL units, shared by all streams.
+// Implementation
+
+#include "ReceiveBufferPool.hh"
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+ReceiveBufferPool receiveBufferPool;
+
+unsigned ReceiveBufferPool::sizeClassFor(unsigned capacity)
+{
+  unsigned sizeClass = 0;
+  while (sizeClass + 1 < RECEIVE_BUFFER_NUM_SIZE_CLASSES && capacityOf(sizeClass) < capacity)
+  {
+    ++sizeClass;
+  }
+  return sizeClass;
+}
+
+unsigned ReceiveBufferPool::capacityOf(unsigned sizeClass)
+{
+  return DUMMY_SINK_RECEIVE_BUFFER_SIZE << sizeClass;
+}
+
+u_int8_t *ReceiveBufferPool::acquire(unsigned sizeClass)
+{
+  u_int8_t *buffer = NULL;
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    if (!fFree[sizeClass].empty())
+    {
+      buffer = fFree[sizeClass].back();
+      fFree[sizeClass].pop_back();
+    }
+  }
+  if (buffer == NULL)
+  {
+    buffer = new u_int8_t[4 + capacityOf(sizeClass) + AV_INPUT_BUFFER_PADDING_SIZE];
+  }
+
+  u_int8_t const start_code[4] = {0x00, 0x00, 0x00, 0x01};
+  memcpy(buffer, start_code, 4);
+  return buffer;
+}
+
+void ReceiveBufferPool::release(u_int8_t *buffer, unsigned sizeClass)
+{
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    if (fFree[sizeClass].size() < RECEIVE_BUFFER_MAX_FREE_PER_CLASS)
+    {
+      fFree[sizeClass].push_back(buffer);
+      return;
+    }
+  }
+  delete[] buffer;
+}
@@ -0,0 +1,40 @@
+// A pool of (start-code-prefixed, padded) buffers for receiving NAL units, shared by all streams.
+// C++ header
+
+#ifndef _RECEIVE_BUFFER_POOL_HH
+#define _RECEIVE_BUFFER_POOL_HH
+
+#include "liveMedia.hh"
+#include <vector>
+#include <mutex>
+
+// Define the (initial) size of the buffer that each sink receives NAL units into.  Each NAL unit is received after a 4-byte
+// start code, and is followed by padding, so that it can be decoded straight from the buffer:
+#define DUMMY_SINK_RECEIVE_BUFFER_SIZE 100000
+
+// Define a pool of receive buffers, shared by all streams.  Buffers come in a few size classes (each double the previous one),
+// so that a stream whose frames have outgrown its buffer can move up a class - and later back down again - with the buffers
+// that other streams have given back being reused, rather than freed and reallocated.  Each buffer has room for a 4-byte
+// start code before, and AV_INPUT_BUFFER_PADDING_SIZE bytes after, its "capacity" bytes of NAL unit.
+
+#define RECEIVE_BUFFER_NUM_SIZE_CLASSES 8        // capacities DUMMY_SINK_RECEIVE_BUFFER_SIZE * 1, 2, 4, ..., 128
+#define RECEIVE_BUFFER_MAX_FREE_PER_CLASS 4      // spare buffers of each class kept for reuse (the rest are freed)
+#define RECEIVE_BUFFER_SHRINK_PERIOD_US 30000000 // a stream with no truncations for this long may move down a size class
+
+class ReceiveBufferPool
+{
+public:
+  static unsigned sizeClassFor(unsigned capacity); // the smallest class whose buffers can hold "capacity" bytes (or the largest)
+  static unsigned capacityOf(unsigned sizeClass);
+
+  u_int8_t *acquire(unsigned sizeClass);
+  void release(u_int8_t *buffer, unsigned sizeClass);
+
+private:
+  std::mutex fMutex;
+  std::vector<u_int8_t *> fFree[RECEIVE_BUFFER_NUM_SIZE_CLASSES];
+};
+
+extern ReceiveBufferPool receiveBufferPool;
+
+#endif
@@ -0,0 +1,252 @@
+// A thread that writes recorded streams' (compressed) video to segmented MP4 or MPEG-TS files, so that disk I/O never stalls an
+// event loop.
+// Implementation
+
+#include "RecordingWriter.hh"
+#include <string.h>
+
+static AVRational const microseconds = {1, 1000000};
+
+RecordingWriter::RecordingWriter()
+    : fLastRecordingId(0), fQueuedBytes(0), fWritingBytes(0), fStopping(false)
+{
+  fThread = std::thread([this]() { writerLoop(); });
+}
+
+RecordingWriter::~RecordingWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStopping = true;
+  }
+  fWake.notify_one();
+  fThread.join();
+}
+
+void RecordingWriter::startSegment(unsigned recordingId, std::string const &fileName, RTSPDecodeEngine::RecordFormat format,
+                                   int hNumber, std::vector<unsigned char> const &extradata)
+{
+  Command command;
+  command.type = Command::START_SEGMENT;
+  command.recordingId = recordingId;
+  command.fileName = fileName;
+  command.format = format;
+  command.hNumber = hNumber;
+  command.extradata = extradata;
+  command.packet = NULL;
+  queue(command, 0);
+}
+
+bool RecordingWriter::write(unsigned recordingId, AVPacket *packet)
+{
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    if (fQueuedBytes + fWritingBytes + packet->size > RECORDING_QUEUE_MAX_BYTES)
+    {
+      av_packet_free(&packet);
+      return false;
+    }
+  }
+  Command command;
+  command.type = Command::WRITE;
+  command.recordingId = recordingId;
+  command.format = RTSPDecodeEngine::RECORD_NONE;
+  command.hNumber = 0;
+  command.packet = packet;
+  queue(command, packet->size);
+  return true;
+}
+
+void RecordingWriter::endSegment(unsigned recordingId)
+{
+  Command command;
+  command.type = Command::END_SEGMENT;
+  command.recordingId = recordingId;
+  command.format = RTSPDecodeEngine::RECORD_NONE;
+  command.hNumber = 0;
+  command.packet = NULL;
+  queue(command, 0);
+}
+
+void RecordingWriter::queue(Command const &command, unsigned size)
+{
+  bool wakeNow;
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fQueue.push_back(command);
+    // (Wake the writer early only as the queue crosses the batch size; otherwise, it picks up the queue within its period.)
+    wakeNow = fQueuedBytes < RECORDING_BATCH_BYTES && fQueuedBytes + size >= RECORDING_BATCH_BYTES;
+    fQueuedBytes += size;
+  }
+  if (wakeNow)
+    fWake.notify_one();
+}
+
+void RecordingWriter::writerLoop()
+{
+  std::vector<Command> batch;
+  while (true)
+  {
+    bool stopping;
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      fWake.wait_for(lock, std::chrono::milliseconds(RECORDING_BATCH_PERIOD_MS),
+                     [this]() { return fStopping || fQueuedBytes >= RECORDING_BATCH_BYTES; });
+      batch.swap(fQueue);
+      fWritingBytes = fQueuedBytes; // (still counted against "RECORDING_QUEUE_MAX_BYTES", until each is written)
+      fQueuedBytes = 0;
+      stopping = fStopping;
+    }
+
+    for (unsigned i = 0; i < batch.size(); ++i)
+    {
+      unsigned size = batch[i].packet != NULL ? batch[i].packet->size : 0;
+      execute(batch[i]);
+      if (size > 0)
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fWritingBytes -= size;
+      }
+    }
+    batch.clear(); // (keeping its capacity, for the next batch)
+    if (stopping)
+      break;
+  }
+
+  // Close any files whose recordings didn't end them (e.g., because the engine is being deleted):
+  for (std::map<unsigned, Segment>::iterator it = fSegments.begin(); it != fSegments.end(); ++it)
+  {
+    closeSegment(it->second);
+  }
+  fSegments.clear();
+}
+
+void RecordingWriter::execute(Command &command)
+{
+  switch (command.type)
+  {
+  case Command::START_SEGMENT:
+  {
+    std::map<unsigned, Segment>::iterator it = fSegments.find(command.recordingId);
+    if (it != fSegments.end())
+      closeSegment(it->second);
+    Segment &segment = fSegments[command.recordingId];
+    segment.fileName = command.fileName;
+    segment.format = command.format;
+    segment.hNumber = command.hNumber;
+    segment.extradata.swap(command.extradata);
+    segment.context = NULL;
+    segment.failed = false;
+    break;
+  }
+  case Command::WRITE:
+  {
+    std::map<unsigned, Segment>::iterator it = fSegments.find(command.recordingId);
+    if (it != fSegments.end() && !it->second.failed && (it->second.context != NULL || openSegment(it->second, command.packet)))
+    {
+      AVFormatContext *context = it->second.context; // alias
+      av_packet_rescale_ts(command.packet, microseconds, context->streams[0]->time_base);
+      if (av_write_frame(context, command.packet) < 0)
+      {
+        fprintf(stderr, "Failed to write to the recording \"%s\"; abandoning it\n", it->second.fileName.c_str());
+        closeSegment(it->second);
+        it->second.failed = true;
+      }
+    }
+    av_packet_free(&command.packet);
+    break;
+  }
+  case Command::END_SEGMENT:
+  {
+    std::map<unsigned, Segment>::iterator it = fSegments.find(command.recordingId);
+    if (it != fSegments.end())
+    {
+      closeSegment(it->second);
+      fSegments.erase(it);
+    }
+    break;
+  }
+  }
+}
+
+// Finds the video's dimensions (which the MP4 muxer needs) by parsing - not decoding - its parameter sets and first slice:
+static void findDimensions(AVCodecID codecId, std::vector<unsigned char> const &extradata, AVPacket const *packet,
+                           int &width, int &height)
+{
+  width = height = 0;
+  AVCodecParserContext *parser = av_parser_init(codecId);
+  AVCodecContext *codecContext = avcodec_alloc_context3(NULL);
+  if (parser != NULL && codecContext != NULL)
+  {
+    std::vector<uint8_t> data(extradata.size() + packet->size + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+    if (!extradata.empty())
+      memcpy(&data[0], &extradata[0], extradata.size());
+    memcpy(&data[extradata.size()], packet->data, packet->size);
+
+    uint8_t *out;
+    int outSize;
+    av_parser_parse2(parser, codecContext, &out, &outSize, &data[0], extradata.size() + packet->size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+    av_parser_parse2(parser, codecContext, &out, &outSize, NULL, 0, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0); // (the end of the data)
+    width = parser->width > 0 ? parser->width : codecContext->width;
+    height = parser->height > 0 ? parser->height : codecContext->height;
+  }
+  if (parser != NULL)
+    av_parser_close(parser);
+  avcodec_free_context(&codecContext);
+}
+
+bool RecordingWriter::openSegment(Segment &segment, AVPacket const *firstPacket)
+{
+  AVCodecID codecId = segment.hNumber == 265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+  AVFormatContext *context = NULL;
+  if (avformat_alloc_output_context2(&context, NULL, segment.format == RTSPDecodeEngine::RECORD_MP4 ? "mp4" : "mpegts",
+                                     segment.fileName.c_str()) < 0)
+  {
+    fprintf(stderr, "Failed to set up the recording \"%s\"\n", segment.fileName.c_str());
+    segment.failed = true;
+    return false;
+  }
+
+  // The access units (and the parameter sets) are in Annex B form, which the MP4 muxer converts to its own:
+  AVStream *stream = avformat_new_stream(context, NULL);
+  stream->time_base = microseconds;
+  AVCodecParameters *par = stream->codecpar; // alias
+  par->codec_type = AVMEDIA_TYPE_VIDEO;
+  par->codec_id = codecId;
+  findDimensions(codecId, segment.extradata, firstPacket, par->width, par->height);
+  if (!segment.extradata.empty())
+  {
+    par->extradata = (uint8_t *)av_mallocz(segment.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+    memcpy(par->extradata, &segment.extradata[0], segment.extradata.size());
+    par->extradata_size = segment.extradata.size();
+  }
+
+  // MP4 files are fragmented (at each keyframe), so that a file that's cut short - e.g., by a crash - is still playable:
+  AVDictionary *muxerOptions = NULL;
+  if (segment.format == RTSPDecodeEngine::RECORD_MP4)
+    av_dict_set(&muxerOptions, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+  int result = avio_open(&context->pb, segment.fileName.c_str(), AVIO_FLAG_WRITE);
+  if (result >= 0)
+    result = avformat_write_header(context, &muxerOptions);
+  av_dict_free(&muxerOptions);
+  if (result < 0)
+  {
+    fprintf(stderr, "Failed to open the recording \"%s\"\n", segment.fileName.c_str());
+    avio_closep(&context->pb);
+    avformat_free_context(context);
+    segment.failed = true;
+    return false;
+  }
+  segment.context = context;
+  return true;
+}
+
+void RecordingWriter::closeSegment(Segment &segment)
+{
+  if (segment.context == NULL)
+    return;
+  av_write_trailer(segment.context);
+  avio_closep(&segment.context->pb);
+  avformat_free_context(segment.context);
+  segment.context = NULL;
+}
@@ -0,0 +1,93 @@
+// A thread that writes recorded streams' (compressed) video to segmented MP4 or MPEG-TS files, so that disk I/O never stalls an
+// event loop.
+// C++ header
+
+#ifndef _RECORDING_WRITER_HH
+#define _RECORDING_WRITER_HH
+
+#include "RTSPDecode.hh"
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+#define RECORDING_BATCH_PERIOD_MS 100               // the writer wakes at least this often when there's something to write...
+#define RECORDING_BATCH_BYTES (4 * 1024 * 1024)     // ... or as soon as this much is queued
+#define RECORDING_QUEUE_MAX_BYTES (64 * 1024 * 1024) // beyond this (e.g., if the disk can't keep up), access units are refused
+                                                     // (this counts those in the batch that's being written, too)
+
+// Define a class for the engine's single writer thread, which owns all of the open recording files.  Each "StreamRecorder"
+// (in an event loop) queues commands for it: to start a new file (segment), to write an access unit to the current one, and to
+// close it.  The writer takes the whole queue at once, and writes it as a batch, without holding the lock.
+
+class RecordingWriter
+{
+public:
+  RecordingWriter(); // starts the writer thread
+  virtual ~RecordingWriter(); // writes whatever is still queued, closes every file, then stops the thread
+
+  unsigned newRecordingId() { return ++fLastRecordingId; } // called from any thread
+
+  // Called from any thread (but, for each recording, from only one thread):
+  void startSegment(unsigned recordingId, std::string const &fileName, RTSPDecodeEngine::RecordFormat format, int hNumber,
+                    std::vector<unsigned char> const &extradata);
+  // closes the recording's current file (if any), then opens "fileName" (once its first access unit arrives, because the
+  // muxer needs the video's dimensions, which are parsed from it).  "extradata" holds the parameter sets (in Annex B form)
+  bool write(unsigned recordingId, AVPacket *packet);
+  // "packet" (an access unit, in Annex B form, with timestamps in microseconds) is taken over by the writer.  Returns false
+  // (and frees "packet") if the queue is full
+  void endSegment(unsigned recordingId); // closes the recording's current file
+
+private:
+  struct Command
+  {
+    enum
+    {
+      START_SEGMENT,
+      WRITE,
+      END_SEGMENT
+    } type;
+    unsigned recordingId;
+    std::string fileName;
+    RTSPDecodeEngine::RecordFormat format;
+    int hNumber;
+    std::vector<unsigned char> extradata;
+    AVPacket *packet;
+  };
+  struct Segment // a file that's being written
+  {
+    std::string fileName;
+    RTSPDecodeEngine::RecordFormat format;
+    int hNumber;
+    std::vector<unsigned char> extradata;
+    AVFormatContext *context; // NULL until the first access unit arrives (or if the file couldn't be opened)
+    bool failed;
+  };
+
+  void queue(Command const &command, unsigned size);
+  void writerLoop();
+  void execute(Command &command);
+  bool openSegment(Segment &segment, AVPacket const *firstPacket);
+  void closeSegment(Segment &segment);
+
+private:
+  std::atomic<unsigned> fLastRecordingId;
+  std::mutex fMutex; // guards the following:
+  std::condition_variable fWake;
+  std::vector<Command> fQueue;
+  unsigned fQueuedBytes;  // of the access units in "fQueue"
+  unsigned fWritingBytes; // of those in the batch that the writer took, that it hasn't written yet
+  bool fStopping;
+  std::map<unsigned, Segment> fSegments; // used only by the writer thread
+  std::thread fThread;
+};
+
+#endif
@@ -0,0 +1,296 @@
+// A ring of decoded frames in shared memory, from which other processes (e.g., detectors) can read them without copying.
+// Implementation
+
+#include "SharedFrameRing.hh"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <new>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+}
+
+#if ATOMIC_LLONG_LOCK_FREE != 2 || ATOMIC_INT_LOCK_FREE != 2
+#error "The shared frame ring needs lock-free atomics, to share them between processes"
+#endif
+
+#define SHARED_FRAME_RING_ALIGNMENT 64 // of each plane's rows
+
+static uint64_t roundUp(uint64_t value, uint64_t multiple)
+{
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+// Lays out "frame"'s planes (each row aligned) from "base".  Returns the bytes needed, or 0 if the format is unsupported:
+static unsigned layOutFrame(AVFrame const *frame, uint8_t *base, uint8_t *planes[SHARED_FRAME_RING_MAX_PLANES],
+                            int linesizes[SHARED_FRAME_RING_MAX_PLANES])
+{
+  if (av_image_fill_linesizes(linesizes, (AVPixelFormat)frame->format, frame->width) < 0)
+    return 0;
+  for (unsigned i = 0; i < SHARED_FRAME_RING_MAX_PLANES; ++i)
+  {
+    linesizes[i] = FFALIGN(linesizes[i], SHARED_FRAME_RING_ALIGNMENT);
+  }
+  int size = av_image_fill_pointers(planes, (AVPixelFormat)frame->format, frame->height, base, linesizes);
+  return size < 0 ? 0 : size;
+}
+
+static void futexWake(std::atomic<uint32_t> *word)
+{
+  syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+// Implementation of "SharedFrameRing":
+
+SharedFrameRing *SharedFrameRing::createNew(char const *name, unsigned numSlots, unsigned slotSize)
+{
+  if (numSlots == 0 || slotSize == 0)
+  {
+    fprintf(stderr, "A shared frame ring needs at least one slot, of non-zero size\n");
+    return NULL;
+  }
+  uint64_t pageSize = sysconf(_SC_PAGESIZE);
+  uint64_t slotsOffset = roundUp(sizeof(SharedFrameRingHeader), pageSize);
+  uint64_t slotStride = roundUp(SHARED_FRAME_SLOT_DATA_OFFSET + (uint64_t)slotSize, pageSize);
+  size_t mappingSize = slotsOffset + numSlots * slotStride;
+
+  // The ring's size is sealed, so that no process can shrink it under the others' mappings (which would crash them):
+  int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Failed to create shared memory for a frame ring: %s\n", strerror(errno));
+    return NULL;
+  }
+  void *mapping = MAP_FAILED;
+  if (ftruncate(fd, mappingSize) < 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+      (mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    fprintf(stderr, "Failed to set up %lu bytes of shared memory for a frame ring: %s\n", (unsigned long)mappingSize, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  // (The new memory is zeroed, so every slot's "sequence" is already 0.)
+  SharedFrameRingHeader *header = new (mapping) SharedFrameRingHeader;
+  header->numSlots = numSlots;
+  header->slotSize = slotSize;
+  header->slotsOffset = slotsOffset;
+  header->slotStride = slotStride;
+  header->lastSequence = 0;
+  header->futexWord = 0;
+  header->closed = 0;
+  header->version = SHARED_FRAME_RING_VERSION;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = SHARED_FRAME_RING_MAGIC; // last, so that readers never see a partly-initialized ring
+  return new SharedFrameRing(fd, header, mappingSize);
+}
+
+SharedFrameRing::SharedFrameRing(int fd, SharedFrameRingHeader *header, size_t mappingSize)
+    : fFd(fd), fHeader(header), fMappingSize(mappingSize), fNumFramesDropped(0)
+{
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+  fHeader->closed = 1;
+  ++fHeader->futexWord;
+  futexWake(&fHeader->futexWord);
+  munmap(fHeader, fMappingSize);
+  close(fFd);
+}
+
+unsigned SharedFrameRing::slotSizeFor(AVFrame const *frame)
+{
+  uint8_t *planes[SHARED_FRAME_RING_MAX_PLANES];
+  int linesizes[SHARED_FRAME_RING_MAX_PLANES];
+  return layOutFrame(frame, NULL, planes, linesizes);
+}
+
+std::string SharedFrameRing::path() const
+{
+  char path[64];
+  snprintf(path, sizeof path, "/proc/%d/fd/%d", (int)getpid(), fFd);
+  return path;
+}
+
+bool SharedFrameRing::write(AVFrame const *frame)
+{
+  uint64_t sequence = fHeader->lastSequence + 1;
+  SharedFrameSlot *slot = (SharedFrameSlot *)((uint8_t *)fHeader + fHeader->slotsOffset + (sequence % fHeader->numSlots) * fHeader->slotStride);
+  uint8_t *data = (uint8_t *)slot + SHARED_FRAME_SLOT_DATA_OFFSET;
+
+  uint8_t *planes[SHARED_FRAME_RING_MAX_PLANES];
+  int linesizes[SHARED_FRAME_RING_MAX_PLANES];
+  unsigned size = layOutFrame(frame, data, planes, linesizes);
+  if (size == 0 || size > fHeader->slotSize)
+  {
+    ++fNumFramesDropped;
+    return false;
+  }
+
+  // Mark the slot as being rewritten (so that a reader still using the frame that was there will see that it's gone), then
+  // fill it, then publish it:
+  slot->sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  av_image_copy(planes, linesizes, (uint8_t const **)frame->data, frame->linesize, (AVPixelFormat)frame->format,
+                frame->width, frame->height);
+  slot->pts = frame->pts;
+  slot->width = frame->width;
+  slot->height = frame->height;
+  slot->format = frame->format;
+  slot->numPlanes = 0;
+  for (unsigned i = 0; i < SHARED_FRAME_RING_MAX_PLANES; ++i)
+  {
+    slot->linesize[i] = planes[i] != NULL ? linesizes[i] : 0;
+    slot->planeOffset[i] = planes[i] != NULL ? planes[i] - data : 0;
+    if (planes[i] != NULL)
+      slot->numPlanes = i + 1;
+  }
+  slot->sequence.store(sequence, std::memory_order_release);
+  fHeader->lastSequence.store(sequence, std::memory_order_release);
+
+  // Wake any waiting readers.  (This is a system call per frame, but it keeps the readers' mappings read-only.)
+  ++fHeader->futexWord;
+  futexWake(&fHeader->futexWord);
+  return true;
+}
+
+// Implementation of "SharedFrameRingReader":
+
+SharedFrameRingReader *SharedFrameRingReader::open(char const *path)
+{
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Failed to open the frame ring \"%s\": %s\n", path, strerror(errno));
+    return NULL;
+  }
+  SharedFrameRingReader *reader = openFd(fd);
+  close(fd); // (the mapping keeps the memory alive)
+  return reader;
+}
+
+SharedFrameRingReader *SharedFrameRingReader::openFd(int fd)
+{
+  struct stat status;
+  if (fstat(fd, &status) < 0 || (size_t)status.st_size < sizeof(SharedFrameRingHeader))
+  {
+    fprintf(stderr, "Not a frame ring (it's too small)\n");
+    return NULL;
+  }
+  size_t mappingSize = status.st_size;
+  void *mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED)
+  {
+    fprintf(stderr, "Failed to map the frame ring: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  SharedFrameRingHeader const *header = (SharedFrameRingHeader const *)mapping;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header->magic != SHARED_FRAME_RING_MAGIC || header->version != SHARED_FRAME_RING_VERSION || header->numSlots == 0 ||
+      header->slotsOffset + header->numSlots * header->slotStride > mappingSize ||
+      SHARED_FRAME_SLOT_DATA_OFFSET + (uint64_t)header->slotSize > header->slotStride)
+  {
+    fprintf(stderr, "Not a frame ring (or one from an incompatible version)\n");
+    munmap(mapping, mappingSize);
+    return NULL;
+  }
+  return new SharedFrameRingReader(header, mappingSize);
+}
+
+SharedFrameRingReader::SharedFrameRingReader(SharedFrameRingHeader const *header, size_t mappingSize)
+    : fHeader(header), fMappingSize(mappingSize), fNumFramesLost(0)
+{
+  // Start with the most recent frame (if there is one), rather than the oldest:
+  uint64_t lastSequence = fHeader->lastSequence;
+  fNextSequence = lastSequence > 0 ? lastSequence : 1;
+}
+
+SharedFrameRingReader::~SharedFrameRingReader()
+{
+  munmap((void *)fHeader, fMappingSize);
+}
+
+SharedFrameSlot const *SharedFrameRingReader::slotFor(uint64_t sequence) const
+{
+  return (SharedFrameSlot const *)((uint8_t const *)fHeader + fHeader->slotsOffset + (sequence % fHeader->numSlots) * fHeader->slotStride);
+}
+
+static int64_t monotonicTimeMS()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * (int64_t)1000 + now.tv_nsec / 1000000;
+}
+
+bool SharedFrameRingReader::next(Frame &frame, int timeoutMS)
+{
+  int64_t deadline = timeoutMS >= 0 ? monotonicTimeMS() + timeoutMS : 0;
+  while (true)
+  {
+    // (Read the futex word before checking for a frame, so that a frame written in between still wakes us.)
+    uint32_t futexWord = fHeader->futexWord.load(std::memory_order_acquire);
+    uint64_t lastSequence = fHeader->lastSequence.load(std::memory_order_acquire);
+    if (lastSequence >= fNextSequence)
+    {
+      if (lastSequence - fNextSequence >= fHeader->numSlots)
+      {
+        // We've been lapped: skip to the oldest frame that's still in the ring:
+        uint64_t oldestSequence = lastSequence - fHeader->numSlots + 1;
+        fNumFramesLost += oldestSequence - fNextSequence;
+        fNextSequence = oldestSequence;
+      }
+
+      // Copy the frame's description, checking (as a "seqlock" reader) that the slot wasn't rewritten meanwhile:
+      SharedFrameSlot const *slot = slotFor(fNextSequence);
+      uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+      frame.sequence = sequence;
+      frame.pts = slot->pts;
+      frame.width = slot->width;
+      frame.height = slot->height;
+      frame.format = slot->format;
+      frame.numPlanes = slot->numPlanes;
+      uint8_t const *data = (uint8_t const *)slot + SHARED_FRAME_SLOT_DATA_OFFSET;
+      for (unsigned i = 0; i < SHARED_FRAME_RING_MAX_PLANES; ++i)
+      {
+        frame.data[i] = i < frame.numPlanes ? data + slot->planeOffset[i] : NULL;
+        frame.linesize[i] = slot->linesize[i];
+      }
+      ++fNextSequence;
+      if (sequence == fNextSequence - 1 && isStillValid(frame))
+        return true;
+      ++fNumFramesLost; // it was overwritten just as we got to it
+      continue;
+    }
+
+    if (fHeader->closed)
+      return false;
+    struct timespec timeout;
+    if (timeoutMS >= 0)
+    {
+      int64_t remainingMS = deadline - monotonicTimeMS();
+      if (remainingMS <= 0)
+        return false;
+      timeout.tv_sec = remainingMS / 1000;
+      timeout.tv_nsec = (remainingMS % 1000) * 1000000;
+    }
+    syscall(SYS_futex, (uint32_t const *)&fHeader->futexWord, FUTEX_WAIT, futexWord, timeoutMS >= 0 ? &timeout : NULL, NULL, 0);
+  }
+}
+
+bool SharedFrameRingReader::isStillValid(Frame const &frame) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slotFor(frame.sequence)->sequence.load(std::memory_order_relaxed) == frame.sequence;
+}
@@ -0,0 +1,116 @@
+// A ring of decoded frames in shared memory, from which other processes (e.g., detectors) can read them without copying.
+// C++ header
+
+#ifndef _SHARED_FRAME_RING_HH
+#define _SHARED_FRAME_RING_HH
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+struct AVFrame;
+
+#define SHARED_FRAME_RING_MAGIC 0x52465344 // "DSFR"
+#define SHARED_FRAME_RING_VERSION 1
+#define SHARED_FRAME_RING_MAX_PLANES 4
+#define SHARED_FRAME_SLOT_DATA_OFFSET 128 // from the start of each slot to its frame data (so that the data is cache-aligned)
+
+// The ring's layout in shared memory.  This is also how readers in other processes see it, so it's made only of fixed-size
+// types, and lock-free atomics (which work across processes):
+//   a "SharedFrameRingHeader", then - starting at "slotsOffset", and "slotStride" bytes apart - "numSlots" slots, each a
+//   "SharedFrameSlot" followed (at SHARED_FRAME_SLOT_DATA_OFFSET) by up to "slotSize" bytes of frame data.
+// Frames are numbered ("sequence") from 1, and frame n goes in slot n % "numSlots".  The writer never waits for readers: it
+// simply overwrites the oldest frame, so a reader that falls "numSlots" frames behind is 'lapped', and loses frames.
+
+struct SharedFrameRingHeader
+{
+  uint32_t magic, version;
+  uint32_t numSlots;
+  uint32_t slotSize;
+  uint64_t slotsOffset, slotStride;
+  std::atomic<uint64_t> lastSequence; // of the most recently written frame (0 => none yet)
+  std::atomic<uint32_t> futexWord;    // changes whenever a frame is written, or the ring is closed; readers wait on this
+  std::atomic<uint32_t> closed;       // set once the writer has finished with the ring
+};
+
+struct SharedFrameSlot
+{
+  std::atomic<uint64_t> sequence; // of the frame in the slot; 0 while the slot is being (re)written
+  int64_t pts;                    // in microseconds (see "RTSPDecodeEngine::FrameCallback")
+  int32_t width, height, format;  // "format" is an "AVPixelFormat"
+  uint32_t numPlanes;
+  int32_t linesize[SHARED_FRAME_RING_MAX_PLANES];
+  uint32_t planeOffset[SHARED_FRAME_RING_MAX_PLANES]; // from the start of the slot's frame data
+};
+
+// Define a class that writes decoded frames into a new ring, held in a "memfd" (an anonymous file in memory).  Other processes
+// map the ring using "SharedFrameRingReader", given either "path()" or (e.g., passed over a UNIX domain socket) "fd()".
+// "write()" copies the frame into the ring - which is the only copy - and must not be called concurrently.
+
+class SharedFrameRing
+{
+public:
+  static SharedFrameRing *createNew(char const *name, unsigned numSlots, unsigned slotSize);
+  // returns NULL (with a message on stderr) if the shared memory couldn't be created.  "name" is just for debugging
+  virtual ~SharedFrameRing(); // marks the ring closed (waking any readers); readers may keep their mappings
+
+  static unsigned slotSizeFor(AVFrame const *frame); // the slot size needed for frames like this (or 0 if unsupported)
+
+  int fd() const { return fFd; }
+  std::string path() const; // "/proc/<pid>/fd/<fd>", which other processes of the same user can open
+
+  bool write(AVFrame const *frame);
+  // returns false (and counts the frame) if it was too big for a slot, or its format is unsupported
+  unsigned long long numFramesWritten() const { return fHeader->lastSequence; }
+  unsigned long long numFramesDropped() const { return fNumFramesDropped; }
+
+private:
+  SharedFrameRing(int fd, SharedFrameRingHeader *header, size_t mappingSize); // called only by "createNew()"
+
+private:
+  int fFd;
+  SharedFrameRingHeader *fHeader; // the start of the mapping
+  size_t fMappingSize;
+  unsigned long long fNumFramesDropped;
+};
+
+// Define a class that reads frames from a "SharedFrameRing" that another process is writing.  The frames are read in place:
+// after using a frame, call "isStillValid()" to check that the writer didn't overwrite it meanwhile (and if it did, discard
+// whatever was computed from it).
+
+class SharedFrameRingReader
+{
+public:
+  static SharedFrameRingReader *open(char const *path);
+  static SharedFrameRingReader *openFd(int fd); // doesn't take ownership of "fd"
+  // return NULL (with a message on stderr) if the ring couldn't be mapped, or isn't a compatible ring
+  virtual ~SharedFrameRingReader();
+
+  struct Frame
+  {
+    uint64_t sequence;
+    int64_t pts;
+    int width, height, format; // "format" is an "AVPixelFormat"
+    unsigned numPlanes;
+    uint8_t const *data[SHARED_FRAME_RING_MAX_PLANES];
+    int linesize[SHARED_FRAME_RING_MAX_PLANES];
+  };
+  bool next(Frame &frame, int timeoutMS);
+  // waits (for at most "timeoutMS"; -1 => for ever) for the frame after the previous one that was read; returns false on a
+  // timeout, or if the ring has been closed.  If we've been lapped, skips (and counts) the frames that were overwritten
+  bool isStillValid(Frame const &frame) const;
+  unsigned long long numFramesLost() const { return fNumFramesLost; } // skipped because we were lapped
+  bool isClosed() const { return fHeader->closed != 0; }
+
+private:
+  SharedFrameRingReader(SharedFrameRingHeader const *header, size_t mappingSize); // called only by "openFd()"
+  SharedFrameSlot const *slotFor(uint64_t sequence) const;
+
+private:
+  SharedFrameRingHeader const *fHeader;
+  size_t fMappingSize;
+  uint64_t fNextSequence;
+  unsigned long long fNumFramesLost;
+};
+
+#endif
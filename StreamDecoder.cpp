@@ -0,0 +1,393 @@
+// A decoder for a single H.264 or H.265 video subsession, which delivers each decoded frame to the stream's frame callback.
+// Implementation
+
+#include "StreamDecoder.hh"
+#include "DecodeWorkerPool.hh"
+
+StreamDecoder *StreamDecoder::createNew(UsageEnvironment &env, char const *streamId, H264or5ParameterSets const &parameterSets,
+                                        unsigned streamNum, RTSPDecodeEngine::FrameCallback const &onFrame,
+                                        DecodeCounters &counters, RTSPDecodeEngine::StreamOptions const &streamOptions)
+{
+  StreamDecoder *decoder = new StreamDecoder(streamId, parameterSets, streamNum, onFrame, counters);
+  if (!decoder->decode_init(env, streamOptions))
+  {
+    delete decoder;
+    return NULL;
+  }
+  return decoder;
+}
+
+StreamDecoder::StreamDecoder(char const *streamId, H264or5ParameterSets const &parameterSets,
+                             unsigned streamNum, RTSPDecodeEngine::FrameCallback const &onFrame, DecodeCounters &counters)
+    : fParameterSets(parameterSets), fStreamNum(streamNum), fOnFrame(onFrame), fCounters(counters),
+      fThumbnailScaler(NULL), fCodec(NULL), fCodecContext(NULL), fFrame(NULL), fNumFramesDecoded(0), fNumDecodeErrors(0), fDecodeTimeUS(0),
+      fDecodeLevel(RTSPDecodeEngine::DECODE_FULL), fFirstFrameTimeUS(0),
+      fAccessUnitPTS(0), fAccessUnitReceiveTime(0), fAccessUnitIsKeyframe(False), fAccessUnitHasNonKeyframeSlice(False),
+      fQueue(DECODE_QUEUE_DEPTH), fQueuePTS(DECODE_QUEUE_DEPTH), fQueueReceiveTime(DECODE_QUEUE_DEPTH), fQueueHead(0), fQueueLength(0),
+      fScheduled(False), fWaitingForKeyframe(True), fAdmitLevel(RTSPDecodeEngine::DECODE_FULL), fNumDroppedAccessUnits(0)
+{
+  fStreamId = strDup(streamId);
+}
+
+StreamDecoder::~StreamDecoder()
+{
+  av_frame_free(&fFrame);
+  avcodec_free_context(&fCodecContext); // also frees "extradata"
+  delete fThumbnailScaler;
+  delete[] fStreamId;
+}
+
+Boolean StreamDecoder::decode_init(UsageEnvironment &env, RTSPDecodeEngine::StreamOptions const &streamOptions)
+{
+  fCodec = avcodec_find_decoder(fParameterSets.hNumber() == 265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264);
+  if (NULL == fCodec)
+  {
+    env.setResultMsg("Codec not found");
+    return False;
+  }
+
+  fCodecContext = avcodec_alloc_context3(fCodec);
+  if (NULL == fCodecContext)
+  {
+    env.setResultMsg("Could not allocate video codec context");
+    return False;
+  }
+
+  // Give the decoder the SDP's parameter sets (if any) once, up front, rather than prepending them to every NAL unit:
+  setExtradata(env);
+
+  // Packet timestamps are presentation times, in microseconds:
+  fCodecContext->pkt_timebase.num = 1;
+  fCodecContext->pkt_timebase.den = 1000000;
+
+  // Set up the decoder's threads (which must be done before it's opened):
+  fCodecContext->thread_count = streamOptions.decodeThreads;
+  switch (streamOptions.decodeThreading)
+  {
+  case RTSPDecodeEngine::DECODE_THREADING_NONE:
+    fCodecContext->thread_count = 1;
+    break;
+  case RTSPDecodeEngine::DECODE_THREADING_THROUGHPUT:
+    fCodecContext->thread_type = FF_THREAD_FRAME;
+    break;
+  case RTSPDecodeEngine::DECODE_THREADING_LATENCY:
+    fCodecContext->thread_type = FF_THREAD_SLICE;
+    fCodecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    break;
+  }
+
+  if (avcodec_open2(fCodecContext, fCodec, NULL) < 0)
+  {
+    env.setResultMsg("Could not open codec");
+    return False;
+  }
+
+  fFrame = av_frame_alloc();
+  if (NULL == fFrame)
+  {
+    env.setResultMsg("Could not allocate video frame");
+    return False;
+  }
+
+  if (streamOptions.analyticsWidth > 0 && streamOptions.analyticsHeight > 0 && streamOptions.onAnalyticsFrame)
+  {
+    fThumbnailScaler = new ThumbnailScaler(streamOptions.analyticsWidth, streamOptions.analyticsHeight, streamOptions.analyticsScaler);
+    fOnAnalyticsFrame = streamOptions.onAnalyticsFrame;
+    env << "Analytics images: " << streamOptions.analyticsWidth << "x" << streamOptions.analyticsHeight
+        << ", using " << fThumbnailScaler->scalerName() << "\n";
+  }
+  return True;
+}
+
+void StreamDecoder::setExtradata(UsageEnvironment &env)
+{
+  unsigned int totalsize = fParameterSets.annexBSize();
+  env << "H." << fParameterSets.hNumber() << ": numParameterSets = " << fParameterSets.numParameterSets()
+      << ", totalsize = " << totalsize << "\n";
+
+  // The codec context owns (and eventually frees) its "extradata", so it must come from "av_malloc()":
+  unsigned char *extradata = (unsigned char *)av_mallocz(totalsize + AV_INPUT_BUFFER_PADDING_SIZE);
+  fParameterSets.copyAnnexB(extradata);
+  av_free(fCodecContext->extradata);
+  fCodecContext->extradata = extradata;
+  fCodecContext->extradata_size = totalsize;
+}
+
+static int64_t presentationTimeUS(struct timeval const &presentationTime)
+{
+  return presentationTime.tv_sec * (int64_t)1000000 + presentationTime.tv_usec;
+}
+
+static int64_t monotonicTimeUS()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * (int64_t)1000000 + now.tv_nsec / 1000;
+}
+
+// Latencies are measured by the wall clock, because they start from the (RTCP-synchronized) wall-clock time of capture:
+static int64_t wallClockTimeUS()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return presentationTimeUS(now);
+}
+
+void StreamDecoder::addNALUnit(unsigned char const *nalUnit, unsigned size, struct timeval presentationTime, int64_t receiveTimeUS,
+                               Boolean endsAccessUnit, DecodeWorkerPool *decodeWorkerPool)
+{
+  // Each access unit's NAL units all have the same presentation time, so a new presentation time begins a new access unit
+  // (if the previous one's last NAL unit - with the RTP marker bit - was lost):
+  int64_t pts = presentationTimeUS(presentationTime);
+  if (!fAccessUnit.empty() && pts != fAccessUnitPTS)
+    completeAccessUnit(decodeWorkerPool);
+  if (fAccessUnit.empty())
+  {
+    fAccessUnitPTS = pts;
+    fAccessUnitIsKeyframe = fAccessUnitHasNonKeyframeSlice = False;
+  }
+  fAccessUnitReceiveTime = receiveTimeUS;
+  if (size > 4)
+  {
+    unsigned nalUnitType = fParameterSets.nalUnitType(nalUnit + 4);
+    if (fParameterSets.isRandomAccessPoint(nalUnitType))
+      fAccessUnitIsKeyframe = True;
+    else if (fParameterSets.isNonRandomAccessSlice(nalUnitType))
+      fAccessUnitHasNonKeyframeSlice = True;
+  }
+  fAccessUnit.insert(fAccessUnit.end(), nalUnit, nalUnit + size);
+
+  if (endsAccessUnit)
+    completeAccessUnit(decodeWorkerPool);
+}
+
+void StreamDecoder::completeAccessUnit(DecodeWorkerPool *decodeWorkerPool)
+{
+  unsigned size = fAccessUnit.size();
+  fAccessUnit.resize(size + AV_INPUT_BUFFER_PADDING_SIZE, 0); // the decoder may read (but ignores) a few bytes past the end
+  if (decodeWorkerPool != NULL)
+  {
+    decodeWorkerPool->submit(this); // (which calls "enqueueAccessUnit()")
+  }
+  else
+  {
+    Boolean admitted;
+    {
+      std::lock_guard<std::mutex> lock(fQueueMutex);
+      admitted = admitAccessUnit();
+    }
+    if (admitted)
+      decodeAccessUnit(&fAccessUnit[0], size, fAccessUnitPTS, fAccessUnitReceiveTime);
+  }
+  fAccessUnit.clear(); // (keeping its capacity, for the next access unit)
+}
+
+int StreamDecoder::decodeAccessUnit(unsigned char *inbuf, int read_size, int64_t pts, int64_t receiveTimeUS)
+{
+  AVCodecContext *c = fCodecContext; // alias
+  AVPacket avpkt;
+  av_init_packet(&avpkt);
+  avpkt.data = inbuf; // "inbuf" is already padded
+  avpkt.size = read_size;
+  avpkt.pts = pts;
+  c->reordered_opaque = receiveTimeUS; // returned with this access unit's picture (even if it's reordered)
+
+  // Have the decoder skip the pictures that the stream's current decode level sheds:
+  switch (decodeLevel())
+  {
+  case RTSPDecodeEngine::DECODE_FULL:
+    c->skip_frame = AVDISCARD_DEFAULT;
+    break;
+  case RTSPDecodeEngine::DECODE_REFERENCE_FRAMES:
+    c->skip_frame = AVDISCARD_NONREF;
+    break;
+  case RTSPDecodeEngine::DECODE_KEYFRAMES:
+    c->skip_frame = AVDISCARD_NONKEY;
+    break;
+  }
+
+  int64_t decodeStartTime = monotonicTimeUS();
+  int result = avcodec_send_packet(c, &avpkt);
+  if (result == AVERROR(EAGAIN))
+  {
+    // The decoder won't take any more input until we've taken the frames that it has ready.  (We always take them all after
+    // sending a packet, so this shouldn't happen; but if it does, take them, then try again.)
+    addDecodeTime(monotonicTimeUS() - decodeStartTime);
+    receiveFrames();
+    decodeStartTime = monotonicTimeUS();
+    result = avcodec_send_packet(c, &avpkt);
+  }
+  addDecodeTime(monotonicTimeUS() - decodeStartTime);
+  if (result < 0)
+  {
+    fprintf(stderr, "Error while decoding an access unit\n");
+    ++fNumDecodeErrors;
+  }
+
+  // Deliver every frame that the decoder now has ready.  (A frame-threaded decoder - given one whole access unit per packet, so
+  // that each of its threads decodes a whole picture - may have none yet, while its threads are still working, or several.)
+  receiveFrames();
+  return result;
+}
+
+void StreamDecoder::receiveFrames()
+{
+  while (True)
+  {
+    int64_t decodeStartTime = monotonicTimeUS();
+    int result = avcodec_receive_frame(fCodecContext, fFrame);
+    addDecodeTime(monotonicTimeUS() - decodeStartTime);
+    if (result == AVERROR(EAGAIN) || result == AVERROR_EOF)
+      break; // no more frames until we send another packet (or, when flushing, no more frames at all)
+    if (result < 0)
+    {
+      fprintf(stderr, "Error while receiving a decoded frame \n");
+      ++fNumDecodeErrors;
+      break;
+    }
+
+    // Hand the frame to the application.  (It's valid only for the duration of the call, unless the callback references it.)
+    fFrame->pts = fFrame->best_effort_timestamp;
+    ++fNumFramesDecoded;
+    ++fCounters.numFramesDecoded;
+    int64_t decodedTime = wallClockTimeUS();
+    if (fFirstFrameTimeUS == 0)
+      fFirstFrameTimeUS = decodedTime;
+    fLatency.receiveToDecoded.record(decodedTime - fFrame->reordered_opaque);
+    if (fOnFrame)
+      fOnFrame(fStreamNum, fFrame);
+    RTSPDecodeEngine::AnalyticsImage image;
+    if (fThumbnailScaler != NULL && fThumbnailScaler->scale(fFrame, image))
+      fOnAnalyticsFrame(fStreamNum, image);
+    fLatency.decodedToDelivered.record(wallClockTimeUS() - decodedTime);
+    av_frame_unref(fFrame);
+  }
+}
+
+void StreamDecoder::addDecodeTime(int64_t decodeTimeUS)
+{
+  fDecodeTimeUS += decodeTimeUS;
+  fCounters.decodeTimeUS += decodeTimeUS;
+}
+
+void StreamDecoder::flush()
+{
+  // Signal the end of the stream, so that the decoder outputs the frames that it's still holding (for reordering, or in its
+  // frame threads), then deliver them:
+  if (avcodec_send_packet(fCodecContext, NULL) == 0)
+    receiveFrames();
+
+  // Then reset the decoder, so that it could be used again (from a keyframe):
+  avcodec_flush_buffers(fCodecContext);
+  resetQueue();
+}
+
+void StreamDecoder::resetQueue()
+{
+  // (A decoder that was cancelled while access units were still queued would otherwise stay 'scheduled' - and so never be
+  // handed to a worker again - if it's reused, e.g. after the stream reconnects.)
+  fAccessUnit.clear();
+  std::lock_guard<std::mutex> lock(fQueueMutex);
+  fQueueHead = fQueueLength = 0;
+  fScheduled = False;
+  fWaitingForKeyframe = True;
+}
+
+void StreamDecoder::skipToNextKeyframe()
+{
+  fAccessUnit.clear(); // (it's now incomplete)
+  std::lock_guard<std::mutex> lock(fQueueMutex);
+  fWaitingForKeyframe = True;
+}
+
+unsigned StreamDecoder::queueDepth()
+{
+  std::lock_guard<std::mutex> lock(fQueueMutex);
+  return fQueueLength;
+}
+
+Boolean StreamDecoder::admitAccessUnit()
+{
+  RTSPDecodeEngine::DecodeLevel level = decodeLevel();
+  if (level != fAdmitLevel)
+  {
+    // While only keyframes were decoded, the non-keyframe pictures that later ones reference were skipped:
+    if (fAdmitLevel == RTSPDecodeEngine::DECODE_KEYFRAMES)
+      fWaitingForKeyframe = True;
+    fAdmitLevel = level;
+  }
+  if (level == RTSPDecodeEngine::DECODE_KEYFRAMES && !fAccessUnitIsKeyframe && fAccessUnitHasNonKeyframeSlice)
+    return False; // shed (deliberately, so not counted as dropped) before it takes up a queue slot
+
+  if (!fWaitingForKeyframe)
+    return True;
+
+  // Until the next keyframe, only access units without pictures that reference earlier ones (e.g., parameter sets that were
+  // sent by themselves) are worth decoding:
+  if (fAccessUnitIsKeyframe)
+  {
+    fWaitingForKeyframe = False;
+    return True;
+  }
+  if (!fAccessUnitHasNonKeyframeSlice)
+    return True;
+
+  ++fNumDroppedAccessUnits;
+  ++fCounters.numDroppedAccessUnits;
+  return False;
+}
+
+Boolean StreamDecoder::enqueueAccessUnit()
+{
+  std::lock_guard<std::mutex> lock(fQueueMutex);
+  if (!admitAccessUnit())
+    return False;
+
+  if (fQueueLength == fQueue.size())
+  {
+    // The decoder has fallen behind.  Drop this access unit (rather than block the event loop), and resynchronize at the next IDR:
+    ++fNumDroppedAccessUnits;
+    ++fCounters.numDroppedAccessUnits;
+    ++fCounters.numQueueOverflows;
+    fWaitingForKeyframe = True;
+    return False;
+  }
+
+  // Move the (already padded) access unit into the slot - without copying it - and gather the next one in the slot's old storage:
+  unsigned slotIndex = (fQueueHead + fQueueLength) % fQueue.size();
+  fQueue[slotIndex].swap(fAccessUnit);
+  fQueuePTS[slotIndex] = fAccessUnitPTS;
+  fQueueReceiveTime[slotIndex] = fAccessUnitReceiveTime;
+  ++fQueueLength;
+
+  if (fScheduled)
+    return False;
+  fScheduled = True;
+  return True;
+}
+
+Boolean StreamDecoder::decodeQueuedAccessUnits(unsigned maxToDecode)
+{
+  for (unsigned i = 0; i < maxToDecode; ++i)
+  {
+    int64_t pts, receiveTimeUS;
+    {
+      std::lock_guard<std::mutex> lock(fQueueMutex);
+      if (fQueueLength == 0)
+        break;
+      fDecodeBuffer.swap(fQueue[fQueueHead]);
+      pts = fQueuePTS[fQueueHead];
+      receiveTimeUS = fQueueReceiveTime[fQueueHead];
+      fQueueHead = (fQueueHead + 1) % fQueue.size();
+      --fQueueLength;
+    }
+
+    decodeAccessUnit(&fDecodeBuffer[0], fDecodeBuffer.size() - AV_INPUT_BUFFER_PADDING_SIZE, pts, receiveTimeUS);
+  }
+
+  std::lock_guard<std::mutex> lock(fQueueMutex);
+  if (fQueueLength > 0)
+    return True;
+  fScheduled = False;
+  return False;
+}
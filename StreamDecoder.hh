@@ -0,0 +1,144 @@
+// A decoder for a single H.264 or H.265 video subsession, which delivers each decoded frame to the stream's frame callback.
+// C++ header
+
+#ifndef _STREAM_DECODER_HH
+#define _STREAM_DECODER_HH
+
+#include "liveMedia.hh"
+#include "RTSPDecode.hh"
+#include "H264or5ParameterSets.hh"
+#include "LatencyHistogram.hh"
+#include "ThumbnailScaler.hh"
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+#define DECODE_QUEUE_DEPTH 8  // compressed access units buffered per stream, when decoding on worker threads
+#define DECODE_WORKER_BATCH 4 // access units a worker decodes for one stream before giving other streams a turn
+
+// Define counters that are shared by all of an engine's streams (and so are updated from many threads):
+
+struct DecodeCounters
+{
+  DecodeCounters() : numFramesDecoded(0), decodeTimeUS(0), numDroppedAccessUnits(0), numTruncatedFrames(0), numQueueOverflows(0) {}
+
+  std::atomic<unsigned long long> numFramesDecoded;
+  std::atomic<unsigned long long> decodeTimeUS;
+  std::atomic<unsigned long long> numDroppedAccessUnits;
+  std::atomic<unsigned long long> numTruncatedFrames;
+  std::atomic<unsigned long long> numQueueOverflows; // access units dropped because a decode queue was full
+};
+
+class DecodeWorkerPool;
+
+// Define a class to hold the decoding state for a single video subsession.  Each "DummySink" that receives H.264 or H.265 video owns
+// one of these, so that concurrent streams never share a decoder (which would corrupt each other's reference frames).
+// The sink hands it one NAL unit at a time, as received; these are gathered into complete access units (pictures, with any
+// parameter sets and SEI that precede them), and only those are given to the decoder - as frame-threaded decoding requires.
+
+class StreamDecoder
+{
+public:
+  static StreamDecoder *createNew(UsageEnvironment &env, char const *streamId, H264or5ParameterSets const &parameterSets,
+                                  unsigned streamNum, RTSPDecodeEngine::FrameCallback const &onFrame,
+                                  DecodeCounters &counters, RTSPDecodeEngine::StreamOptions const &streamOptions);
+  // ("streamOptions.decodeThreads" must have been resolved, i.e., not 0; "parameterSets" must outlive the decoder, which may
+  // outlive the subsession that it was created for - see "CachedDecoder")
+  // returns NULL (with "env.getResultMsg()" set) if the decoder could not be opened
+  virtual ~StreamDecoder();
+
+  void addNALUnit(unsigned char const *nalUnit, unsigned size, struct timeval presentationTime, int64_t receiveTimeUS,
+                  Boolean endsAccessUnit, DecodeWorkerPool *decodeWorkerPool);
+  // called within the event loop.  "nalUnit" is preceded by a 4-byte start code (which "size" includes).  An access unit ends
+  // at a NAL unit with "endsAccessUnit" (the RTP marker bit) set, or else when a NAL unit with a new presentation time arrives.
+  // Each complete access unit is then decoded - within the event loop, or (if "decodeWorkerPool" is non-NULL) by a worker -
+  // and any frames that are ready are delivered to the frame callback
+
+  // Used when decoding is offloaded to a "DecodeWorkerPool":
+  Boolean enqueueAccessUnit();
+  // called within the event loop, to queue the access unit that has just been completed; returns True iff the stream was
+  // idle, and so now needs to be scheduled on a worker
+  Boolean decodeQueuedAccessUnits(unsigned maxToDecode);
+  // called by a worker; returns True iff there are still access units queued (and so the stream should stay scheduled)
+
+  unsigned numDroppedAccessUnits() const { return fNumDroppedAccessUnits; } // called within the event loop
+  unsigned long long numFramesDecoded() const { return fNumFramesDecoded; }     // called from any thread
+  unsigned long long numDecodeErrors() const { return fNumDecodeErrors; }       // ditto
+  int64_t firstFrameTime() const { return fFirstFrameTimeUS; } // (wall clock) when the first frame was decoded; 0 => not yet
+  void resetFirstFrameTime() { fFirstFrameTimeUS = 0; }        // called within the event loop, when the stream reconnects
+  void skipToNextKeyframe(); // called within the event loop, when an access unit has been lost (e.g., truncated)
+  void flush();
+  // called within the event loop when the stream is shutting down (and, if there's a "DecodeWorkerPool", after it has been
+  // cancelled): delivers the frames that the decoder is still holding to the frame callback, then resets the decoder (and
+  // its queue, using "resetQueue()")
+  void resetQueue();
+  // discards any queued access units (and the one that's being gathered), and marks the stream idle (so that its next access
+  // unit schedules it again).  Called within the event loop, only when no worker can be decoding the stream (e.g., after it
+  // has been cancelled)
+  StreamLatency &latency() { return fLatency; }
+
+  // Used by a "LoadShedder":
+  unsigned streamNum() const { return fStreamNum; }
+  RTSPDecodeEngine::DecodeLevel decodeLevel() const { return (RTSPDecodeEngine::DecodeLevel)fDecodeLevel.load(); } // called from any thread
+  void setDecodeLevel(RTSPDecodeEngine::DecodeLevel level) { fDecodeLevel = level; }                            // ditto
+  unsigned long long decodeTimeUS() const { return fDecodeTimeUS; }                                             // ditto
+  unsigned queueDepth(); // ditto
+
+private:
+  StreamDecoder(char const *streamId, H264or5ParameterSets const &parameterSets,
+                unsigned streamNum, RTSPDecodeEngine::FrameCallback const &onFrame, DecodeCounters &counters);
+  // called only by "createNew()"
+  Boolean decode_init(UsageEnvironment &env, RTSPDecodeEngine::StreamOptions const &streamOptions);
+  void setExtradata(UsageEnvironment &env); // builds the codec's "extradata" from the parameter sets
+  void completeAccessUnit(DecodeWorkerPool *decodeWorkerPool);
+  Boolean admitAccessUnit(); // called with "fQueueMutex" held, for the access unit that has just been completed
+  int decodeAccessUnit(unsigned char *inbuf, int read_size, int64_t pts, int64_t receiveTimeUS);
+  // "inbuf" must be followed by AV_INPUT_BUFFER_PADDING_SIZE zero bytes
+  void receiveFrames(); // delivers every frame that the decoder has ready
+  void addDecodeTime(int64_t decodeTimeUS);
+
+private:
+  char *fStreamId;
+  H264or5ParameterSets const &fParameterSets; // (also tells us whether the stream is H.264 or H.265)
+  unsigned fStreamNum; // the engine's id for the stream
+  RTSPDecodeEngine::FrameCallback fOnFrame;
+  DecodeCounters &fCounters;
+  ThumbnailScaler *fThumbnailScaler; // NULL unless the stream has analytics images
+  RTSPDecodeEngine::AnalyticsCallback fOnAnalyticsFrame;
+  AVCodec *fCodec;
+  AVCodecContext *fCodecContext;
+  AVFrame *fFrame;
+  StreamLatency fLatency;
+  std::atomic<unsigned long long> fNumFramesDecoded, fNumDecodeErrors, fDecodeTimeUS;
+  std::atomic<int> fDecodeLevel; // a "RTSPDecodeEngine::DecodeLevel"; changed by the load shedder, and applied at the next access unit
+  std::atomic<int64_t> fFirstFrameTimeUS;
+
+  // The access unit that's being gathered (within the event loop), from NAL units that all have the same presentation time.
+  // Once complete, it's padded (with AV_INPUT_BUFFER_PADDING_SIZE zero bytes) for decoding in place:
+  std::vector<unsigned char> fAccessUnit;
+  int64_t fAccessUnitPTS;
+  int64_t fAccessUnitReceiveTime; // when its last NAL unit was received
+  Boolean fAccessUnitIsKeyframe;  // it has a random access point (an IDR picture, or for H.265, any IRAP picture)
+  Boolean fAccessUnitHasNonKeyframeSlice; // it has a picture that may reference earlier ones
+
+  // The bounded queue of compressed access units (each in Annex B form, and padded for decoding in place) waiting for a decode
+  // worker.  Slots are recycled (by swapping them with "fAccessUnit", and with "fDecodeBuffer"), so their memory is reused from
+  // frame to frame:
+  std::mutex fQueueMutex;
+  std::vector<std::vector<unsigned char> > fQueue;
+  std::vector<int64_t> fQueuePTS, fQueueReceiveTime;
+  unsigned fQueueHead, fQueueLength;
+  std::vector<unsigned char> fDecodeBuffer;
+  Boolean fScheduled;          // True while the stream is queued on, or being decoded by, a worker
+  Boolean fWaitingForKeyframe; // set at first, and after losing an access unit, because (until the next keyframe) any
+                               // non-keyframe slices would reference pictures that we don't have
+  RTSPDecodeEngine::DecodeLevel fAdmitLevel; // the decode level that "admitAccessUnit()" last applied
+  unsigned fNumDroppedAccessUnits;
+};
+
+#endif
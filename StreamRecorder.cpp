@@ -0,0 +1,148 @@
+// A recorder for a single H.264 or H.265 video subsession, which writes its access units - as received, without decoding them -
+// to a series of time-limited files.
+// Implementation
+
+#include "StreamRecorder.hh"
+#include <time.h>
+
+StreamRecorder::StreamRecorder(RecordingWriter &writer, H264or5ParameterSets const &parameterSets, unsigned streamNum,
+                               RTSPDecodeEngine::StreamOptions const &streamOptions)
+    : fWriter(writer), fParameterSets(parameterSets), fRecordingId(writer.newRecordingId()), fFormat(streamOptions.recordFormat),
+      fFilePrefix(streamOptions.recordFilePrefix),
+      fSegmentDurationUS((streamOptions.recordSegmentSeconds > 0 ? streamOptions.recordSegmentSeconds : 1) * (int64_t)1000000),
+      fAccessUnitPTS(0), fAccessUnitIsKeyframe(False), fInSegment(False), fSegmentStartUS(0), fLastPTS(-1),
+      fParameterSetsChanged(False), fWaitingForKeyframe(False),
+      fNumAccessUnitsRecorded(0), fNumAccessUnitsDropped(0), fNumRecordedFiles(0)
+{
+  if (fFilePrefix.empty())
+  {
+    char prefix[30];
+    sprintf(prefix, "stream%u", streamNum);
+    fFilePrefix = prefix;
+  }
+}
+
+StreamRecorder::~StreamRecorder()
+{
+  recordAccessUnit();
+  if (fInSegment)
+    fWriter.endSegment(fRecordingId);
+}
+
+void StreamRecorder::addNALUnit(unsigned char const *nalUnit, unsigned size, struct timeval presentationTime)
+{
+  // Each access unit's NAL units all have the same presentation time, so a new presentation time begins a new access unit:
+  int64_t pts = presentationTime.tv_sec * (int64_t)1000000 + presentationTime.tv_usec;
+  if (!fAccessUnit.empty() && pts != fAccessUnitPTS)
+    recordAccessUnit();
+
+  if (fAccessUnit.empty())
+  {
+    fAccessUnitPTS = pts;
+    fAccessUnitIsKeyframe = False;
+  }
+  if (size > 4 && fParameterSets.isRandomAccessPoint(fParameterSets.nalUnitType(nalUnit + 4)))
+    fAccessUnitIsKeyframe = True;
+  fAccessUnit.insert(fAccessUnit.end(), nalUnit, nalUnit + size);
+}
+
+void StreamRecorder::parameterSetsChanged()
+{
+  fParameterSetsChanged = True;
+}
+
+void StreamRecorder::skipToNextKeyframe()
+{
+  // The access unit that's being gathered is now incomplete:
+  if (!fAccessUnit.empty())
+  {
+    fAccessUnit.clear();
+    ++fNumAccessUnitsDropped;
+  }
+  fWaitingForKeyframe = True;
+}
+
+void StreamRecorder::recordAccessUnit()
+{
+  if (fAccessUnit.empty())
+    return;
+
+  // Files start only at keyframes (so that each can be played by itself):
+  if (fAccessUnitIsKeyframe &&
+      (!fInSegment || fParameterSetsChanged || fAccessUnitPTS - fSegmentStartUS >= fSegmentDurationUS || fAccessUnitPTS < fSegmentStartUS))
+  {
+    startSegment(fAccessUnitPTS);
+  }
+  if (fAccessUnitIsKeyframe)
+    fWaitingForKeyframe = False;
+  if (!fInSegment || fWaitingForKeyframe)
+  {
+    fAccessUnit.clear();
+    ++fNumAccessUnitsDropped;
+    return;
+  }
+
+  AVPacket *packet = av_packet_alloc();
+  if (packet == NULL || av_new_packet(packet, fAccessUnit.size()) < 0)
+  {
+    av_packet_free(&packet);
+    fAccessUnit.clear();
+    ++fNumAccessUnitsDropped;
+    fWaitingForKeyframe = True;
+    return;
+  }
+  memcpy(packet->data, &fAccessUnit[0], fAccessUnit.size());
+  fAccessUnit.clear(); // (keeping its capacity, for the next access unit)
+
+  // The muxers need strictly increasing timestamps.  We don't reorder access units, so (for streams with B-frames) these are
+  // in decode order, with "dts" == "pts":
+  int64_t pts = fAccessUnitPTS - fSegmentStartUS;
+  if (fLastPTS >= 0 && pts <= fLastPTS)
+    pts = fLastPTS + 1;
+  fLastPTS = pts;
+  packet->pts = packet->dts = pts;
+  if (fAccessUnitIsKeyframe)
+    packet->flags |= AV_PKT_FLAG_KEY;
+
+  if (fWriter.write(fRecordingId, packet))
+  {
+    ++fNumAccessUnitsRecorded;
+  }
+  else
+  {
+    // The disk isn't keeping up.  Later access units would reference this one, so skip to the next keyframe:
+    ++fNumAccessUnitsDropped;
+    fWaitingForKeyframe = True;
+  }
+}
+
+void StreamRecorder::startSegment(int64_t startUS)
+{
+  // Name the file from the (wall-clock) time that it starts:
+  char timeStr[20];
+  time_t timeNow = time(NULL);
+  struct tm localTime;
+  localtime_r(&timeNow, &localTime);
+  strftime(timeStr, sizeof timeStr, "%Y%m%d-%H%M%S", &localTime);
+  std::string fileName = fFilePrefix + "-" + timeStr;
+  if (fileName == fLastFileName.substr(0, fileName.size()) && fNumRecordedFiles > 0)
+  {
+    // (The previous file started within the same second, e.g. because the parameter sets changed.)
+    char suffix[20];
+    sprintf(suffix, "-%llu", fNumRecordedFiles);
+    fileName += suffix;
+  }
+  fLastFileName = fileName;
+  fileName += fFormat == RTSPDecodeEngine::RECORD_MP4 ? ".mp4" : ".ts";
+
+  std::vector<unsigned char> extradata(fParameterSets.annexBSize());
+  if (!extradata.empty())
+    fParameterSets.copyAnnexB(&extradata[0]);
+  fWriter.startSegment(fRecordingId, fileName, fFormat, fParameterSets.hNumber(), extradata);
+
+  fInSegment = True;
+  fSegmentStartUS = startUS;
+  fLastPTS = -1;
+  fParameterSetsChanged = False;
+  ++fNumRecordedFiles;
+}
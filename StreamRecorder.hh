@@ -0,0 +1,63 @@
+// A recorder for a single H.264 or H.265 video subsession, which writes its access units - as received, without decoding them -
+// to a series of time-limited files.
+// C++ header
+
+#ifndef _STREAM_RECORDER_HH
+#define _STREAM_RECORDER_HH
+
+#include "liveMedia.hh"
+#include "RTSPDecode.hh"
+#include "H264or5ParameterSets.hh"
+#include "RecordingWriter.hh"
+#include <vector>
+#include <string>
+
+// Define a class to hold the recording state for a single video subsession.  Each "DummySink" whose stream is to be recorded owns
+// one of these.  It's used only within the stream's event loop: it gathers the received NAL units into access units, and queues
+// them - in files (segments) that each start with a keyframe - to the engine's "RecordingWriter".
+
+class StreamRecorder
+{
+public:
+  StreamRecorder(RecordingWriter &writer, H264or5ParameterSets const &parameterSets, unsigned streamNum,
+                 RTSPDecodeEngine::StreamOptions const &streamOptions);
+  // ("parameterSets" must outlive the recorder)
+  virtual ~StreamRecorder(); // queues the last access unit, and ends the current file
+
+  void addNALUnit(unsigned char const *nalUnit, unsigned size, struct timeval presentationTime);
+  // "nalUnit" is preceded by a 4-byte start code (which "size" includes)
+  void parameterSetsChanged(); // the next file is started at the next keyframe (so that it has the new parameter sets)
+  void skipToNextKeyframe();   // called when a NAL unit has been lost (e.g., truncated)
+
+  unsigned long long numAccessUnitsRecorded() const { return fNumAccessUnitsRecorded; }
+  unsigned long long numAccessUnitsDropped() const { return fNumAccessUnitsDropped; } // before the first keyframe, or refused
+  unsigned long long numRecordedFiles() const { return fNumRecordedFiles; }
+
+private:
+  void recordAccessUnit();
+  void startSegment(int64_t startUS);
+
+private:
+  RecordingWriter &fWriter;
+  H264or5ParameterSets const &fParameterSets;
+  unsigned fRecordingId;
+  RTSPDecodeEngine::RecordFormat fFormat;
+  std::string fFilePrefix;
+  int64_t fSegmentDurationUS;
+  // The access unit that's being gathered (all of whose NAL units have the same presentation time):
+  std::vector<unsigned char> fAccessUnit;
+  int64_t fAccessUnitPTS;
+  Boolean fAccessUnitIsKeyframe;
+  // The current file:
+  Boolean fInSegment;
+  int64_t fSegmentStartUS; // the presentation time of its first (key)frame
+  int64_t fLastPTS;        // the timestamp (relative to "fSegmentStartUS") of the last access unit written to it
+  std::string fLastFileName;
+  Boolean fParameterSetsChanged;
+  Boolean fWaitingForKeyframe; // set after losing a NAL unit, or if the writer refused an access unit
+  unsigned long long fNumAccessUnitsRecorded;
+  unsigned long long fNumAccessUnitsDropped;
+  unsigned long long fNumRecordedFiles;
+};
+
+#endif
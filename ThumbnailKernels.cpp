@@ -0,0 +1,392 @@
+// Vectorized kernels for making small BGR copies of decoded frames (e.g., for analytics): fixed-ratio downscaling of a plane,
+// and YUV 4:2:0 to BGR24 conversion.
+// Implementation
+
+#include "ThumbnailKernels.hh"
+#include <string.h>
+
+// The YUV->BGR coefficients (BT.601), in fixed point with 6 fractional bits.  They're small enough that every product fits in
+// 16 bits, so the vector kernels can work on 8 (SSE4) or 16 (AVX2) pixels at a time:
+struct YUVCoefficients
+{
+  int yOffset, y, vr, ug, vg, ub;
+};
+static YUVCoefficients const limitedRangeCoefficients = {16, 75, 102, 25, 52, 129}; // 1.164, 1.596, 0.391, 0.813, 2.018
+static YUVCoefficients const fullRangeCoefficients = {0, 64, 90, 22, 46, 113};      // 1.0, 1.402, 0.344, 0.714, 1.772
+
+// Scalar kernels (which also handle whatever is left over at the end of each row by the vector kernels).  They saturate at
+// 16 bits just where the vector kernels do, so that their results are identical:
+
+static inline int adds16(int a, int b)
+{
+  int sum = a + b;
+  return sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum;
+}
+
+static inline uint8_t clampToByte(int value)
+{
+  return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static inline void sumRowsScalar(uint8_t const *srcRow, int srcStride, unsigned factor, int from, int to, uint16_t *rowSums)
+{
+  for (int x = from; x < to; ++x)
+  {
+    unsigned sum = 0;
+    for (unsigned k = 0; k < factor; ++k)
+    {
+      sum += srcRow[(int)k * srcStride + x];
+    }
+    rowSums[x] = sum;
+  }
+}
+
+static inline void averageColumnsScalar(uint16_t const *rowSums, unsigned factor, int from, int to,
+                                        unsigned half, unsigned reciprocal, uint8_t *dstRow)
+{
+  for (int x = from; x < to; ++x)
+  {
+    unsigned sum = 0;
+    for (unsigned j = 0; j < factor; ++j)
+    {
+      sum += rowSums[x * factor + j];
+    }
+    // The rounded average.  (Multiplying by a 16-bit reciprocal, as the vector kernels must, makes this 1 too high, now and
+    // then, for factors that aren't powers of 2 - and, for some large factors, more than 255 for a white block, so it's
+    // saturated, as the vector kernels' results are.)
+    dstRow[x] = clampToByte(((sum + half) * reciprocal) >> 16);
+  }
+}
+
+static void boxDownscaleScalar(uint8_t const *src, int srcStride, uint8_t *dst, int dstStride, int dstWidth, int dstHeight,
+                               unsigned factor, uint16_t *rowSums)
+{
+  if (factor == 1)
+  {
+    for (int y = 0; y < dstHeight; ++y)
+    {
+      memcpy(dst + y * dstStride, src + y * srcStride, dstWidth);
+    }
+    return;
+  }
+
+  unsigned area = factor * factor, half = area / 2, reciprocal = (65536 + area - 1) / area;
+  for (int y = 0; y < dstHeight; ++y)
+  {
+    sumRowsScalar(src + y * (int)factor * srcStride, srcStride, factor, 0, dstWidth * factor, rowSums);
+    averageColumnsScalar(rowSums, factor, 0, dstWidth, half, reciprocal, dst + y * dstStride);
+  }
+}
+
+static inline void yuv420ToBGRRowScalar(uint8_t const *yRow, uint8_t const *uRow, uint8_t const *vRow, uint8_t *bgrRow,
+                                        int from, int to, YUVCoefficients const &k)
+{
+  for (int x = from; x < to; ++x)
+  {
+    int yy = (yRow[x] - k.yOffset) * k.y;
+    int u = uRow[x / 2] - 128, v = vRow[x / 2] - 128;
+    bgrRow[3 * x] = clampToByte(adds16(adds16(yy, u * k.ub), 32) >> 6);
+    bgrRow[3 * x + 1] = clampToByte(adds16(adds16(adds16(yy, -(u * k.ug)), -(v * k.vg)), 32) >> 6);
+    bgrRow[3 * x + 2] = clampToByte(adds16(adds16(yy, v * k.vr), 32) >> 6);
+  }
+}
+
+static void yuv420ToBGRScalar(uint8_t const *y, int yStride, uint8_t const *u, int uStride, uint8_t const *v, int vStride,
+                              uint8_t *bgr, int bgrStride, int width, int height, bool fullRange)
+{
+  YUVCoefficients const &k = fullRange ? fullRangeCoefficients : limitedRangeCoefficients;
+  for (int row = 0; row < height; ++row)
+  {
+    yuv420ToBGRRowScalar(y + row * yStride, u + (row / 2) * uStride, v + (row / 2) * vStride, bgr + row * bgrStride,
+                         0, width, k);
+  }
+}
+
+ThumbnailKernels const &scalarThumbnailKernels()
+{
+  static ThumbnailKernels const kernels = {"scalar", boxDownscaleScalar, yuv420ToBGRScalar};
+  return kernels;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// x86 vector kernels.  Each is compiled for its own instruction set (so the rest of the library needn't be), and is used
+// only if the CPU that we're running on turns out to support it.
+
+#include <immintrin.h>
+
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+// The shuffle masks that gather the column sums making up each output pixel into its own 16-bit lane: "masks[k][j]" picks,
+// from the "k"th vector of 8 column sums, the "j"th sum of each output pixel (if it's in that vector):
+static void buildColumnGatherMasks(unsigned factor, uint8_t masks[THUMBNAIL_MAX_SIMD_FACTOR][THUMBNAIL_MAX_SIMD_FACTOR][16])
+{
+  for (unsigned k = 0; k < factor; ++k)
+  {
+    for (unsigned j = 0; j < factor; ++j)
+    {
+      for (unsigned lane = 0; lane < 8; ++lane)
+      {
+        unsigned column = lane * factor + j;
+        bool inVector = column >= 8 * k && column < 8 * k + 8;
+        masks[k][j][2 * lane] = inVector ? 2 * (column - 8 * k) : 0x80;
+        masks[k][j][2 * lane + 1] = inVector ? 2 * (column - 8 * k) + 1 : 0x80;
+      }
+    }
+  }
+}
+
+// The shuffle masks that interleave 16 B, G and R bytes into 48 bytes of BGR24: "masks[c][channel]" makes the "c"th 16 bytes:
+static void buildBGRInterleaveMasks(uint8_t masks[3][3][16])
+{
+  for (unsigned c = 0; c < 3; ++c)
+  {
+    for (unsigned channel = 0; channel < 3; ++channel)
+    {
+      for (unsigned i = 0; i < 16; ++i)
+      {
+        unsigned byte = 16 * c + i;
+        masks[c][channel][i] = byte % 3 == channel ? byte / 3 : 0x80;
+      }
+    }
+  }
+}
+
+TARGET_SSE4 static inline void sumRowsSSE4(uint8_t const *srcRow, int srcStride, unsigned factor, int srcWidth, uint16_t *rowSums)
+{
+  int x = 0;
+  for (; x + 16 <= srcWidth; x += 16)
+  {
+    __m128i pixels = _mm_loadu_si128((__m128i const *)(srcRow + x));
+    __m128i lo = _mm_cvtepu8_epi16(pixels), hi = _mm_cvtepu8_epi16(_mm_srli_si128(pixels, 8));
+    for (unsigned k = 1; k < factor; ++k)
+    {
+      pixels = _mm_loadu_si128((__m128i const *)(srcRow + (int)k * srcStride + x));
+      lo = _mm_add_epi16(lo, _mm_cvtepu8_epi16(pixels));
+      hi = _mm_add_epi16(hi, _mm_cvtepu8_epi16(_mm_srli_si128(pixels, 8)));
+    }
+    _mm_storeu_si128((__m128i *)(rowSums + x), lo);
+    _mm_storeu_si128((__m128i *)(rowSums + x + 8), hi);
+  }
+  sumRowsScalar(srcRow, srcStride, factor, x, srcWidth, rowSums);
+}
+
+TARGET_AVX2 static inline void sumRowsAVX2(uint8_t const *srcRow, int srcStride, unsigned factor, int srcWidth, uint16_t *rowSums)
+{
+  int x = 0;
+  for (; x + 32 <= srcWidth; x += 32)
+  {
+    __m256i pixels = _mm256_loadu_si256((__m256i const *)(srcRow + x));
+    __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels));
+    __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels, 1));
+    for (unsigned k = 1; k < factor; ++k)
+    {
+      pixels = _mm256_loadu_si256((__m256i const *)(srcRow + (int)k * srcStride + x));
+      lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels)));
+      hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels, 1)));
+    }
+    _mm256_storeu_si256((__m256i *)(rowSums + x), lo);
+    _mm256_storeu_si256((__m256i *)(rowSums + x + 16), hi);
+  }
+  sumRowsScalar(srcRow, srcStride, factor, x, srcWidth, rowSums);
+}
+
+// (Also used by the AVX2 kernel: gathering columns across 256-bit lanes would gain little.)
+TARGET_SSE4 static inline void averageColumnsSSE4(uint16_t const *rowSums, unsigned factor, int dstWidth, unsigned half,
+                                                  unsigned reciprocal, uint8_t const masks[][THUMBNAIL_MAX_SIMD_FACTOR][16],
+                                                  uint8_t *dstRow)
+{
+  __m128i halfVector = _mm_set1_epi16(half), reciprocalVector = _mm_set1_epi16(reciprocal);
+  int x = 0;
+  for (; x + 8 <= dstWidth; x += 8)
+  {
+    uint16_t const *columns = rowSums + x * factor; // the 8 output pixels' "8*factor" column sums
+    __m128i sum = _mm_setzero_si128();
+    for (unsigned k = 0; k < factor; ++k)
+    {
+      __m128i columnSums = _mm_loadu_si128((__m128i const *)(columns + 8 * k));
+      for (unsigned j = 0; j < factor; ++j)
+      {
+        sum = _mm_add_epi16(sum, _mm_shuffle_epi8(columnSums, _mm_loadu_si128((__m128i const *)masks[k][j])));
+      }
+    }
+    __m128i average = _mm_mulhi_epu16(_mm_add_epi16(sum, halfVector), reciprocalVector);
+    _mm_storel_epi64((__m128i *)(dstRow + x), _mm_packus_epi16(average, average));
+  }
+  averageColumnsScalar(rowSums, factor, x, dstWidth, half, reciprocal, dstRow);
+}
+
+TARGET_SSE4 static void boxDownscaleSSE4(uint8_t const *src, int srcStride, uint8_t *dst, int dstStride, int dstWidth, int dstHeight,
+                                         unsigned factor, uint16_t *rowSums)
+{
+  if (factor == 1 || factor > THUMBNAIL_MAX_SIMD_FACTOR)
+  {
+    boxDownscaleScalar(src, srcStride, dst, dstStride, dstWidth, dstHeight, factor, rowSums);
+    return;
+  }
+
+  uint8_t masks[THUMBNAIL_MAX_SIMD_FACTOR][THUMBNAIL_MAX_SIMD_FACTOR][16];
+  buildColumnGatherMasks(factor, masks);
+  unsigned area = factor * factor, half = area / 2, reciprocal = (65536 + area - 1) / area;
+  for (int y = 0; y < dstHeight; ++y)
+  {
+    sumRowsSSE4(src + y * (int)factor * srcStride, srcStride, factor, dstWidth * factor, rowSums);
+    averageColumnsSSE4(rowSums, factor, dstWidth, half, reciprocal, masks, dst + y * dstStride);
+  }
+}
+
+TARGET_AVX2 static void boxDownscaleAVX2(uint8_t const *src, int srcStride, uint8_t *dst, int dstStride, int dstWidth, int dstHeight,
+                                         unsigned factor, uint16_t *rowSums)
+{
+  if (factor == 1 || factor > THUMBNAIL_MAX_SIMD_FACTOR)
+  {
+    boxDownscaleScalar(src, srcStride, dst, dstStride, dstWidth, dstHeight, factor, rowSums);
+    return;
+  }
+
+  uint8_t masks[THUMBNAIL_MAX_SIMD_FACTOR][THUMBNAIL_MAX_SIMD_FACTOR][16];
+  buildColumnGatherMasks(factor, masks);
+  unsigned area = factor * factor, half = area / 2, reciprocal = (65536 + area - 1) / area;
+  for (int y = 0; y < dstHeight; ++y)
+  {
+    sumRowsAVX2(src + y * (int)factor * srcStride, srcStride, factor, dstWidth * factor, rowSums);
+    averageColumnsSSE4(rowSums, factor, dstWidth, half, reciprocal, masks, dst + y * dstStride);
+  }
+}
+
+TARGET_SSE4 static inline void storeBGRSSE4(uint8_t *out, __m128i b, __m128i g, __m128i r, uint8_t const masks[3][3][16])
+{
+  for (unsigned c = 0; c < 3; ++c)
+  {
+    __m128i bgr = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, _mm_loadu_si128((__m128i const *)masks[c][0])),
+                                            _mm_shuffle_epi8(g, _mm_loadu_si128((__m128i const *)masks[c][1]))),
+                               _mm_shuffle_epi8(r, _mm_loadu_si128((__m128i const *)masks[c][2])));
+    _mm_storeu_si128((__m128i *)(out + 16 * c), bgr);
+  }
+}
+
+// Converts 8 pixels (as 16-bit lanes), just as "yuv420ToBGRRowScalar()" does:
+TARGET_SSE4 static inline void yuvToBGRSSE4(__m128i y, __m128i u, __m128i v, YUVCoefficients const &k,
+                                            __m128i &b, __m128i &g, __m128i &r)
+{
+  __m128i chromaOffset = _mm_set1_epi16(128), rounding = _mm_set1_epi16(32);
+  y = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(k.yOffset)), _mm_set1_epi16(k.y));
+  u = _mm_sub_epi16(u, chromaOffset);
+  v = _mm_sub_epi16(v, chromaOffset);
+  b = _mm_adds_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(k.ub))), rounding);
+  g = _mm_adds_epi16(_mm_subs_epi16(_mm_subs_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(k.ug))),
+                                    _mm_mullo_epi16(v, _mm_set1_epi16(k.vg))),
+                     rounding);
+  r = _mm_adds_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(k.vr))), rounding);
+  b = _mm_srai_epi16(b, 6);
+  g = _mm_srai_epi16(g, 6);
+  r = _mm_srai_epi16(r, 6);
+}
+
+// Likewise, for 16 pixels:
+TARGET_AVX2 static inline void yuvToBGRAVX2(__m256i y, __m256i u, __m256i v, YUVCoefficients const &k,
+                                            __m256i &b, __m256i &g, __m256i &r)
+{
+  __m256i chromaOffset = _mm256_set1_epi16(128), rounding = _mm256_set1_epi16(32);
+  y = _mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(k.yOffset)), _mm256_set1_epi16(k.y));
+  u = _mm256_sub_epi16(u, chromaOffset);
+  v = _mm256_sub_epi16(v, chromaOffset);
+  b = _mm256_adds_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(k.ub))), rounding);
+  g = _mm256_adds_epi16(_mm256_subs_epi16(_mm256_subs_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(k.ug))),
+                                          _mm256_mullo_epi16(v, _mm256_set1_epi16(k.vg))),
+                        rounding);
+  r = _mm256_adds_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, _mm256_set1_epi16(k.vr))), rounding);
+  b = _mm256_srai_epi16(b, 6);
+  g = _mm256_srai_epi16(g, 6);
+  r = _mm256_srai_epi16(r, 6);
+}
+
+TARGET_SSE4 static void yuv420ToBGRSSE4(uint8_t const *y, int yStride, uint8_t const *u, int uStride, uint8_t const *v, int vStride,
+                                        uint8_t *bgr, int bgrStride, int width, int height, bool fullRange)
+{
+  YUVCoefficients const &k = fullRange ? fullRangeCoefficients : limitedRangeCoefficients;
+  uint8_t masks[3][3][16];
+  buildBGRInterleaveMasks(masks);
+  for (int row = 0; row < height; ++row)
+  {
+    uint8_t const *yRow = y + row * yStride, *uRow = u + (row / 2) * uStride, *vRow = v + (row / 2) * vStride;
+    uint8_t *bgrRow = bgr + row * bgrStride;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      // 16 luma samples, and the 8 chroma samples that they share (each duplicated, for its 2 pixels):
+      __m128i luma = _mm_loadu_si128((__m128i const *)(yRow + x));
+      __m128i cb = _mm_loadl_epi64((__m128i const *)(uRow + x / 2)), cr = _mm_loadl_epi64((__m128i const *)(vRow + x / 2));
+      cb = _mm_unpacklo_epi8(cb, cb);
+      cr = _mm_unpacklo_epi8(cr, cr);
+
+      __m128i bLo, gLo, rLo, bHi, gHi, rHi;
+      yuvToBGRSSE4(_mm_cvtepu8_epi16(luma), _mm_cvtepu8_epi16(cb), _mm_cvtepu8_epi16(cr), k, bLo, gLo, rLo);
+      yuvToBGRSSE4(_mm_cvtepu8_epi16(_mm_srli_si128(luma, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(cb, 8)),
+                   _mm_cvtepu8_epi16(_mm_srli_si128(cr, 8)), k, bHi, gHi, rHi);
+      storeBGRSSE4(bgrRow + 3 * x, _mm_packus_epi16(bLo, bHi), _mm_packus_epi16(gLo, gHi), _mm_packus_epi16(rLo, rHi), masks);
+    }
+    yuv420ToBGRRowScalar(yRow, uRow, vRow, bgrRow, x, width, k);
+  }
+}
+
+TARGET_AVX2 static void yuv420ToBGRAVX2(uint8_t const *y, int yStride, uint8_t const *u, int uStride, uint8_t const *v, int vStride,
+                                        uint8_t *bgr, int bgrStride, int width, int height, bool fullRange)
+{
+  YUVCoefficients const &k = fullRange ? fullRangeCoefficients : limitedRangeCoefficients;
+  uint8_t masks[3][3][16];
+  buildBGRInterleaveMasks(masks);
+  for (int row = 0; row < height; ++row)
+  {
+    uint8_t const *yRow = y + row * yStride, *uRow = u + (row / 2) * uStride, *vRow = v + (row / 2) * vStride;
+    uint8_t *bgrRow = bgr + row * bgrStride;
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+      // 32 luma samples, and the 16 chroma samples that they share:
+      __m256i luma = _mm256_loadu_si256((__m256i const *)(yRow + x));
+      __m128i cb = _mm_loadu_si128((__m128i const *)(uRow + x / 2)), cr = _mm_loadu_si128((__m128i const *)(vRow + x / 2));
+      for (unsigned half = 0; half < 2; ++half)
+      {
+        __m128i halfLuma = half == 0 ? _mm256_castsi256_si128(luma) : _mm256_extracti128_si256(luma, 1);
+        __m128i halfCb = half == 0 ? _mm_unpacklo_epi8(cb, cb) : _mm_unpackhi_epi8(cb, cb);
+        __m128i halfCr = half == 0 ? _mm_unpacklo_epi8(cr, cr) : _mm_unpackhi_epi8(cr, cr);
+
+        __m256i b, g, r;
+        yuvToBGRAVX2(_mm256_cvtepu8_epi16(halfLuma), _mm256_cvtepu8_epi16(halfCb), _mm256_cvtepu8_epi16(halfCr), k, b, g, r);
+        storeBGRSSE4(bgrRow + 3 * (x + 16 * half),
+                     _mm_packus_epi16(_mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1)),
+                     _mm_packus_epi16(_mm256_castsi256_si128(g), _mm256_extracti128_si256(g, 1)),
+                     _mm_packus_epi16(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)), masks);
+      }
+    }
+    yuv420ToBGRRowScalar(yRow, uRow, vRow, bgrRow, x, width, k);
+  }
+}
+
+ThumbnailKernels const *sse4ThumbnailKernels()
+{
+  static ThumbnailKernels const kernels = {"sse4", boxDownscaleSSE4, yuv420ToBGRSSE4};
+  return __builtin_cpu_supports("sse4.1") ? &kernels : NULL;
+}
+
+ThumbnailKernels const *avx2ThumbnailKernels()
+{
+  static ThumbnailKernels const kernels = {"avx2", boxDownscaleAVX2, yuv420ToBGRAVX2};
+  return __builtin_cpu_supports("avx2") ? &kernels : NULL;
+}
+
+#else
+
+ThumbnailKernels const *sse4ThumbnailKernels()
+{
+  return NULL;
+}
+
+ThumbnailKernels const *avx2ThumbnailKernels()
+{
+  return NULL;
+}
+
+#endif
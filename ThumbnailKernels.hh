@@ -0,0 +1,32 @@
+// Vectorized kernels for making small BGR copies of decoded frames (e.g., for analytics): fixed-ratio downscaling of a plane,
+// and YUV 4:2:0 to BGR24 conversion.
+// C++ header
+
+#ifndef _THUMBNAIL_KERNELS_HH
+#define _THUMBNAIL_KERNELS_HH
+
+#include <stdint.h>
+
+#define THUMBNAIL_MAX_SIMD_FACTOR 8 // larger downscaling factors always use the scalar kernel
+
+// Define the kernels that one instruction set provides.  Each set gives exactly the same results as the others (the vector
+// kernels use the same fixed-point arithmetic as the scalar ones), so they can be compared, and swapped freely:
+//   "boxDownscale()" averages each "factor" x "factor" block of "src" into one pixel of "dst".  (Only the top-left
+//     "dstWidth*factor" x "dstHeight*factor" pixels of "src" are used.)  "rowSums" must have room for "dstWidth*factor" values.
+//   "yuv420ToBGR()" converts a "width" x "height" (both even) 4:2:0 image to packed BGR24, using BT.601 coefficients, for
+//     either limited-range ("studio swing") or - if "fullRange" - full-range (e.g., YUVJ420P) input.
+
+struct ThumbnailKernels
+{
+  char const *name;
+  void (*boxDownscale)(uint8_t const *src, int srcStride, uint8_t *dst, int dstStride, int dstWidth, int dstHeight,
+                       unsigned factor, uint16_t *rowSums);
+  void (*yuv420ToBGR)(uint8_t const *y, int yStride, uint8_t const *u, int uStride, uint8_t const *v, int vStride,
+                      uint8_t *bgr, int bgrStride, int width, int height, bool fullRange);
+};
+
+ThumbnailKernels const &scalarThumbnailKernels();
+ThumbnailKernels const *sse4ThumbnailKernels(); // NULL unless this is a x86 CPU with SSE4.1
+ThumbnailKernels const *avx2ThumbnailKernels(); // NULL unless this is a x86 CPU with AVX2
+
+#endif
@@ -0,0 +1,86 @@
+// Makes a stream's analytics images: small BGR copies of its decoded frames.
+// Implementation
+
+#include "ThumbnailScaler.hh"
+
+ThumbnailScaler::ThumbnailScaler(unsigned width, unsigned height, RTSPDecodeEngine::AnalyticsScaler scaler)
+    : fWidth(width & ~1u), fHeight(height & ~1u), fScaler(scaler), fKernels(NULL), fSwsContext(NULL),
+      fY(fWidth * fHeight), fU(fWidth * fHeight / 4), fV(fWidth * fHeight / 4), fBGR(3 * fWidth * fHeight)
+{
+  ThumbnailKernels const *avx2 = avx2ThumbnailKernels();
+  ThumbnailKernels const *sse4 = sse4ThumbnailKernels();
+  if ((fScaler == RTSPDecodeEngine::ANALYTICS_SCALER_AUTO || fScaler == RTSPDecodeEngine::ANALYTICS_SCALER_AVX2) && avx2 != NULL)
+  {
+    fScaler = RTSPDecodeEngine::ANALYTICS_SCALER_AVX2;
+    fKernels = avx2;
+  }
+  else if ((fScaler == RTSPDecodeEngine::ANALYTICS_SCALER_AUTO || fScaler == RTSPDecodeEngine::ANALYTICS_SCALER_SSE4) && sse4 != NULL)
+  {
+    fScaler = RTSPDecodeEngine::ANALYTICS_SCALER_SSE4;
+    fKernels = sse4;
+  }
+  else if (fScaler != RTSPDecodeEngine::ANALYTICS_SCALER_SWSCALE)
+  {
+    // (This includes an explicit choice of SSE4 or AVX2 that this CPU can't run:)
+    fScaler = RTSPDecodeEngine::ANALYTICS_SCALER_SCALAR;
+    fKernels = &scalarThumbnailKernels();
+  }
+}
+
+ThumbnailScaler::~ThumbnailScaler()
+{
+  sws_freeContext(fSwsContext);
+}
+
+char const *ThumbnailScaler::scalerName() const
+{
+  return fKernels != NULL ? fKernels->name : "swscale";
+}
+
+bool ThumbnailScaler::scale(AVFrame const *frame, RTSPDecodeEngine::AnalyticsImage &image)
+{
+  if (fWidth == 0 || fHeight == 0)
+    return false;
+
+  bool scaled;
+  // (Only exact multiples, because the kernels would crop anything else - where libswscale scales the whole frame:)
+  unsigned factor = frame->width / fWidth;
+  if (fKernels != NULL && factor >= 1 && (unsigned)frame->width == factor * fWidth && (unsigned)frame->height == factor * fHeight &&
+      (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P))
+    scaled = scaleWithKernels(frame, factor);
+  else
+    scaled = scaleWithSwscale(frame);
+  if (!scaled)
+    return false;
+
+  image.bgr = &fBGR[0];
+  image.width = fWidth;
+  image.height = fHeight;
+  image.stride = 3 * fWidth;
+  image.pts = frame->pts;
+  return true;
+}
+
+bool ThumbnailScaler::scaleWithKernels(AVFrame const *frame, unsigned factor)
+{
+  fRowSums.resize(fWidth * factor);
+  fKernels->boxDownscale(frame->data[0], frame->linesize[0], &fY[0], fWidth, fWidth, fHeight, factor, &fRowSums[0]);
+  fKernels->boxDownscale(frame->data[1], frame->linesize[1], &fU[0], fWidth / 2, fWidth / 2, fHeight / 2, factor, &fRowSums[0]);
+  fKernels->boxDownscale(frame->data[2], frame->linesize[2], &fV[0], fWidth / 2, fWidth / 2, fHeight / 2, factor, &fRowSums[0]);
+  fKernels->yuv420ToBGR(&fY[0], fWidth, &fU[0], fWidth / 2, &fV[0], fWidth / 2, &fBGR[0], 3 * fWidth, fWidth, fHeight,
+                        frame->format == AV_PIX_FMT_YUVJ420P);
+  return true;
+}
+
+bool ThumbnailScaler::scaleWithSwscale(AVFrame const *frame)
+{
+  fSwsContext = sws_getCachedContext(fSwsContext, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                     fWidth, fHeight, AV_PIX_FMT_BGR24, SWS_BILINEAR, NULL, NULL, NULL);
+  if (fSwsContext == NULL)
+    return false;
+
+  uint8_t *dst[1] = {&fBGR[0]};
+  int dstStride[1] = {(int)(3 * fWidth)};
+  sws_scale(fSwsContext, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+  return true;
+}
@@ -0,0 +1,49 @@
+// Makes a stream's analytics images: small BGR copies of its decoded frames.
+// C++ header
+
+#ifndef _THUMBNAIL_SCALER_HH
+#define _THUMBNAIL_SCALER_HH
+
+#include "RTSPDecode.hh"
+#include "ThumbnailKernels.hh"
+#include <vector>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+#include "libswscale/swscale.h"
+}
+
+// Define a class that downscales frames to a fixed size, and converts them to BGR24.  A frame whose size is an exact
+// multiple ("factor") of the output size in both directions - e.g., 1920x1080 or 1280x720 to 640x360 - and whose format is
+// YUV420P (or YUVJ420P) is box-filtered, then converted, by our own "ThumbnailKernels"; other frames (e.g., 1920x1080 to
+// 600x360, which the kernels would have to crop), and all frames if ANALYTICS_SCALER_SWSCALE was chosen, use libswscale instead.  The output buffers are allocated once, and reused.
+
+class ThumbnailScaler
+{
+public:
+  ThumbnailScaler(unsigned width, unsigned height, RTSPDecodeEngine::AnalyticsScaler scaler);
+  // "width" and "height" are rounded down to even; "scaler" is resolved to one that this CPU supports (see "scaler()")
+  virtual ~ThumbnailScaler();
+
+  RTSPDecodeEngine::AnalyticsScaler scaler() const { return fScaler; } // never ANALYTICS_SCALER_AUTO
+  char const *scalerName() const;
+
+  bool scale(AVFrame const *frame, RTSPDecodeEngine::AnalyticsImage &image);
+  // returns false (leaving "image" unchanged) if the frame couldn't be converted.  "image" is valid until the next call
+
+private:
+  bool scaleWithKernels(AVFrame const *frame, unsigned factor);
+  bool scaleWithSwscale(AVFrame const *frame);
+
+private:
+  unsigned fWidth, fHeight;
+  RTSPDecodeEngine::AnalyticsScaler fScaler;
+  ThumbnailKernels const *fKernels; // NULL iff "fScaler" is ANALYTICS_SCALER_SWSCALE
+  struct SwsContext *fSwsContext;   // created only if needed
+  std::vector<uint8_t> fY, fU, fV;  // the downscaled planes
+  std::vector<uint16_t> fRowSums;
+  std::vector<uint8_t> fBGR;
+};
+
+#endif
@@ -0,0 +1,186 @@
+// A self-contained throughput benchmark for "librtspdecode".  It serves one or more H.264 or H.265 elementary stream files from a
+// LIVE555 "RTSPServer" on the loopback interface (in its own thread), then - for each transport (RTP/UDP, then RTP-over-TCP),
+// and for K = 1, 2, 4, ..., up to the maximum number of streams - opens K streams from it, and reports their aggregate decode
+// rate, the decode time per frame, the CPU time used per stream, the frames dropped and truncated, and the process's memory.
+// Everything runs offline, on one machine.
+
+#include "RTSPDecode.hh"
+#include "liveMedia.hh"
+#include "BasicUsageEnvironment.hh"
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <sys/resource.h>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+}
+
+#define BENCH_DEFAULT_PORT 8554
+#define BENCH_DEFAULT_MAX_STREAMS 64
+#define BENCH_DEFAULT_WARMUP_SECONDS 2   // let the streams connect, and reach their first keyframe, before measuring
+#define BENCH_DEFAULT_MEASURE_SECONDS 10
+
+static char volatile serverWatchVariable = 0;
+
+// Runs the RTSP server's event loop (in its own thread):
+static void runServer(UsageEnvironment *env)
+{
+  env->taskScheduler().doEventLoop(&serverWatchVariable);
+}
+
+static double cpuSeconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Returns the process's resident set size, in kB (or 0, if it can't be read):
+static unsigned long residentSetKB()
+{
+  FILE *fid = fopen("/proc/self/status", "r");
+  if (fid == NULL)
+    return 0;
+  char line[256];
+  unsigned long kB = 0;
+  while (fgets(line, sizeof line, fid) != NULL)
+  {
+    if (sscanf(line, "VmRSS: %lu kB", &kB) == 1)
+      break;
+  }
+  fclose(fid);
+  return kB;
+}
+
+static void usage(char const *progName)
+{
+  fprintf(stderr, "Usage: %s [-p <port>] [-k <max-streams>] [-w <num-decode-workers>] [-s <num-event-loops>] "
+                  "[-d <seconds-per-run>] [-f] [-b <decode-thread-budget>] <file-1.264> ... <file-N.264>\n",
+          progName);
+  fprintf(stderr, "\t(the files should each play for longer than the warm-up and measurement periods combined;\n"
+                  "\t files whose names end in \".265\" or \".h265\" are served as H.265)\n");
+}
+
+int main(int argc, char **argv)
+{
+  portNumBits port = BENCH_DEFAULT_PORT;
+  unsigned maxStreams = BENCH_DEFAULT_MAX_STREAMS;
+  unsigned measureSeconds = BENCH_DEFAULT_MEASURE_SECONDS;
+  RTSPDecodeEngine::Options options;
+  options.verbosityLevel = 0;
+  options.applicationName = argv[0];
+  RTSPDecodeEngine::StreamOptions streamOptions;
+
+  int firstFile = 1;
+  while (firstFile + 1 < argc && argv[firstFile][0] == '-')
+  {
+    if (strcmp(argv[firstFile], "-f") == 0)
+    {
+      streamOptions.decodeThreading = RTSPDecodeEngine::DECODE_THREADING_THROUGHPUT; // decode with frame threads
+      ++firstFile;
+      continue;
+    }
+    char const *value = argv[firstFile + 1];
+    if (strcmp(argv[firstFile], "-p") == 0)
+      port = (portNumBits)atoi(value);
+    else if (strcmp(argv[firstFile], "-k") == 0)
+      maxStreams = (unsigned)atoi(value);
+    else if (strcmp(argv[firstFile], "-w") == 0)
+      options.numDecodeWorkers = atoi(value);
+    else if (strcmp(argv[firstFile], "-s") == 0)
+      options.numEventLoops = (unsigned)atoi(value);
+    else if (strcmp(argv[firstFile], "-d") == 0)
+      measureSeconds = (unsigned)atoi(value);
+    else if (strcmp(argv[firstFile], "-b") == 0)
+      options.decodeThreadBudget = (unsigned)atoi(value);
+    else
+      break;
+    firstFile += 2;
+  }
+  if (firstFile >= argc || argv[firstFile][0] == '-' || maxStreams == 0 || measureSeconds == 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Set up the server, in its own event loop:
+  TaskScheduler *serverScheduler = BasicTaskScheduler::createNew();
+  UsageEnvironment *serverEnv = BasicUsageEnvironment::createNew(*serverScheduler);
+  OutPacketBuffer::maxSize = 2000000; // big enough for a high-resolution IDR frame
+  RTSPServer *server = RTSPServer::createNew(*serverEnv, port, NULL);
+  if (server == NULL)
+  {
+    fprintf(stderr, "Failed to create a RTSP server on port %u: %s\n", port, serverEnv->getResultMsg());
+    return 1;
+  }
+  std::vector<std::string> urls; // each file is served as "stream<i>"
+  for (int i = firstFile; i < argc; ++i)
+  {
+    char streamName[32];
+    snprintf(streamName, sizeof streamName, "stream%d", i - firstFile);
+    ServerMediaSession *sms = ServerMediaSession::createNew(*serverEnv, streamName, argv[i], "librtspdecode benchmark");
+    // Each of a file's clients gets its own copy of the stream (so that all of them start at its first keyframe):
+    char const *extension = strrchr(argv[i], '.');
+    if (extension != NULL && (strcmp(extension, ".265") == 0 || strcmp(extension, ".h265") == 0))
+      sms->addSubsession(H265VideoFileServerMediaSubsession::createNew(*serverEnv, argv[i], False));
+    else
+      sms->addSubsession(H264VideoFileServerMediaSubsession::createNew(*serverEnv, argv[i], False));
+    server->addServerMediaSession(sms);
+
+    char url[64];
+    snprintf(url, sizeof url, "rtsp://127.0.0.1:%u/%s", port, streamName);
+    urls.push_back(url);
+  }
+  std::thread serverThread(runServer, serverEnv);
+
+  printf("transport\tstreams\tfps\tdecode_ms_per_frame\tcpu_pct_per_stream\tdropped\ttruncated\trss_kB\n");
+  for (unsigned useTCP = 0; useTCP <= 1; ++useTCP)
+  {
+    for (unsigned k = 1; k <= maxStreams; k *= 2)
+    {
+      options.streamUsingTCP = useTCP != 0;
+      RTSPDecodeEngine engine(options);
+      for (unsigned i = 0; i < k; ++i)
+      {
+        engine.openStream(urls[i % urls.size()].c_str(), [](unsigned, AVFrame *) {}, streamOptions);
+      }
+      std::this_thread::sleep_for(std::chrono::seconds(BENCH_DEFAULT_WARMUP_SECONDS));
+
+      RTSPDecodeEngine::Totals before, after;
+      engine.getTotals(before);
+      double cpuBefore = cpuSeconds();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      std::this_thread::sleep_for(std::chrono::seconds(measureSeconds));
+      engine.getTotals(after);
+      double cpuUsed = cpuSeconds() - cpuBefore;
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      unsigned long rss = residentSetKB();
+
+      // (Note that the CPU time includes the server's, which is small compared to decoding.)
+      unsigned long long numFrames = after.numFramesDecoded - before.numFramesDecoded;
+      printf("%s\t%u\t%.1f\t%.2f\t%.1f\t%llu\t%llu\t%lu\n", useTCP ? "tcp" : "udp", k,
+             numFrames / elapsed,
+             numFrames > 0 ? (after.decodeTimeUS - before.decodeTimeUS) / 1000.0 / numFrames : 0.0,
+             100.0 * cpuUsed / elapsed / k,
+             after.numDroppedAccessUnits - before.numDroppedAccessUnits,
+             after.numTruncatedFrames - before.numTruncatedFrames,
+             rss);
+      fflush(stdout);
+      if (engine.numOpenStreams() < k)
+      {
+        fprintf(stderr, "(only %u of the %u streams were still open at the end of the run)\n", engine.numOpenStreams(), k);
+      }
+      // (Leaving this scope closes the streams before the next run.)
+    }
+  }
+
+  serverWatchVariable = 1; // (the server's event loop checks this at least every 10 ms)
+  serverThread.join();
+  Medium::close(server);
+  serverEnv->reclaim();
+  delete serverScheduler;
+  return 0;
+}
@@ -0,0 +1,196 @@
+// A micro-benchmark of the ways of making analytics images (see "ThumbnailScaler"): for each of the common camera frame sizes,
+// and each of the analytics image sizes, it times our scalar, SSE4 and AVX2 kernels (those that this CPU supports) and
+// libswscale, on synthetic YUV420P frames, and reports each one's time per frame, its speedup over libswscale, and the largest
+// difference between its output and the scalar kernels' (which should be 0, except for libswscale).  It then checks that each
+// scaler turns a white frame into a white image, including at downscaling factors too large for the vector kernels.
+// Everything runs offline, on one machine; no streams are involved.
+
+#include "ThumbnailScaler.hh"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_DEFAULT_ITERATIONS 200
+
+static unsigned const sourceSizes[][2] = {{1920, 1080}, {1280, 720}};
+static unsigned const targetSizes[][2] = {{640, 360}, {320, 180}, {128, 72}}; // (the last is beyond THUMBNAIL_MAX_SIMD_FACTOR)
+static RTSPDecodeEngine::AnalyticsScaler const scalers[] = {
+    RTSPDecodeEngine::ANALYTICS_SCALER_SWSCALE, RTSPDecodeEngine::ANALYTICS_SCALER_SCALAR,
+    RTSPDecodeEngine::ANALYTICS_SCALER_SSE4, RTSPDecodeEngine::ANALYTICS_SCALER_AVX2};
+#define NUM_SCALERS (sizeof scalers / sizeof scalers[0])
+
+// Returns a YUV420P frame with some detail in it (gradients, plus noise), so that no kernel is flattered by uniform input:
+static AVFrame *makeTestFrame(unsigned width, unsigned height)
+{
+  AVFrame *frame = av_frame_alloc();
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = width;
+  frame->height = height;
+  if (av_frame_get_buffer(frame, 32) < 0)
+  {
+    av_frame_free(&frame);
+    return NULL;
+  }
+
+  srand(width * height);
+  for (unsigned plane = 0; plane < 3; ++plane)
+  {
+    unsigned planeWidth = plane == 0 ? width : width / 2, planeHeight = plane == 0 ? height : height / 2;
+    for (unsigned y = 0; y < planeHeight; ++y)
+    {
+      uint8_t *row = frame->data[plane] + y * frame->linesize[plane];
+      for (unsigned x = 0; x < planeWidth; ++x)
+      {
+        row[x] = (uint8_t)((x * 255 / planeWidth + y * 255 / planeHeight) / 2 + rand() % 32);
+      }
+    }
+  }
+  frame->pts = 0;
+  return frame;
+}
+
+// Returns a YUV420P frame that's all white (full-scale luma, neutral chroma), whose blocks sum to the most that they can:
+static AVFrame *makeWhiteFrame(unsigned width, unsigned height)
+{
+  AVFrame *frame = av_frame_alloc();
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = width;
+  frame->height = height;
+  if (av_frame_get_buffer(frame, 32) < 0)
+  {
+    av_frame_free(&frame);
+    return NULL;
+  }
+
+  memset(frame->data[0], 255, frame->linesize[0] * height);
+  memset(frame->data[1], 128, frame->linesize[1] * (height / 2));
+  memset(frame->data[2], 128, frame->linesize[2] * (height / 2));
+  frame->pts = 0;
+  return frame;
+}
+
+static unsigned maxDifferenceFromWhite(RTSPDecodeEngine::AnalyticsImage const &image)
+{
+  unsigned maxDiff = 0;
+  for (unsigned y = 0; y < image.height; ++y)
+  {
+    for (unsigned x = 0; x < 3 * image.width; ++x)
+    {
+      unsigned diff = 255 - image.bgr[y * image.stride + x];
+      if (diff > maxDiff)
+        maxDiff = diff;
+    }
+  }
+  return maxDiff;
+}
+
+static unsigned maxDifference(RTSPDecodeEngine::AnalyticsImage const &a, RTSPDecodeEngine::AnalyticsImage const &b)
+{
+  unsigned maxDiff = 0;
+  for (unsigned y = 0; y < a.height; ++y)
+  {
+    for (unsigned x = 0; x < 3 * a.width; ++x)
+    {
+      int diff = a.bgr[y * a.stride + x] - b.bgr[y * b.stride + x];
+      if ((unsigned)abs(diff) > maxDiff)
+        maxDiff = abs(diff);
+    }
+  }
+  return maxDiff;
+}
+
+static void usage(char const *progName)
+{
+  fprintf(stderr, "Usage: %s [-n <iterations>]\n", progName);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned iterations = BENCH_DEFAULT_ITERATIONS;
+  if (argc == 3 && strcmp(argv[1], "-n") == 0)
+    iterations = (unsigned)atoi(argv[2]);
+  else if (argc != 1)
+    iterations = 0;
+  if (iterations == 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  printf("source\ttarget\tscaler\tms_per_frame\tspeedup_vs_swscale\tmax_diff_vs_scalar\n");
+  for (unsigned s = 0; s < sizeof sourceSizes / sizeof sourceSizes[0]; ++s)
+  {
+    AVFrame *frame = makeTestFrame(sourceSizes[s][0], sourceSizes[s][1]);
+    if (frame == NULL)
+    {
+      fprintf(stderr, "Failed to allocate a %ux%u frame\n", sourceSizes[s][0], sourceSizes[s][1]);
+      return 1;
+    }
+
+    for (unsigned t = 0; t < sizeof targetSizes / sizeof targetSizes[0]; ++t)
+    {
+      unsigned width = targetSizes[t][0], height = targetSizes[t][1];
+      ThumbnailScaler reference(width, height, RTSPDecodeEngine::ANALYTICS_SCALER_SCALAR);
+      RTSPDecodeEngine::AnalyticsImage referenceImage;
+      reference.scale(frame, referenceImage);
+
+      double swscaleMS = 0.0;
+      for (unsigned i = 0; i < NUM_SCALERS; ++i)
+      {
+        ThumbnailScaler scaler(width, height, scalers[i]);
+        if (scaler.scaler() != scalers[i])
+          continue; // this CPU doesn't support it
+
+        RTSPDecodeEngine::AnalyticsImage image;
+        scaler.scale(frame, image); // (a warm-up, which also allocates anything that's allocated lazily)
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned n = 0; n < iterations; ++n)
+        {
+          scaler.scale(frame, image);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+        if (scalers[i] == RTSPDecodeEngine::ANALYTICS_SCALER_SWSCALE)
+          swscaleMS = ms;
+
+        printf("%ux%u\t%ux%u\t%s\t%.3f\t%.2f\t%u\n", sourceSizes[s][0], sourceSizes[s][1], width, height,
+               scaler.scalerName(), ms, swscaleMS / ms, maxDifference(image, referenceImage));
+      }
+    }
+    av_frame_free(&frame);
+  }
+
+  // Every kernel should saturate (rather than wrap around) when averaging white blocks:
+  int result = 0;
+  printf("\nsource\ttarget\tscaler\tmax_diff_vs_white\n");
+  for (unsigned s = 0; s < sizeof sourceSizes / sizeof sourceSizes[0]; ++s)
+  {
+    AVFrame *frame = makeWhiteFrame(sourceSizes[s][0], sourceSizes[s][1]);
+    if (frame == NULL)
+    {
+      fprintf(stderr, "Failed to allocate a %ux%u frame\n", sourceSizes[s][0], sourceSizes[s][1]);
+      return 1;
+    }
+
+    for (unsigned t = 0; t < sizeof targetSizes / sizeof targetSizes[0]; ++t)
+    {
+      for (unsigned i = 0; i < NUM_SCALERS; ++i)
+      {
+        if (scalers[i] == RTSPDecodeEngine::ANALYTICS_SCALER_SWSCALE)
+          continue; // (its own rounding isn't ours to check)
+        ThumbnailScaler scaler(targetSizes[t][0], targetSizes[t][1], scalers[i]);
+        if (scaler.scaler() != scalers[i])
+          continue; // this CPU doesn't support it
+
+        RTSPDecodeEngine::AnalyticsImage image;
+        scaler.scale(frame, image);
+        unsigned maxDiff = maxDifferenceFromWhite(image);
+        printf("%ux%u\t%ux%u\t%s\t%u\n", sourceSizes[s][0], sourceSizes[s][1], targetSizes[t][0], targetSizes[t][1],
+               scaler.scalerName(), maxDiff);
+        if (maxDiff > 0)
+          result = 1;
+      }
+    }
+    av_frame_free(&frame);
+  }
+  return result;
+}